@@ -0,0 +1,29 @@
+#ifndef __ARENA_H_
+#define __ARENA_H_
+
+#include <stddef.h>
+
+/* Bump allocator, memory is carved out of large chunks and only released
+ * all at once with arena_free()
+ */
+#define ARENA_ALIGN	32
+
+typedef struct ArenaChunk {
+	struct ArenaChunk *next;
+	size_t used, size;
+	unsigned char data[] __attribute__((aligned(ARENA_ALIGN)));
+} ArenaChunk;
+
+typedef struct Arena {
+	ArenaChunk *head;
+	size_t chunk_size;
+} Arena;
+
+#define ARENA_INIT(chunk_size)	{ NULL, chunk_size }
+
+/* Zeroed memory aligned to ARENA_ALIGN, NULL if out of memory */
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strndup(Arena *arena, const char *str, size_t len);
+void arena_free(Arena *arena);
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef __COMMAND_H_
+#define __COMMAND_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "types.h"
+#include "regs.h"
+#include "arena.h"
+
+/* Command engine shared by the console and the TUI.
+ * Text is compiled once into a CMDScript: words are split into an arena,
+ * commands are looked up and register operands resolved, so running a
+ * script again only costs its handlers. Loaded scripts are cached by path.
+ */
+
+/* Frontend callbacks */
+typedef struct CMDFrontend {
+	void (*out)(const char *str);
+	/* Show the display list for a packet, ex. a replayed step, NULL if
+	 * there is nowhere to show it
+	 */
+	void (*show)(const FetcherPacket *packet);
+	/* The display list changed, NULL if nothing to redraw */
+	void (*changed)(void);
+	/* quit command, NULL ends the calling thread */
+	void (*quit)(void);
+	/* Move the display window by `lines`, NULL if everything is shown */
+	void (*scroll)(int lines);
+} CMDFrontend;
+
+/* command_results() status bits */
+#define COMMAND_ASSERT_FAILED	(1 << 0)
+#define COMMAND_WATCH_HIT	(1 << 1)
+#define COMMAND_ERROR		(1 << 2)
+
+typedef struct CMDLine {
+	const CMDDefinition *def;
+	int argc;
+	char **argv;
+	ARMCPOperand op; /* valid if def->operand */
+	int line; /* line number in the source */
+} CMDLine;
+
+typedef struct CMDScript {
+	Arena arena; /* words, argv arrays and the lines */
+	CMDLine *lines;
+	int nr_lines;
+	char *source; /* file name, NULL for typed commands */
+} CMDScript;
+
+void command_init(const CMDFrontend *frontend);
+void command_destroy(void);
+
+/* Compile errors are reported and the line is left out */
+CMDScript *command_compile(const char *text, size_t length, const char *source);
+void command_run(const CMDScript *script);
+void command_free(CMDScript *script);
+/* Compile and run one typed line */
+void command_execute(const char *line);
+/* Run a script file quietly, -1 if it can not be read */
+int command_load(const char *path);
+
+/* Latest packet from QEMU or the replayed trace, watches are checked and
+ * the emit command's records are written here
+ */
+void command_update(const FetcherPacket *packet, uint64_t timestamp);
+/* A new QEMU connection, watches take their next value as a baseline */
+void command_resync(void);
+/* Fetcher sections the display and watch lists read (FETCHER_SUBSCRIBE_*).
+ * `fn` is called with the lock held whenever they change.
+ */
+void command_subscribe(void (*fn)(uint32_t flags));
+uint32_t command_subscription(void);
+/* Show the first step of a replayed trace */
+void command_replay(void);
+/* Print assertion failures and watch changes, return COMMAND_* bits */
+int command_results(void);
+
+/* Walk the display list. Takes no lock, the walk sees the list as it was
+ * published when it started.
+ */
+void command_for_each_hook(void (*fn)(const HookRegisters *, void *), void *arg);
+/* Walk the displays that pass the view filter, calling fn() with the
+ * position from `first` for `count` of them only. Return how many pass.
+ */
+int command_for_each_visible_hook(int first, int count, void (*fn)(const HookRegisters *, int, void *), void *arg);
+/* Value of a display or watch entry, -1 if it has none */
+int command_hook_read(const HookRegisters *hook, const FetcherPacket *packet, uint64_t *value);
+/* Value in the entry's format, "UNIMPLEMENTED" or "N/A" */
+void command_hook_format(const HookRegisters *hook, const FetcherPacket *packet, char *buf, size_t len);
+
+#endif
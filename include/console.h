@@ -2,7 +2,9 @@
 #define __CONSOLE_H_
 #include "types.h"
 
+void console_setup(void);
 void console_handle(FetcherPacket packet);
 void _console_prompt();
+void console_replay(void);
 
 #endif
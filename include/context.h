@@ -0,0 +1,49 @@
+#ifndef __CONTEXT_H_
+#define __CONTEXT_H_
+
+#include <stdint.h>
+
+#include "packet.h"
+#include "trace.h"
+
+/* Context switch timeline
+ * A switch is recorded when the ASID (from TTBR0_EL1, or TTBR1_EL1 when
+ * TCR_EL1.A1 is set) or CONTEXTIDR_EL1 differs from the previous packet,
+ * so the timeline grows by one compare per packet and holds one entry per
+ * switch. Live packets are numbered from the first one received, a trace
+ * is indexed by step with context_scan(), which skips every chunk whose
+ * columns do not change.
+ * Packets are fed from one thread at a time. Appending a switch and the
+ * readers take a lock, a packet in the same context does not.
+ */
+typedef struct ContextSwitch {
+	uint64_t step; /* first step in the context */
+	uint32_t asid;
+	uint32_t contextidr;
+} ContextSwitch;
+
+/* Time spent in one (ASID, CONTEXTIDR) pair */
+typedef struct ContextResidency {
+	uint32_t asid;
+	uint32_t contextidr;
+	uint64_t steps;
+	uint64_t switches; /* times it was switched in */
+} ContextResidency;
+
+void context_reset(void);
+/* Feed packets in step order */
+void context_update(uint64_t step, const FetcherPacket *packet);
+/* Rebuild the timeline of a whole trace */
+int context_scan(const TraceReader *tr);
+
+uint64_t context_count(void);
+/* Copy of switch `index`, -1 if there is none */
+int context_get(uint64_t index, ContextSwitch *sw);
+/* Index of the switch in effect at `step`, -1 before the first one */
+int64_t context_find(uint64_t step);
+/* Return a malloc()ed array sorted by steps, most resident first */
+ContextResidency *context_residency(uint64_t *count);
+/* Steps covered so far */
+uint64_t context_steps(void);
+
+#endif
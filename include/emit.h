@@ -0,0 +1,80 @@
+#ifndef __EMIT_H_
+#define __EMIT_H_
+
+#include <stdint.h>
+
+#include "packet.h"
+
+/* Structured output of the display list, one record per packet
+ *    1 - EMIT_FORMAT_JSON: JSON Lines,
+ *        {"seq":0,"ts":123,"pc":"0x...","regs":{"x0":"0x1","ESR_EL1.EC":null}}
+ *        Values are hex strings so 64-bit registers survive every parser,
+ *        null if the register is not implemented.
+ *    2 - EMIT_FORMAT_BINARY: fixed-layout little-endian records, an
+ *        EmitHeader followed by `count` EmitName or EmitValue entries.
+ *        A EMIT_RECORD_NAMES record comes first and again after every
+ *        change of the display list, EmitValue.id refers to it.
+ *    3 - EMIT_FORMAT_TIMELINE: Chrome/Perfetto JSON trace events. Every
+ *        display is a counter track written when its value changes, the
+ *        exception level and CONTEXTIDR_EL1 are slices on their own
+ *        threads and watch hits are instant events. Events stream out in
+ *        one pass, a file cut short still loads as the JSON Array Format
+ *        does not need the closing bracket.
+ * Records are serialized into one reusable buffer and written with
+ * write(2), there is no allocation or printf per packet. The buffer is
+ * flushed when it fills up or when the previous flush is older than
+ * EMIT_FLUSH_NS, so a slow stream is written record by record.
+ */
+#define EMIT_FORMAT_JSON	0
+#define EMIT_FORMAT_BINARY	1
+#define EMIT_FORMAT_TIMELINE	2
+
+#define EMIT_RECORD_NAMES	1
+#define EMIT_RECORD_VALUES	2
+
+#define EMIT_NAME_LEN		60
+#define EMIT_BUFFER_SIZE	(64 * 1024)
+#define EMIT_FLUSH_NS		(10 * 1000 * 1000)
+
+typedef struct EmitHeader {
+	uint32_t type; /* EMIT_RECORD_* */
+	uint32_t count;
+	uint64_t seq; /* packet number */
+	uint64_t timestamp; /* capture time, 0 for replayed steps */
+	uint64_t pc;
+} __attribute__((packed)) EmitHeader;
+
+typedef struct EmitName {
+	uint32_t id; /* display number */
+	char name[EMIT_NAME_LEN]; /* NUL padded */
+} __attribute__((packed)) EmitName;
+
+typedef struct EmitValue {
+	uint32_t id;
+	uint32_t valid; /* 0 if the register is not implemented */
+	uint64_t value;
+} __attribute__((packed)) EmitValue;
+
+/* `path` "-" is stdout, a FIFO works like a file */
+int emit_start(const char *path, int format);
+int emit_stop(void);
+int emit_active(void);
+/* Records go to stdout, messages should not */
+int emit_stdout(void);
+/* Write what is buffered */
+void emit_flush(void);
+
+/* The display list changed, emit_names_wanted() until names are sent */
+void emit_names_changed(void);
+int emit_names_wanted(void);
+void emit_names_begin(void);
+void emit_name(int id, const char *name);
+
+/* One record: emit_begin(), emit_value() for each display, emit_end() */
+void emit_begin(uint64_t seq, uint64_t timestamp, const FetcherPacket *packet);
+void emit_value(int id, const char *name, int valid, uint64_t value);
+void emit_end(void);
+/* A watch changed in the last record, timeline only */
+void emit_watch(int id, const char *name, uint64_t old, uint64_t new);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef __EPOCH_H_
+#define __EPOCH_H_
+
+/* Epoch-based reclamation
+ * Readers bracket their use of published data with epoch_enter() and
+ * epoch_exit(), which only store to a per-thread slot. A writer replaces
+ * the shared pointer first and then hands the old object to
+ * epoch_retire(). The object is freed by a later epoch_reclaim() once
+ * every reader has left the epoch that could still see it.
+ * At most EPOCH_MAX_THREADS threads may read, a slot is kept for the
+ * life of the thread. Sections nest.
+ */
+#define EPOCH_MAX_THREADS	32
+
+void epoch_enter(void);
+void epoch_exit(void);
+
+void epoch_retire(void *p, void (*destroy)(void *));
+/* Free what no reader can reach any more */
+void epoch_reclaim(void);
+/* Wait for the readers in a section to leave it, then free everything */
+void epoch_synchronize(void);
+
+#endif
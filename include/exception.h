@@ -0,0 +1,29 @@
+#ifndef __EXCEPTION_H_
+#define __EXCEPTION_H_
+
+#include <stdint.h>
+
+#include "packet.h"
+
+/* Exception record of the latest packet
+ * In exception mode the fetcher sends a FETCHER_MSG_EXCEPTION with every
+ * capture taken at an exception entry or ERET. Its fields are the EXC_*
+ * registers (ARM_CP_EXC_*, fieldoffset is in ExceptionRecord), which read
+ * as N/A for a packet captured at a gdb stop. They are live only, traces
+ * do not record them.
+ */
+typedef struct ExceptionRecord {
+	uint64_t esr;
+	uint64_t far;
+	uint64_t elr;
+	uint32_t vector;
+	uint32_t dropped;
+	uint32_t kind; /* FETCHER_EXC_* */
+	uint32_t el;
+} ExceptionRecord;
+
+/* Record of the next packet, NULL if it was not captured at an exception */
+void exception_update(const FetcherWireException *exc);
+int exception_read(uint32_t offset, int size, uint64_t *value);
+
+#endif
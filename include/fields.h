@@ -0,0 +1,47 @@
+#ifndef __FIELDS_H_
+#define __FIELDS_H_
+
+#include <stdint.h>
+
+/* Named register fields, generated from fields.def */
+typedef struct ARMCPField {
+	const char *reg;
+	const char *name;
+	uint64_t mask; /* in register position */
+	uint8_t shift;
+	uint8_t width;
+	uint16_t nr_enums;
+	const char *const *enums; /* value names indexed by field value */
+} ARMCPField;
+
+/* Compile-time shift and width, ex. TCR_EL1_T0SZ_SHIFT */
+enum {
+#define FIELD(REG, FLD, END, START, ENUMS) \
+	REG##_##FLD##_SHIFT = START, \
+	REG##_##FLD##_WIDTH = END - START + 1,
+#include "fields.def"
+#undef FIELD
+};
+
+#define FIELD_MASK(REG, FLD) \
+	((0xFFFFFFFFFFFFFFFFULL >> (64 - REG##_##FLD##_WIDTH)) << REG##_##FLD##_SHIFT)
+#define FIELD_GET(VALUE, REG, FLD) \
+	(((VALUE) & FIELD_MASK(REG, FLD)) >> REG##_##FLD##_SHIFT)
+
+/* Index in arm_cp_fields, ex. FIELD_ESR_EL1_EC */
+enum {
+#define FIELD(REG, FLD, END, START, ENUMS) FIELD_##REG##_##FLD,
+#include "fields.def"
+#undef FIELD
+	NR_ARM_CP_FIELDS
+};
+
+extern const ARMCPField arm_cp_fields[NR_ARM_CP_FIELDS];
+
+const ARMCPField *arm_cp_field_find(const char *reg, const char *field);
+/* All fields of a register, NULL if it has none */
+const ARMCPField *arm_cp_field_list(const char *reg, int *count);
+/* Name of a field value, NULL if it has none */
+const char *arm_cp_field_enum(const ARMCPField *f, uint64_t value);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef __FORMAT_H_
+#define __FORMAT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Integer formatting
+ * The display list is rendered for every packet, so values are written
+ * straight into the caller's buffer two digits at a time from lookup
+ * tables instead of going through a printf format. Nothing is terminated,
+ * each call returns the number of characters written and needs at most
+ * FORMAT_MAX_DIGITS of room.
+ */
+#define FORMAT_MAX_DIGITS	24
+
+/* Digits only, ex. "ff" */
+int format_hex_digits(char *buf, uint64_t value);
+/* Like printf's %#lx, %#lo, %lu and %ld */
+int format_hex(char *buf, uint64_t value);
+int format_oct(char *buf, uint64_t value);
+int format_udec(char *buf, uint64_t value);
+int format_dec(char *buf, int64_t value);
+/* Value in one of the FORMAT_* of types.h, %#lx for FORMAT_ADDR */
+int format_value(char *buf, uint64_t value, int format);
+
+/* Spaces after `len` characters up to `width`, return the new length */
+int format_pad(char *buf, int len, int width);
+/* `value` right-aligned in `width` columns, like %*lu */
+int format_udec_width(char *buf, uint64_t value, int width);
+
+#endif
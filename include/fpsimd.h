@@ -0,0 +1,25 @@
+#ifndef __FPSIMD_H_
+#define __FPSIMD_H_
+
+#include <stdint.h>
+
+#include "packet.h"
+
+/* FP/SIMD registers of the latest packet
+ * The fetcher only sends them while FETCHER_SUBSCRIBE_FPSIMD is set, which
+ * command.c asks for while a display or watch reads one of them. They are
+ * the ARM_CP_FP_* registers, fieldoffset is in FPSIMDState, and read as
+ * N/A for a packet without the section. They are live only, traces do not
+ * record them.
+ */
+typedef struct FPSIMDState {
+	uint64_t v[32][2]; /* bits [63:0] then [127:64] */
+	uint32_t fpsr;
+	uint32_t fpcr;
+} FPSIMDState;
+
+/* State of the next packet, NULL if it has no FP/SIMD section */
+void fpsimd_update(const FetcherWireFPSIMD *fp);
+int fpsimd_read(uint32_t offset, int size, uint64_t *value);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef __GUESTMEM_H_
+#define __GUESTMEM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Read-only view of guest physical memory.
+ * Guest RAM is shared by QEMU through a file descriptor (memfd or a shared
+ * memory-backend-file) and mapped directly into qemu-monitor, so reading
+ * guest memory never goes through QEMU.
+ */
+#define GUEST_MEM_MAX_REGIONS	16
+
+int guest_mem_attach(const char *path, uint64_t base, uint64_t size, uint64_t offset);
+int guest_mem_attach_fd(uint32_t pid, uint32_t fd, uint64_t base, uint64_t size, uint64_t offset);
+void guest_mem_detach(void);
+int guest_mem_read(uint64_t paddr, void *buf, size_t len);
+int guest_mem_regions(int index, uint64_t *base, uint64_t *size);
+
+/* Examine memory like gdb x/NFU, output goes line by line to `out`.
+ * `read` reads physical or virtual addresses, `arg` is passed on to it.
+ */
+int guest_mem_parse_format(const char *arg, int *count, char *format, int *unit);
+void guest_mem_examine(uint64_t addr, int count, char format, int unit,
+                       int (*read)(const void *, uint64_t, void *, size_t), const void *arg,
+                       void (*out)(const char *));
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef __LINES_H_
+#define __LINES_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Source lines for address display
+ * The .debug_line programs of the ELF file are decoded once into a line
+ * table sidecar, $XDG_CACHE_HOME/qemu-monitor/<build-id>.lines (or
+ * ~/.cache/...), which later sessions map as it is. The file is a
+ * LineFileHeader, LineFileRow[nr_rows] sorted by address, one string
+ * offset per file and the NUL terminated paths. Addresses are 32-bit
+ * offsets from the first executable section, a row with file
+ * LINE_FILE_NONE ends a sequence.
+ * Like the symbol table, a load publishes a new line table and retires
+ * the old one through epoch.h.
+ */
+#define LINE_MAGIC		"QMLINES"
+#define LINE_VERSION		1
+#define LINE_BUILD_ID_LEN	32
+#define LINE_FILE_NONE		0xffffffffU
+
+typedef struct LineFileHeader {
+	char magic[8]; /* LINE_MAGIC */
+	uint32_t version; /* LINE_VERSION */
+	uint32_t build_id_len;
+	uint8_t build_id[LINE_BUILD_ID_LEN];
+	uint64_t base;
+	uint32_t nr_rows;
+	uint32_t nr_files;
+	uint64_t strings_size;
+} __attribute__((packed)) LineFileHeader;
+
+typedef struct LineFileRow {
+	uint32_t addr; /* offset from base */
+	uint32_t file; /* LINE_FILE_NONE after the end of a sequence */
+	uint32_t line;
+} __attribute__((packed)) LineFileRow;
+
+/* Map the sidecar of `path`, build it first if there is none.
+ * Return -1 if the file has no usable .debug_line.
+ */
+int lines_load(const char *path);
+uint32_t lines_count(void);
+/* File and line of `addr`, NULL if unknown. The path is only valid until
+ * the caller's epoch_exit().
+ */
+const char *lines_lookup(uint64_t addr, uint32_t *line);
+/* Append " file:line" to `buf` of `len` bytes, nothing if unknown */
+void lines_format(uint64_t addr, char *buf, size_t len);
+
+#endif
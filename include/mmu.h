@@ -0,0 +1,60 @@
+#ifndef __MMU_H_
+#define __MMU_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "packet.h"
+
+/* AArch64 stage 1 translation for EL1&0, walked over the shared guest
+ * memory with the TTBR0/TTBR1/TCR/MAIR/SCTLR values of a packet.
+ * 4K, 16K and 64K granules and every start level are supported, output
+ * addresses are 48-bit.
+ */
+#define MMU_OK			0
+#define MMU_FAULT_TRANSLATION	1 /* invalid descriptor or VA out of range */
+#define MMU_FAULT_WALK_DISABLED	2 /* TCR_EL1.EPDx set */
+#define MMU_FAULT_MEMORY	3 /* table is not in shared guest memory */
+
+/* Translation regime of one packet. Each caller walks its own, the
+ * receive thread and the prompt thread may use different packets.
+ */
+typedef struct MMUContext {
+	uint64_t ttbr[2];
+	uint64_t tcr;
+	uint64_t mair;
+	uint32_t sctlr;
+} MMUContext;
+
+/* Software TLB, direct mapped on the VA page */
+#define MMU_TLB_ENTRIES		1024
+
+typedef struct MMUTranslation {
+	uint64_t va;
+	uint64_t pa;
+	uint64_t desc; /* leaf descriptor, 0 when the MMU is off */
+	int region; /* 0 - TTBR0_EL1, 1 - TTBR1_EL1 */
+	int level; /* leaf or faulting level, -1 when the MMU is off */
+	int page_shift; /* log2 of the page or block size */
+	uint16_t asid;
+	uint8_t attr; /* MAIR_EL1 attribute of the leaf */
+	uint8_t tlb_hit;
+} MMUTranslation;
+
+void mmu_context(MMUContext *ctx, const FetcherPacket *packet);
+void mmu_flush(void);
+/* Translate in `ctx`. The TLB holds one regime, it is flushed when a
+ * translation comes with other TCR_EL1, SCTLR_EL1, TTBR0_EL1 or TTBR1_EL1
+ * values.
+ */
+int mmu_translate(const MMUContext *ctx, uint64_t va, MMUTranslation *t);
+/* Copy guest virtual memory, page by page */
+int mmu_read(const MMUContext *ctx, uint64_t va, void *buf, size_t len);
+
+const char *mmu_fault_name(int fault);
+void mmu_attr_name(uint8_t attr, char *buf, size_t len);
+/* One line summary of a translation, without the trailing newline */
+void mmu_describe(const MMUTranslation *t, char *buf, size_t len);
+void mmu_stats(uint64_t *hits, uint64_t *misses, uint64_t *flushes);
+
+#endif
@@ -0,0 +1,247 @@
+#ifndef __PACKET_H_
+#define __PACKET_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <endian.h>
+
+/* This header is shared verbatim between qemu-monitor (include/packet.h)
+ * and the QEMU fetcher (target-arm/packet.h), keep both copies in sync.
+ *
+ * Wire format
+ *    Every message is a FetcherHeader followed by `length` bytes of payload.
+ *    All multi-byte fields are little-endian whatever the host is, and all
+ *    wire structures are packed with fields grouped by width, so there is no
+ *    padding hole and no host layout dependency on the wire or in a recording.
+ */
+#define FETCHER_VERSION		1
+
+/* Message type */
+#define FETCHER_MSG_REGS	1
+#define FETCHER_MSG_MEMMAP	2
+#define FETCHER_MSG_SYSREGS_LAYOUT	3
+#define FETCHER_MSG_SYSREGS	4
+/* Control messages, qemu-monitor to the fetcher */
+#define FETCHER_MSG_SUBSCRIBE	5
+#define FETCHER_MSG_KEYFRAME	6
+#define FETCHER_MSG_EXCEPTION	7
+#define FETCHER_MSG_FPSIMD	8
+
+/* Header flags */
+#define FETCHER_FLAG_BIG_ENDIAN	(1 << 0) /* raw payload in big-endian host order */
+#define FETCHER_FLAG_KEYFRAME	(1 << 1) /* state sent on request, not at a stop */
+
+typedef struct FetcherHeader {
+	uint64_t timestamp; /* CLOCK_MONOTONIC nanoseconds at capture */
+	uint32_t length; /* payload length in bytes */
+	uint16_t type; /* FETCHER_MSG_* */
+	uint8_t version; /* FETCHER_VERSION */
+	uint8_t flags;
+} __attribute__((packed)) FetcherHeader;
+
+/* In-memory register packet.
+ * Fields are grouped by width: all 64-bit registers first, then all 32-bit
+ * registers, so the struct is naturally aligned without holes and its word
+ * order is exactly the order of FetcherWireRegs.
+ */
+typedef struct FetcherPacket {
+	/* AArch64 System Registers, 64-bit */
+	uint64_t CCSIDR_EL1; /* cpu->ccsidr[env->cp15.c0_cssel] */
+	uint64_t FAR_EL1; /* env->cp15.far_el1 */
+	uint64_t VBAR_EL1; /* env->cp15.vbar_el[1] */
+	uint64_t VBAR_EL2; /* env->cp15.vbar_el[2] */
+	uint64_t VBAR_EL3; /* env->cp15.vbar_el[3] */
+	uint64_t TTBR0_EL1; /* env->cp15.ttbr0_el1 */
+	uint64_t TTBR1_EL1; /* env->cp15.ttbr1_el1 */
+	uint64_t TCR_EL1; /* env->cp15.c2_control */
+	uint64_t MAIR_EL1; /* env->cp15.mair_el1 */
+	uint64_t CNTFRQ_EL0; /* env->cp15.c14_cntfrq */
+	uint64_t CNTP_CVAL_EL0; /* env->cp15.c14_timer[GTIMER_PHYS].cval */
+	uint64_t CNTV_CVAL_EL0; /* env->cp15.c14_timer[GTIMER_VIRT].cval */
+	uint64_t TPIDR_EL0; /* env->cp15.tpidr_el0 */
+	uint64_t TPIDR_EL1; /* env->cp15.tpidr_el1 */
+	uint64_t TPIDRRO_EL0; /* env->cp15.tpidrro_el0 */
+
+	/* General Purpose Registers */
+	uint64_t xregs[32];
+	uint64_t pc;
+
+	/* AArch64 System Registers, 32-bit */
+	uint32_t MPIDR_EL1; /* cpu->cpu_index */
+	uint32_t CSSELR_EL1; /* env->cp15.c10_cssel */
+	uint32_t DCZID_EL0; /* cpu->dcz_blocksize, check target-arm/helper.c:1842 */
+	uint32_t ESR_EL1; /* env->cp15.esr_el[1] */
+	uint32_t ISR_EL1; /* check target-arm/helper.c:699 */
+	uint32_t SCTLR_EL1; /* env->cp15.c1_sys */
+	uint32_t CONTEXTIDR_EL1; /* env->cp15.contextidr_el1 */
+	uint32_t CPACR_EL1; /* env->cp15.c1_coproc */
+
+	uint32_t PMCR_EL0; /* env->cp15.c9_pmcr */
+	uint32_t PMCNTENSET_EL0; /* env->cp15.c9_pmcnten */
+	uint32_t PMCNTENCLR_EL0; /* env->cp15.c9_pmcnten */
+	uint32_t PMXEVTYPER_EL0; /* env->cp15.c9_pmxevtyper */
+	uint32_t PMUSERENR_EL0; /* env->cp15.c9_pmuserenr */
+	uint32_t PMINTENSET_EL1; /* env->cp15.c9_pminten */
+	uint32_t PMINTENCLR_EL1; /* env->cp15.c9_pminten */
+
+	uint32_t CNTKCTL_EL1; /* env->cp15.c14_cntkctl */
+	uint32_t CNTP_CTL_EL0; /* env->cp15.c14_timer[GTIMER_PHYS].ctl */
+	uint32_t CNTV_CTL_EL0; /* env->cp15.c14_timer[GTIMER_VIRT].ctl */
+
+	/* For AArch64 from AArch64, not support from AArch32.
+	 * Architectural PSTATE layout, use the SPSR_* masks below.
+	 */
+	uint32_t spsr;
+} FetcherPacket;
+
+#define SPSR_N		(1U << 31)
+#define SPSR_Z		(1U << 30)
+#define SPSR_C		(1U << 29)
+#define SPSR_V		(1U << 28)
+#define SPSR_SS		(1U << 21)
+#define SPSR_IL		(1U << 20)
+#define SPSR_D		(1U << 9)
+#define SPSR_A		(1U << 8)
+#define SPSR_I		(1U << 7)
+#define SPSR_F		(1U << 6)
+#define SPSR_M4		(1U << 4) /* M[4], Execution state */
+#define SPSR_M		0xfU /* M[3:0] */
+
+/* Number of 64-bit and 32-bit words in FetcherPacket */
+#define FETCHER_NR_REG64	(offsetof(FetcherPacket, MPIDR_EL1) / sizeof(uint64_t))
+#define FETCHER_NR_REG32	((offsetof(FetcherPacket, spsr) + sizeof(uint32_t) \
+				  - offsetof(FetcherPacket, MPIDR_EL1)) / sizeof(uint32_t))
+
+/* FETCHER_MSG_REGS payload */
+typedef struct FetcherWireRegs {
+	uint64_t r64[FETCHER_NR_REG64];
+	uint32_t r32[FETCHER_NR_REG32];
+} __attribute__((packed)) FetcherWireRegs;
+
+_Static_assert(FETCHER_NR_REG64 == 48 && FETCHER_NR_REG32 == 19,
+               "FetcherPacket layout changed, bump FETCHER_VERSION");
+_Static_assert(sizeof(FetcherWireRegs) == 48 * 8 + 19 * 4,
+               "FetcherWireRegs must not contain padding");
+
+/* FETCHER_MSG_MEMMAP payload, sent once per guest RAM block on connect.
+ * The fetcher keeps `fd` open and shared, qemu-monitor maps it read-only
+ * through /proc/<pid>/fd/<fd> and reads guest memory without asking QEMU.
+ */
+typedef struct FetcherWireMemMap {
+	uint64_t base; /* guest physical address */
+	uint64_t size;
+	uint64_t offset; /* offset of the block in fd */
+	uint32_t pid;
+	uint32_t fd;
+} __attribute__((packed)) FetcherWireMemMap;
+
+/* Raw system register capture
+ * In capture mode the fetcher copies env->cp15 and the other CPUARMState
+ * slices it knows about into one blob with memcpy and sends it as
+ * FETCHER_MSG_SYSREGS right before each FETCHER_MSG_REGS. The blob is in
+ * QEMU host byte order, FETCHER_FLAG_BIG_ENDIAN is set on the layout message
+ * for big-endian hosts. The layout, an array of FetcherWireSysreg sent once
+ * as FETCHER_MSG_SYSREGS_LAYOUT, names the registers found in the blob.
+ */
+#define FETCHER_SYSREG_NAME_LEN	32
+
+typedef struct FetcherWireSysreg {
+	char name[FETCHER_SYSREG_NAME_LEN]; /* architectural name, NUL padded */
+	uint32_t offset; /* in the FETCHER_MSG_SYSREGS payload */
+	uint32_t size; /* 4 or 8 */
+} __attribute__((packed)) FetcherWireSysreg;
+
+/* Resync on connect
+ * The socket is bidirectional. Right after accepting a connection
+ * qemu-monitor sends FETCHER_MSG_SUBSCRIBE with what it wants captured and
+ * FETCHER_MSG_KEYFRAME, which carries no payload. The fetcher answers a
+ * keyframe request with the layout and blob in capture mode and a
+ * FETCHER_MSG_REGS of the current CPU state flagged FETCHER_FLAG_KEYFRAME,
+ * so a restarted QEMU is displayed before its first stop. A fetcher that
+ * does not read control messages keeps working as before.
+ * qemu-monitor sends FETCHER_MSG_SUBSCRIBE again whenever what it wants
+ * changes. The capture mode and the exception mode stay on once set,
+ * FETCHER_SUBSCRIBE_FPSIMD is followed both ways.
+ */
+#define FETCHER_SUBSCRIBE_SYSREGS	(1 << 0) /* raw system register capture */
+#define FETCHER_SUBSCRIBE_EXCEPTIONS	(1 << 1) /* capture at exception entry and return */
+#define FETCHER_SUBSCRIBE_FPSIMD	(1 << 2) /* FP/SIMD registers, see FetcherWireFPSIMD */
+
+typedef struct FetcherWireSubscribe {
+	uint32_t flags; /* FETCHER_SUBSCRIBE_* */
+} __attribute__((packed)) FetcherWireSubscribe;
+
+/* Exception capture
+ * In exception mode (FETCHER_SUBSCRIBE_EXCEPTIONS, or FETCHER_EXCEPTIONS=1
+ * in the QEMU environment) the fetcher captures the CPU at every AArch64
+ * exception entry and ERET, not only at gdb stops. Such a capture is a
+ * FETCHER_MSG_EXCEPTION right before its FETCHER_MSG_REGS. Captures are
+ * queued and sent by a thread of their own, an exception capture that
+ * finds the queue full is dropped and counted in the next one sent.
+ */
+#define FETCHER_EXC_ENTRY	1 /* taken, the registers are those at the vector */
+#define FETCHER_EXC_RETURN	2 /* ERET, the registers are those after the return */
+
+typedef struct FetcherWireException {
+	uint64_t esr; /* ESR_ELx of the EL taking or returning from the exception */
+	uint64_t far; /* FAR_ELx */
+	uint64_t elr; /* ELR_ELx, the preferred return address */
+	uint32_t vector; /* offset from VBAR_ELx, 0 for a return */
+	uint32_t dropped; /* exception captures lost to a full queue before this one */
+	uint8_t kind; /* FETCHER_EXC_* */
+	uint8_t el; /* target EL, the EL returned to for a return */
+	uint8_t reserved[6];
+} __attribute__((packed)) FetcherWireException;
+
+_Static_assert(sizeof(FetcherWireException) == 40,
+               "FetcherWireException must not contain padding");
+
+/* FP/SIMD section
+ * The vector registers are 512 bytes, more than the rest of a packet, so
+ * they are only captured while FETCHER_SUBSCRIBE_FPSIMD is set, which
+ * qemu-monitor does while a SIMD register is displayed or watched. The
+ * section is a FETCHER_MSG_FPSIMD right before the FETCHER_MSG_REGS.
+ */
+typedef struct FetcherWireFPSIMD {
+	uint64_t v[32][2]; /* V0-V31, bits [63:0] then [127:64] */
+	uint32_t fpsr;
+	uint32_t fpcr;
+} __attribute__((packed)) FetcherWireFPSIMD;
+
+_Static_assert(sizeof(FetcherWireFPSIMD) == 32 * 16 + 8,
+               "FetcherWireFPSIMD must not contain padding");
+
+/* Conversion between the in-memory packet and the wire payload.
+ * Both are a flat run of 64-bit words followed by a run of 32-bit words, so
+ * each direction is two straight loops which the compiler turns into vector
+ * copies (or vector byte swaps on big-endian hosts).
+ */
+static inline void fetcher_regs_pack(FetcherWireRegs *dst, const FetcherPacket *src)
+{
+	const uint64_t *s64 = (const uint64_t *)src;
+	const uint32_t *s32 = (const uint32_t *)&src->MPIDR_EL1;
+	size_t i;
+
+	for(i = 0; i < FETCHER_NR_REG64; i++) {
+		dst->r64[i] = htole64(s64[i]);
+	}
+	for(i = 0; i < FETCHER_NR_REG32; i++) {
+		dst->r32[i] = htole32(s32[i]);
+	}
+}
+
+static inline void fetcher_regs_unpack(FetcherPacket *dst, const FetcherWireRegs *src)
+{
+	uint64_t *d64 = (uint64_t *)dst;
+	uint32_t *d32 = (uint32_t *)&dst->MPIDR_EL1;
+	size_t i;
+
+	for(i = 0; i < FETCHER_NR_REG64; i++) {
+		d64[i] = le64toh(src->r64[i]);
+	}
+	for(i = 0; i < FETCHER_NR_REG32; i++) {
+		d32[i] = le32toh(src->r32[i]);
+	}
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef __PROXY_H_
+#define __PROXY_H_
+
+#include <stdint.h>
+
+#include "packet.h"
+
+/* gdb remote protocol proxy
+ * Sits between gdb and the gdbstub of a stock QEMU (-gdb tcp::1234), so no
+ * fetcher patch is needed. Traffic is forwarded untouched both ways. A stop
+ * reply from QEMU is held back while the registers are read in one
+ * pipelined batch, 'g' for the core registers and 'p' for every register of
+ * QEMU's target description that a FetcherPacket field (or the FP/SIMD
+ * section) has, then passed on to gdb.
+ * Registers the gdbstub does not describe read as 0. There is no shared
+ * guest memory, capture mode or exception mode.
+ */
+
+/* Accept gdb on `port`, connect to the gdbstub at `target` (host:port) and
+ * read its target description. Return -1 on failure.
+ */
+int proxy_open(int port, const char *target, void (*report)(const char *));
+/* Forward traffic until the next stop. Return 1 with the registers read
+ * at it, 0 when either side closed. FETCHER_SUBSCRIBE_FPSIMD in
+ * `subscription` also reads the FP/SIMD registers.
+ */
+int proxy_read(FetcherPacket *packet, uint64_t *timestamp, uint32_t subscription);
+void proxy_close(void);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef __QUERY_H_
+#define __QUERY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "trace.h"
+
+/* Predicate over recorded registers
+ *    expr := and_expr ( "||" and_expr )*
+ *    and_expr := term ( "&&" term )*
+ *    term := $register[end_bit:start_bit] op number | $register.FIELD op number
+ *    op := == | != | < | <= | > | >=
+ */
+typedef struct Query Query;
+
+Query *query_compile(const char *expr, char *err, size_t errlen);
+void query_free(Query *q);
+
+int query_match(const Query *q, const FetcherPacket *packet);
+
+/* Scan the whole trace with `threads` workers (0 = one per online CPU).
+ * Return a malloc()ed array of matching steps in ascending order, NULL if
+ * a column of the trace does not decode or memory runs out.
+ */
+uint64_t *query_run(const Query *q, const TraceReader *tr, int threads, uint64_t *count);
+
+/* qemu-monitor query trace_file expr */
+int query_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef __REGS_H_
+#define __REGS_H_
+
+#include "types.h"
+#include "fields.h"
+
+extern ARMCPRegArray reg_array[16];
+
+ARMCPRegInfo *arm_cp_find(const char *name);
+int arm_cp_read(const ARMCPRegInfo *ri, const FetcherPacket *packet, uint64_t *value);
+int arm_cp_implemented(const ARMCPRegInfo *ri);
+int arm_cp_eval(const char *arg, const FetcherPacket *packet, uint64_t *value);
+
+/* Register operand
+ *    $reg, $reg[end_bit:start_bit], $reg.FIELD or $reg.* (every field)
+ *    $vN.T[lane] or $qN.T[lane], T is b, h, s or d
+ */
+typedef struct ARMCPOperand {
+	ARMCPRegInfo *reg;
+	const ARMCPField *field; /* named field, NULL for a bit range */
+	uint64_t mask;
+	int shift;
+	int all; /* $reg.* */
+} ARMCPOperand;
+
+int arm_cp_parse(const char *str, ARMCPOperand *op);
+int arm_cp_format(char *buf, size_t len, const char *name, uint64_t value, char format,
+                  const ARMCPField *field);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef __REPLAY_H_
+#define __REPLAY_H_
+
+#include <stdint.h>
+
+#include "types.h"
+#include "trace.h"
+
+int replay_open(const char *path);
+void replay_close(void);
+int replay_active(void);
+int replay_seek(int64_t step, FetcherPacket *packet);
+uint64_t replay_step(void);
+uint64_t replay_steps(void);
+const TraceReader *replay_reader(void);
+void replay_set_matches(uint64_t *steps, uint64_t count);
+int replay_next_match(uint64_t *step);
+
+#endif
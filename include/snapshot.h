@@ -0,0 +1,41 @@
+#ifndef __SNAPSHOT_H_
+#define __SNAPSHOT_H_
+
+#include <stdint.h>
+
+#include "packet.h"
+
+/* Named copies of the register state.
+ * A snapshot holds a FetcherPacket and, in the fetcher capture mode, the
+ * raw system register blob. Snapshots are carved out of an arena and never
+ * freed one by one, saving a name again shadows the older copy.
+ * "current" names the live state in snapshot_diff().
+ */
+#define SNAPSHOT_NAME_LEN	32
+#define SNAPSHOT_CURRENT	"current"
+
+/* Packet words, rounded up to whole vectors */
+#define SNAPSHOT_PACKET_WORDS	((sizeof(FetcherPacket) + 31) / 32 * 4)
+
+typedef struct Snapshot {
+	union {
+		FetcherPacket packet;
+		uint64_t words[SNAPSHOT_PACKET_WORDS]; /* zero padded */
+	} __attribute__((aligned(32)));
+	uint8_t *blob; /* zero padded to whole vectors, NULL if not captured */
+	uint32_t blob_length;
+	int big_endian;
+	char name[SNAPSHOT_NAME_LEN];
+	struct Snapshot *next;
+} Snapshot;
+
+int snapshot_save(const char *name, const FetcherPacket *packet);
+void snapshot_list(void (*out)(const char *));
+/* List every changed register and field between `a` and `b`.
+ * Return the number of changed registers, -1 if a name is unknown, -2 if
+ * out of memory.
+ */
+int snapshot_diff(const char *a, const char *b, const FetcherPacket *current,
+                  void (*out)(const char *));
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __STATS_H_
+#define __STATS_H_
+
+#include <stdint.h>
+
+/* Latency counters
+ * Nanoseconds from the capture in QEMU, the CLOCK_MONOTONIC timestamp of
+ * the packet, to the packet being received and to it being displayed, so
+ * the cost of the receive mode (blocking or --poll) shows per stop.
+ * Replayed packets are not counted.
+ */
+#define STATS_RECEIVE	0
+#define STATS_DISPLAY	1
+#define NR_STATS	2
+
+/* Receive mode shown with the counters, ex. "poll, cpu 2" */
+void stats_mode(const char *mode);
+/* Count the time from `timestamp` to now */
+void stats_record(int counter, uint64_t timestamp);
+void stats_reset(void);
+void stats_print(void (*out)(const char *));
+
+#endif
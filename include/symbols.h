@@ -0,0 +1,26 @@
+#ifndef __SYMBOLS_H_
+#define __SYMBOLS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Kernel symbols for address display
+ * The ELF file (vmlinux) is mapped read-only and its symbol table is read
+ * once into a sorted array. The start addresses are also laid out in
+ * Eytzinger (BFS) order, so a lookup walks one path from the root where
+ * the next levels share cache lines and can be prefetched, with no
+ * unpredictable branch. Names point into the mapping.
+ * A load publishes a new table and retires the old one through epoch.h,
+ * so symbol-file can run while the packet path formats addresses.
+ */
+int symbols_load(const char *path);
+/* Number of symbols, 0 if nothing is loaded */
+uint32_t symbols_count(void);
+/* Name of the symbol containing `addr`, NULL if none. The name is only
+ * valid until the caller's epoch_exit().
+ */
+const char *symbols_lookup(uint64_t addr, uint64_t *offset);
+/* Append " <name+0x24>" to `buf` of `len` bytes, nothing if unknown */
+void symbols_format(uint64_t addr, char *buf, size_t len);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __SYSREGS_H_
+#define __SYSREGS_H_
+
+#include <stdint.h>
+
+#include "packet.h"
+#include "types.h"
+
+/* Registers resolved lazily from the raw blob of the fetcher capture mode.
+ * sysregs_layout() binds the unimplemented reg_array entries named by the
+ * fetcher to offsets in the blob, their values are only read out of the
+ * latest blob when displayed or printed. reg_array is left as it is, the
+ * bindings are a table of their own that readers look up under its lock.
+ */
+int sysregs_layout(const FetcherWireSysreg *regs, int count, int big_endian);
+void sysregs_update(const void *blob, uint32_t length);
+/* Offset and size of `ri` in the blob, -1 if the layout lacks it */
+int sysregs_bound(const ARMCPRegInfo *ri, uint32_t *offset, int *size);
+int sysregs_read(const ARMCPRegInfo *ri, uint64_t *value);
+/* Copy up to `size` bytes of the latest blob, return its full length */
+uint32_t sysregs_copy(void *buf, uint32_t size, int *big_endian);
+
+#endif
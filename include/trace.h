@@ -0,0 +1,135 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "packet.h"
+
+/* Trace file format
+ *    A trace file starts with a TraceFileHeader and is followed by either
+ *    1 - TRACE_FORMAT_RAW: FETCHER_MSG_REGS messages exactly as received
+ *        from QEMU (FetcherHeader + FetcherWireRegs), one per step.
+ *    2 - TRACE_FORMAT_COLUMNAR: chunks of up to TRACE_CHUNK_STEPS steps.
+ *        Each register is a column, stored as a Gorilla-style bit stream of
+ *        either XOR-with-previous or delta-of-delta values, whichever is
+ *        smaller for that chunk. Every column descriptor carries the chunk
+ *        min/max so scans can skip chunks without decoding them. A chunk
+ *        index and TraceFileTrailer close the file.
+ *    All fields are little-endian.
+ */
+#define TRACE_MAGIC		"QMTRACE"
+#define TRACE_INDEX_MAGIC	"QMINDEX"
+
+#define TRACE_FORMAT_RAW	0
+#define TRACE_FORMAT_COLUMNAR	1
+
+#define TRACE_CHUNK_STEPS	4096
+
+/* One column per FetcherPacket word, plus the capture timestamp */
+#define TRACE_NR_COLUMNS	(FETCHER_NR_REG64 + FETCHER_NR_REG32 + 1)
+#define TRACE_COL_TIMESTAMP	(TRACE_NR_COLUMNS - 1)
+
+/* Column encoding */
+#define TRACE_ENC_CONST		0
+#define TRACE_ENC_XOR		1
+#define TRACE_ENC_DOD		2
+
+typedef struct TraceFileHeader {
+	char magic[8]; /* TRACE_MAGIC */
+	uint32_t version; /* FETCHER_VERSION of the recorded packets */
+	uint32_t chunk_steps;
+	uint16_t format; /* TRACE_FORMAT_* */
+	uint16_t columns; /* TRACE_NR_COLUMNS */
+	uint32_t reserved;
+} __attribute__((packed)) TraceFileHeader;
+
+typedef struct TraceChunkHeader {
+	uint64_t first_step;
+	uint32_t steps;
+	uint32_t length; /* bytes of column data after the descriptors */
+} __attribute__((packed)) TraceChunkHeader;
+
+typedef struct TraceColumnDesc {
+	uint64_t first; /* value of the first step */
+	uint64_t min;
+	uint64_t max;
+	uint32_t offset; /* bit stream offset in column data */
+	uint32_t length; /* bit stream length in bytes */
+	uint8_t encoding; /* TRACE_ENC_* */
+	uint8_t reserved[7];
+} __attribute__((packed)) TraceColumnDesc;
+
+typedef struct TraceIndexEntry {
+	uint64_t offset; /* file offset of TraceChunkHeader */
+	uint64_t first_step;
+	uint32_t steps;
+	uint32_t reserved;
+} __attribute__((packed)) TraceIndexEntry;
+
+typedef struct TraceFileTrailer {
+	uint64_t index_offset;
+	uint64_t nr_chunks;
+	char magic[8]; /* TRACE_INDEX_MAGIC */
+} __attribute__((packed)) TraceFileTrailer;
+
+/* Map a FetcherPacket field offset to its column */
+static inline int trace_column(ptrdiff_t fieldoffset)
+{
+	if(fieldoffset < (ptrdiff_t)(FETCHER_NR_REG64 * sizeof(uint64_t))) {
+		return fieldoffset / sizeof(uint64_t);
+	}
+	return FETCHER_NR_REG64
+	       + (fieldoffset - FETCHER_NR_REG64 * sizeof(uint64_t)) / sizeof(uint32_t);
+}
+
+static inline uint64_t trace_packet_get(const FetcherPacket *packet, int col)
+{
+	if(col < FETCHER_NR_REG64) {
+		return ((const uint64_t *)packet)[col];
+	}
+	return (&packet->MPIDR_EL1)[col - FETCHER_NR_REG64];
+}
+
+static inline void trace_packet_set(FetcherPacket *packet, int col, uint64_t value)
+{
+	if(col < FETCHER_NR_REG64) {
+		((uint64_t *)packet)[col] = value;
+	}
+	else {
+		(&packet->MPIDR_EL1)[col - FETCHER_NR_REG64] = value;
+	}
+}
+
+/* Trace writer */
+typedef struct TraceWriter TraceWriter;
+
+TraceWriter *trace_writer_open(const char *path, int format);
+int trace_writer_append(TraceWriter *tw, const FetcherPacket *packet, uint64_t timestamp);
+int trace_writer_close(TraceWriter *tw);
+
+/* Trace reader
+ * The file is mapped read-only. trace_chunk_*() do not touch shared state
+ * and may be called from several threads at once, trace_read() uses a
+ * per-reader chunk cache and may not.
+ */
+typedef struct TraceReader TraceReader;
+
+TraceReader *trace_reader_open(const char *path);
+void trace_reader_close(TraceReader *tr);
+int trace_format(const TraceReader *tr);
+uint64_t trace_steps(const TraceReader *tr);
+int trace_read(TraceReader *tr, uint64_t step, FetcherPacket *packet, uint64_t *timestamp);
+
+uint32_t trace_nr_chunks(const TraceReader *tr);
+void trace_chunk_info(const TraceReader *tr, uint32_t chunk, uint64_t *first_step, uint32_t *steps);
+int trace_chunk_range(const TraceReader *tr, uint32_t chunk, int col, uint64_t *min, uint64_t *max);
+int trace_chunk_column(const TraceReader *tr, uint32_t chunk, int col, uint64_t *out);
+
+/* Session recorder, fed by the receive thread */
+int record_start(const char *path, int format);
+void record_packet(const FetcherPacket *packet, uint64_t timestamp);
+int record_stop(void);
+int record_active(void);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef __TRACK_H_
+#define __TRACK_H_
+
+#include <stdint.h>
+
+#include "packet.h"
+#include "regs.h"
+
+/* Tracked guest memory
+ * A tracked region is read out of the shared guest memory with every live
+ * packet, at a physical address or at the virtual address a register holds
+ * in that packet (ex. the stack at $x31). Regions are split into 4 KiB
+ * pages, each page is hashed and kept once in a content-addressed store, so
+ * a region only costs a new version when a page changed or it moved, and
+ * a page that comes back costs nothing.
+ */
+#define TRACK_PAGE_SIZE		4096
+#define TRACK_MAX_LENGTH	(1024 * 1024)
+
+/* Track `length` bytes at `addr`, or at the value of `reg` when it is not
+ * NULL. Return the region id, -1 on error.
+ */
+int track_add(const char *name, const ARMCPRegInfo *reg, uint64_t addr, uint64_t length);
+int track_remove(int id);
+void track_reset(void);
+
+/* Read every region for packet `step`, steps must increase */
+void track_update(uint64_t step, const FetcherPacket *packet);
+
+void track_list(void (*out)(const char *));
+/* Versions of region `id`, the steps where it changed */
+int track_history(int id, void (*out)(const char *));
+/* Examine region `id` as it was at `step`, like x/NFU */
+int track_show(int id, uint64_t step, int count, char format, int unit, void (*out)(const char *));
+
+#endif
@@ -9,6 +9,7 @@ void ui_destroy(void);
 void display_update(FetcherPacket packet);
 void display_status(int toggle);
 void display_add(char *input);
+void display_replay(void);
 
 void console_puts(const char *str);
 void console_prompt(void);
@@ -0,0 +1,52 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+	ArenaChunk *chunk;
+	void *p;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if(arena->head == NULL || arena->head->used + size > arena->head->size) {
+		size_t chunk_size = size > arena->chunk_size ? size : arena->chunk_size;
+
+		if((chunk = aligned_alloc(ARENA_ALIGN, sizeof(ArenaChunk) + chunk_size)) == NULL) {
+			return NULL;
+		}
+		chunk->next = arena->head;
+		chunk->used = 0;
+		chunk->size = chunk_size;
+		arena->head = chunk;
+	}
+
+	p = arena->head->data + arena->head->used;
+	arena->head->used += size;
+	memset(p, 0, size);
+
+	return p;
+}
+
+char *arena_strndup(Arena *arena, const char *str, size_t len)
+{
+	char *p;
+
+	if((p = arena_alloc(arena, len + 1)) == NULL) {
+		return NULL;
+	}
+	memcpy(p, str, len);
+
+	return p;
+}
+
+void arena_free(Arena *arena)
+{
+	ArenaChunk *chunk, *next;
+
+	for(chunk = arena->head; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	arena->head = NULL;
+}
@@ -0,0 +1,2027 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "command.h"
+#include "trace.h"
+#include "replay.h"
+#include "query.h"
+#include "guestmem.h"
+#include "mmu.h"
+#include "snapshot.h"
+#include "emit.h"
+#include "symbols.h"
+#include "lines.h"
+#include "context.h"
+#include "epoch.h"
+#include "track.h"
+#include "format.h"
+#include "stats.h"
+
+#define SCRIPT_CHUNK_SIZE	(64 * 1024)
+#define MAX_LOAD_DEPTH		16
+#define HOOK_HASH_SIZE		1024
+
+/* Display or watch list, hashed on the name for duplicate checks */
+typedef struct HookList {
+	HookRegisters *head, *tail;
+	HookRegisters *hash[HOOK_HASH_SIZE];
+} HookList;
+
+/* Compiled scripts by path, reused while the file is unchanged */
+typedef struct CMDCache {
+	char *path;
+	time_t mtime;
+	off_t size;
+	CMDScript *script;
+	int busy; /* running, a nested load must not free it */
+	struct CMDCache *next;
+} CMDCache;
+
+/* Condition checked on every packet */
+typedef struct CMDAssert {
+	int id;
+	char *expr;
+	Query *query;
+	uint64_t failures;
+	struct CMDAssert *next;
+} CMDAssert;
+
+/* Failures reported one by one, the rest are only counted */
+#define ASSERT_REPORT_LIMIT	10
+
+/* What the packet path reads of the lists, never changed once published.
+ * Commands edit the lists under the lock and publish a new plan, the old
+ * plan and removed entries are freed through epoch.h when no packet can
+ * still be using them.
+ */
+typedef struct HookPlan {
+	int nr_displays, nr_visible, nr_watches, nr_asserts;
+	uint32_t subscription; /* FETCHER_SUBSCRIBE_* the entries read */
+	HookRegisters **displays;
+	HookRegisters **visible; /* displays that pass the view filter */
+	HookRegisters **watches;
+	CMDAssert **asserts;
+} HookPlan;
+
+/* Global Variables */
+static const CMDFrontend *frontend;
+/* Latest packet, a sequence lock as only the packet path writes it */
+static FetcherPacket packet;
+static unsigned int packet_seq;
+static HookList displays, watches;
+static HookPlan empty_plan;
+static HookPlan *plan = &empty_plan;
+/* The lists changed while a script was loading, see plan_changed() */
+static int plan_dirty;
+static CMDAssert *asserts, *asserts_tail;
+static uint64_t nr_packets;
+static int nr_errors;
+static int quitting;
+/* Serializes the commands that edit the lists */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* Serializes the emit output. The packet path takes it inside its epoch
+ * section, so it is never held across epoch_synchronize(). Taken after
+ * `lock` when both are.
+ */
+static pthread_mutex_t emit_lock = PTHREAD_MUTEX_INITIALIZER;
+/* The display list changed since the last plan, emit sends the names again */
+static int names_dirty;
+static CMDCache *cache;
+static const CMDScript *running_script;
+static const CMDLine *running;
+static int load_depth;
+/* The replayed trace is indexed on first use. The scan reads every chunk,
+ * it runs under its own lock so hooks and the packet path are not held up.
+ */
+static pthread_mutex_t contexts_lock = PTHREAD_MUTEX_INITIALIZER;
+static int contexts_scanned;
+/* Told when the plan needs other fetcher sections */
+static void (*subscribe)(uint32_t flags);
+/* Display name filter, empty shows all */
+static char view_filter[64];
+
+static int plan_publish(void);
+
+/* Command prototype */
+static void cmd_display(int argc, char *argv[]);
+static void cmd_undisplay(int argc, char *argv[]);
+static void cmd_print(int argc, char *argv[]);
+static void cmd_list(int argc, char *argv[]);
+static void cmd_store(int argc, char *argv[]);
+static void cmd_load(int argc, char *argv[]);
+static void cmd_record(int argc, char *argv[]);
+static void cmd_emit(int argc, char *argv[]);
+static void cmd_goto(int argc, char *argv[]);
+static void cmd_next(int argc, char *argv[]);
+static void cmd_prev(int argc, char *argv[]);
+static void cmd_query(int argc, char *argv[]);
+static void cmd_contexts(int argc, char *argv[]);
+static void cmd_x(int argc, char *argv[]);
+static void cmd_mem(int argc, char *argv[]);
+static void cmd_translate(int argc, char *argv[]);
+static void cmd_snapshot(int argc, char *argv[]);
+static void cmd_track(int argc, char *argv[]);
+static void cmd_untrack(int argc, char *argv[]);
+static void cmd_watch(int argc, char *argv[]);
+static void cmd_unwatch(int argc, char *argv[]);
+static void cmd_assert(int argc, char *argv[]);
+static void cmd_symbol_file(int argc, char *argv[]);
+static void cmd_refresh(int argc, char *argv[]);
+static void cmd_view(int argc, char *argv[]);
+static void cmd_stats(int argc, char *argv[]);
+static void cmd_quit(int argc, char *argv[]);
+static void cmd_help(int argc, char *argv[]);
+
+static const CMDDefinition cmd[] = {
+	{.name = "display", .handler = cmd_display, .operand = 1,
+	 .desc = "* Display a register or part of it every step, in format(d, x, o, u, a).\n"
+		 "  -> display $register_name[end_bit:start_bit]\n"
+		 "  -> display /x $register_name.field_name"},
+	{.name = "undisplay", .handler = cmd_undisplay,
+	 .desc = "* Remove a register from the display list.\n"
+		 "  -> undisplay display_number"},
+	{.name = "print", .handler = cmd_print, .operand = 1,
+	 .desc = "* Print a register, a bit range, a named field or every field.\n"
+		 "  -> print /x $register_name[end_bit:start_bit]\n"
+		 "  -> print $TCR_EL1.T0SZ\n"
+		 "  -> print $TCR_EL1.*"},
+	{.name = "list", .handler = cmd_list,
+	 .desc = "* List all registers.\n"
+		 "  -> list"},
+	{.name = "store", .handler = cmd_store,
+	 .desc = "* Store the display and watch lists as a command script.\n"
+		 "  -> store [file_name]"},
+	{.name = "load", .handler = cmd_load,
+	 .desc = "* Run a command script, like gdb -x.\n"
+		 "  -> load [file_name]"},
+	{.name = "record", .handler = cmd_record,
+	 .desc = "* Record received packets to a trace file, /c selects the compressed columnar format.\n"
+		 "  -> record [/c] file_name\n"
+		 "  -> record stop"},
+	{.name = "emit", .handler = cmd_emit,
+	 .desc = "* Write the display list of every packet as JSON Lines(/j), binary records(/b)\n"
+		 "  or a Chrome/Perfetto timeline(/t), to a file, a pipe or stdout(-).\n"
+		 "  -> emit [/j] file_name\n"
+		 "  -> emit /b -\n"
+		 "  -> emit /t boot.json\n"
+		 "  -> emit stop"},
+	{.name = "goto", .handler = cmd_goto,
+	 .desc = "* Jump to a step of the replayed trace(-replay mode only).\n"
+		 "  -> goto step"},
+	{.name = "next", .handler = cmd_next,
+	 .desc = "* Step forward in the replayed trace(-replay mode only).\n"
+		 "  -> next [count]"},
+	{.name = "prev", .handler = cmd_prev,
+	 .desc = "* Step backward in the replayed trace(-replay mode only).\n"
+		 "  -> prev [count]"},
+	{.name = "query", .handler = cmd_query,
+	 .desc = "* Search the replayed trace and jump to the next match(-replay mode only).\n"
+		 "  -> query $pc >= 0xffff000008080000 && $ESR_EL1[31:26] == 0x15\n"
+		 "  -> query"},
+	{.name = "contexts", .handler = cmd_contexts,
+	 .desc = "* Show the time spent in each (ASID, CONTEXTIDR_EL1) pair, or jump to a context switch\n"
+		 "  (-replay mode only) by number, or the next or previous one.\n"
+		 "  -> contexts\n"
+		 "  -> contexts switch_number\n"
+		 "  -> contexts next\n"
+		 "  -> contexts prev"},
+	{.name = "x", .handler = cmd_x,
+	 .desc = "* Examine guest memory, N units in format(x, d, u, o) of size(b, h, w, g).\n"
+		 "  A number is a physical address, a register is translated as a virtual address.\n"
+		 "  -> x/NFU address\n"
+		 "  -> x/4xg 0x40080000\n"
+		 "  -> x/4xg $x31"},
+	{.name = "mem", .handler = cmd_mem,
+	 .desc = "* Show guest memory shared by QEMU, or map a shared memory-backend-file.\n"
+		 "  -> mem\n"
+		 "  -> mem attach file_name guest_physical_address"},
+	{.name = "translate", .handler = cmd_translate,
+	 .desc = "* Translate a virtual address with the current TTBR/TCR, or show TLB statistics.\n"
+		 "  -> translate address\n"
+		 "  -> translate $FAR_EL1\n"
+		 "  -> translate"},
+	{.name = "snapshot", .handler = cmd_snapshot,
+	 .desc = "* Save the registers under a name, or list what changed between two snapshots.\n"
+		 "  \"current\" is the live state, the default second snapshot of diff.\n"
+		 "  -> snapshot save name\n"
+		 "  -> snapshot diff before after\n"
+		 "  -> snapshot diff before\n"
+		 "  -> snapshot list"},
+	{.name = "track", .handler = cmd_track,
+	 .desc = "* Keep the contents of guest memory with every packet, list the tracked regions, list\n"
+		 "  the packets where a region changed or examine it as it was at a packet(x/NFU format).\n"
+		 "  A number is a physical address, a register is read as a virtual address in every packet.\n"
+		 "  -> track mem address [length]\n"
+		 "  -> track mem $x31 8192\n"
+		 "  -> track history track_number\n"
+		 "  -> track show [/NFU] track_number [packet]\n"
+		 "  -> track"},
+	{.name = "untrack", .handler = cmd_untrack,
+	 .desc = "* Stop tracking a memory region.\n"
+		 "  -> untrack track_number"},
+	{.name = "watch", .handler = cmd_watch, .operand = 1,
+	 .desc = "* Report every change of a register or part of it, or list the watches.\n"
+		 "  -> watch $register_name[end_bit:start_bit]\n"
+		 "  -> watch $ESR_EL1.EC\n"
+		 "  -> watch"},
+	{.name = "unwatch", .handler = cmd_unwatch,
+	 .desc = "* Remove a watch.\n"
+		 "  -> unwatch watch_number"},
+	{.name = "assert", .handler = cmd_assert,
+	 .desc = "* Check a condition on every packet and report when it does not hold, or list the assertions.\n"
+		 "  Same expressions as query.\n"
+		 "  -> assert $ESR_EL1.EC != 0x25\n"
+		 "  -> assert"},
+	{.name = "symbol-file", .handler = cmd_symbol_file,
+	 .desc = "* Load the symbols and source lines of an ELF file, shown after pc, x30 and /a values.\n"
+		 "  -> symbol-file vmlinux\n"
+		 "  -> symbol-file"},
+	{.name = "refresh", .handler = cmd_refresh,
+	 .desc = "* Show the display list again.\n"
+		 "  -> refresh"},
+	{.name = "view", .handler = cmd_view,
+	 .desc = "* Show only the displays whose name contains a text, or scroll the display window(TUI only,\n"
+		 "  Shift+PageUp and Shift+PageDown also scroll).\n"
+		 "  -> view filter ESR\n"
+		 "  -> view filter\n"
+		 "  -> view down [lines]\n"
+		 "  -> view up [lines]\n"
+		 "  -> view"},
+	{.name = "stats", .handler = cmd_stats,
+	 .desc = "* Show the latency from a capture in QEMU to the packet being received and displayed,\n"
+		 "  or clear it.\n"
+		 "  -> stats\n"
+		 "  -> stats reset"},
+	{.name = "quit", .handler = cmd_quit,
+	 .desc = "* Terminate qemu-monitor.\n"
+		 "  -> quit"},
+	{.name = "help", .handler = cmd_help,
+	 .desc = "* Show this help guide.\n"
+		 "  -> help"},
+};
+
+#define NR_COMMANDS	(sizeof(cmd) / sizeof(CMDDefinition))
+
+/* Output
+ * cmd_out - results, always shown
+ * cmd_info - confirmations, quiet while a script runs
+ * cmd_error - prefixed with the script position while a script runs
+ */
+static void cmd_vout(const char *prefix, const char *fmt, va_list ap)
+{
+	char str[512], *p = str;
+	va_list aq;
+	int n, len = 0;
+
+	if(prefix) {
+		len = snprintf(str, sizeof(str), "%s", prefix);
+	}
+	va_copy(aq, ap);
+	n = vsnprintf(str + len, sizeof(str) - len, fmt, aq);
+	va_end(aq);
+	if(n >= (int)sizeof(str) - len && (p = malloc(len + n + 1)) != NULL) {
+		memcpy(p, str, len);
+		vsnprintf(p + len, n + 1, fmt, ap);
+	}
+
+	frontend->out(p ? p : str);
+	if(p != str) {
+		free(p);
+	}
+}
+
+static void cmd_out(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static void cmd_out(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	cmd_vout(NULL, fmt, ap);
+	va_end(ap);
+}
+
+static void cmd_info(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static void cmd_info(const char *fmt, ...)
+{
+	va_list ap;
+
+	if(load_depth > 0) {
+		return;
+	}
+	va_start(ap, fmt);
+	cmd_vout(NULL, fmt, ap);
+	va_end(ap);
+}
+
+static void cmd_report(const char *source, int line, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+static void cmd_report(const char *source, int line, const char *fmt, ...)
+{
+	char prefix[256];
+	va_list ap;
+
+	nr_errors++;
+	if(source) {
+		snprintf(prefix, sizeof(prefix), "%s:%d: ", source, line);
+	}
+	va_start(ap, fmt);
+	cmd_vout(source ? prefix : NULL, fmt, ap);
+	va_end(ap);
+}
+
+#define cmd_error(fmt, ...) \
+	cmd_report(running_script ? running_script->source : NULL, running ? running->line : 0, \
+	           fmt, ##__VA_ARGS__)
+
+/* Register operand of the running line, resolved when it was compiled */
+static int cmd_operand(const char *arg, ARMCPOperand *op)
+{
+	if(running && running->def->operand && running->op.reg && arg == running->argv[running->argc - 1]) {
+		*op = running->op;
+		return 0;
+	}
+
+	return arm_cp_parse(arg, op) == (int)strlen(arg) ? 0 : -1;
+}
+
+/* Compiler */
+static int is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/* Split one line into `argv`, NULL to only count the words */
+static int split_words(Arena *arena, const char *p, const char *end, char **argv)
+{
+	const char *word, *slash;
+	int count = 0;
+
+	while(1) {
+		for(; p < end && is_space(*p); p++);
+		if(p == end) {
+			break;
+		}
+		for(word = p; p < end && !is_space(*p); p++);
+
+		/* gdb style "x/4xg": split the format from the command name */
+		if(count == 0 && (slash = memchr(word, '/', p - word)) != NULL && slash != word) {
+			if(argv) {
+				argv[count] = arena_strndup(arena, word, slash - word);
+			}
+			count++;
+			word = slash;
+		}
+		if(argv) {
+			argv[count] = arena_strndup(arena, word, p - word);
+		}
+		count++;
+	}
+
+	return count;
+}
+
+static const CMDDefinition *cmd_find(const char *name)
+{
+	int i;
+
+	for(i = 0; i < NR_COMMANDS; i++) {
+		if(!strcmp(cmd[i].name, name)) {
+			return &cmd[i];
+		}
+	}
+
+	return NULL;
+}
+
+CMDScript *command_compile(const char *text, size_t length, const char *source)
+{
+	CMDScript *script;
+	CMDLine *cl;
+	Arena arena = ARENA_INIT(SCRIPT_CHUNK_SIZE);
+	const char *p = text, *end = text + length, *eol, *s;
+	char **words;
+	int nr_lines = 1, line, count;
+	size_t i;
+
+	for(i = 0; i < length; i++) {
+		nr_lines += text[i] == '\n';
+	}
+	if((script = arena_alloc(&arena, sizeof(CMDScript))) == NULL
+	   || (script->lines = arena_alloc(&arena, nr_lines * sizeof(CMDLine))) == NULL) {
+		arena_free(&arena);
+		return NULL;
+	}
+	script->source = source ? arena_strndup(&arena, source, strlen(source)) : NULL;
+
+	for(line = 1; p < end; line++, p = eol + 1) {
+		if((eol = memchr(p, '\n', end - p)) == NULL) {
+			eol = end;
+		}
+		/* Blank lines and comments */
+		for(s = p; s < eol && is_space(*s); s++);
+		if(s == eol || *s == '#') {
+			continue;
+		}
+
+		count = split_words(&arena, p, eol, NULL);
+		if((words = arena_alloc(&arena, (count + 1) * sizeof(char *))) == NULL) {
+			break;
+		}
+		split_words(&arena, p, eol, words);
+
+		cl = &script->lines[script->nr_lines];
+		memset(cl, 0, sizeof(*cl));
+		if((cl->def = cmd_find(words[0])) == NULL) {
+			cmd_report(script->source, line, "Undefined command \"%s\"\n", words[0]);
+			continue;
+		}
+		cl->argc = count - 1;
+		cl->argv = words + 1;
+		cl->line = line;
+
+		/* Resolve the register once, not every time the line runs */
+		if(cl->def->operand && cl->argc > 0 && cl->argv[cl->argc - 1][0] == '$') {
+			s = cl->argv[cl->argc - 1];
+			if(arm_cp_parse(s, &cl->op) != (int)strlen(s)) {
+				cmd_report(script->source, line, "Invalid register name \"%s\"\n", s);
+				continue;
+			}
+		}
+		script->nr_lines++;
+	}
+
+	script->arena = arena;
+
+	return script;
+}
+
+void command_free(CMDScript *script)
+{
+	Arena arena;
+
+	if(script) {
+		/* The script lives in its own arena */
+		arena = script->arena;
+		arena_free(&arena);
+	}
+}
+
+void command_run(const CMDScript *script)
+{
+	const CMDScript *saved_script = running_script;
+	const CMDLine *saved = running;
+	int i;
+
+	running_script = script;
+	for(i = 0; i < script->nr_lines && !quitting; i++) {
+		running = &script->lines[i];
+		running->def->handler(running->argc, running->argv);
+	}
+	running_script = saved_script;
+	running = saved;
+}
+
+void command_execute(const char *line)
+{
+	CMDScript *script;
+
+	if((script = command_compile(line, strlen(line), NULL)) != NULL) {
+		command_run(script);
+		command_free(script);
+	}
+}
+
+static char *read_file(const char *path, size_t *length)
+{
+	FILE *fin;
+	char *buf = NULL, *tmp;
+	size_t size = 0, n;
+
+	if((fin = fopen(path, "r")) == NULL) {
+		return NULL;
+	}
+
+	*length = 0;
+	do {
+		if(*length == size) {
+			size = size ? size * 2 : 64 * 1024;
+			if((tmp = realloc(buf, size)) == NULL) {
+				free(buf);
+				fclose(fin);
+				return NULL;
+			}
+			buf = tmp;
+		}
+		n = fread(buf + *length, 1, size - *length, fin);
+		*length += n;
+	} while(n > 0);
+
+	fclose(fin);
+
+	return buf;
+}
+
+/* Compile a script file, or reuse the cached compilation */
+static int load_file(const char *path)
+{
+	CMDCache *c;
+	CMDScript *script;
+	struct stat st;
+	size_t length;
+	char *text;
+
+	if(stat(path, &st) < 0) {
+		return -1;
+	}
+
+	for(c = cache; c; c = c->next) {
+		if(!strcmp(c->path, path)) {
+			break;
+		}
+	}
+
+	if(c == NULL || c->busy || c->mtime != st.st_mtime || c->size != st.st_size) {
+		if((text = read_file(path, &length)) == NULL) {
+			return -1;
+		}
+		script = command_compile(text, length, path);
+		free(text);
+		if(script == NULL) {
+			return -1;
+		}
+
+		/* A script loading itself runs its own copy */
+		if(c && c->busy) {
+			command_run(script);
+			command_free(script);
+			return 0;
+		}
+		if(c == NULL) {
+			if((c = calloc(1, sizeof(CMDCache))) == NULL) {
+				command_free(script);
+				return -1;
+			}
+			c->path = strdup(path);
+			c->next = cache;
+			cache = c;
+		}
+		command_free(c->script);
+		c->script = script;
+		c->mtime = st.st_mtime;
+		c->size = st.st_size;
+	}
+
+	c->busy = 1;
+	command_run(c->script);
+	c->busy = 0;
+
+	return 0;
+}
+
+int command_load(const char *path)
+{
+	int ret;
+
+	load_depth++;
+	ret = load_file(path);
+	load_depth--;
+
+	/* One plan for the whole script, not one per line */
+	if(load_depth == 0 && plan_dirty) {
+		pthread_mutex_lock(&lock);
+		plan_publish();
+		pthread_mutex_unlock(&lock);
+	}
+
+	return ret;
+}
+
+/* Display and watch lists */
+static unsigned int hook_hash(const char *name)
+{
+	unsigned int h = 2166136261u;
+
+	for(; *name; name++) {
+		h = (h ^ (*name | 0x20)) * 16777619u;
+	}
+
+	return h % HOOK_HASH_SIZE;
+}
+
+static void packet_publish(const FetcherPacket *new_packet)
+{
+	__atomic_store_n(&packet_seq, packet_seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	packet = *new_packet;
+	__atomic_store_n(&packet_seq, packet_seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Consistent copy of the latest packet */
+static void packet_current(FetcherPacket *out)
+{
+	unsigned int seq;
+
+	do {
+		while((seq = __atomic_load_n(&packet_seq, __ATOMIC_ACQUIRE)) & 1);
+		*out = packet;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while(__atomic_load_n(&packet_seq, __ATOMIC_RELAXED) != seq);
+}
+
+/* Reader side, no lock is taken */
+static const HookPlan *plan_enter(void)
+{
+	epoch_enter();
+
+	return __atomic_load_n(&plan, __ATOMIC_ACQUIRE);
+}
+
+static void plan_exit(void)
+{
+	epoch_exit();
+}
+
+static void plan_free(void *p)
+{
+	if(p != &empty_plan) {
+		free(p);
+	}
+}
+
+/* Fetcher section an entry reads, asked for only while it is in a list */
+static uint32_t hook_subscription(const HookRegisters *hook)
+{
+	if(hook->reg->type == ARM_CP_FP_L || hook->reg->type == ARM_CP_FP_H) {
+		return FETCHER_SUBSCRIBE_FPSIMD;
+	}
+
+	return 0;
+}
+
+/* Publish the lists as they are now, caller holds the lock.
+ * Return -1 if out of memory, the old plan stays.
+ */
+static int plan_publish(void)
+{
+	HookPlan *p;
+	HookRegisters *it, **slot;
+	CMDAssert *a;
+	int nr_displays = 0, nr_watches = 0, nr_asserts = 0;
+
+	for(it = displays.head; it != NULL; it = it->next, nr_displays++);
+	for(it = watches.head; it != NULL; it = it->next, nr_watches++);
+	for(a = asserts; a != NULL; a = a->next, nr_asserts++);
+
+	/* One block: the plan, then its arrays */
+	if((p = malloc(sizeof(HookPlan) + (2 * nr_displays + nr_watches + nr_asserts) * sizeof(void *))) == NULL) {
+		return -1;
+	}
+	slot = (HookRegisters **)(p + 1);
+	p->displays = slot;
+	p->visible = slot + nr_displays;
+	p->watches = slot + 2 * nr_displays;
+	p->asserts = (CMDAssert **)(slot + 2 * nr_displays + nr_watches);
+	p->nr_displays = p->nr_visible = p->nr_watches = p->nr_asserts = 0;
+	p->subscription = 0;
+
+	for(it = displays.head; it != NULL; it = it->next) {
+		p->displays[p->nr_displays++] = it;
+		p->subscription |= hook_subscription(it);
+		if(!it->hidden) {
+			p->visible[p->nr_visible++] = it;
+		}
+	}
+	for(it = watches.head; it != NULL; it = it->next) {
+		p->watches[p->nr_watches++] = it;
+		p->subscription |= hook_subscription(it);
+	}
+	for(a = asserts; a != NULL; a = a->next) {
+		p->asserts[p->nr_asserts++] = a;
+	}
+	if(subscribe && p->subscription != plan->subscription) {
+		subscribe(p->subscription);
+	}
+
+	/* Records of the new plan follow its names */
+	pthread_mutex_lock(&emit_lock);
+	epoch_retire(__atomic_exchange_n(&plan, p, __ATOMIC_ACQ_REL), plan_free);
+	if(names_dirty) {
+		emit_names_changed();
+		names_dirty = 0;
+	}
+	pthread_mutex_unlock(&emit_lock);
+	epoch_reclaim();
+	plan_dirty = 0;
+
+	return 0;
+}
+
+/* The lists were edited, caller holds the lock. A script publishes once
+ * when it is done, so loading stays linear in its length.
+ */
+static void plan_changed(void)
+{
+	if(load_depth > 0) {
+		plan_dirty = 1;
+		return;
+	}
+	plan_publish();
+}
+
+/* Case-insensitive substring match against the view filter */
+static int view_match(const char *name)
+{
+	size_t len = strlen(view_filter);
+
+	for(; *name; name++) {
+		if(!strncasecmp(name, view_filter, len)) {
+			return 1;
+		}
+	}
+
+	return len == 0;
+}
+
+/* Return the new entry, NULL if `name` is already in the list */
+static HookRegisters *hook_add(HookList *list, const char *name, const ARMCPOperand *op, int format)
+{
+	HookRegisters *it, *tmp;
+	unsigned int h = hook_hash(name);
+
+	for(it = list->hash[h]; it != NULL; it = it->hash_next) {
+		if(!strcasecmp(it->name, name)) {
+			return NULL;
+		}
+	}
+
+	if((tmp = calloc(1, sizeof(HookRegisters))) == NULL) {
+		return NULL;
+	}
+	snprintf(tmp->name, sizeof(tmp->name), "%s", name);
+	tmp->mask = op->mask;
+	tmp->reg = op->reg;
+	tmp->start_bit = op->shift;
+	tmp->format = format;
+	tmp->hidden = list == &displays && !view_match(name);
+
+	tmp->id = list->tail ? list->tail->id + 1 : 0;
+	if(list->tail) {
+		list->tail->next = tmp;
+	}
+	else {
+		list->head = tmp;
+	}
+	list->tail = tmp;
+	tmp->hash_next = list->hash[h];
+	list->hash[h] = tmp;
+
+	return tmp;
+}
+
+/* Unlink the entry numbered `id`, the caller frees it */
+static HookRegisters *hook_remove(HookList *list, int id)
+{
+	HookRegisters *it, *prev, **pp;
+
+	for(prev = NULL, it = list->head; it != NULL; prev = it, it = it->next) {
+		if(it->id == id) {
+			break;
+		}
+	}
+	if(it == NULL) {
+		return NULL;
+	}
+
+	if(prev) {
+		prev->next = it->next;
+	}
+	else {
+		list->head = it->next;
+	}
+	if(list->tail == it) {
+		list->tail = prev;
+	}
+	for(pp = &list->hash[hook_hash(it->name)]; *pp != it; pp = &(*pp)->hash_next);
+	*pp = it->hash_next;
+
+	return it;
+}
+
+static void hook_clear(HookList *list)
+{
+	HookRegisters *it, *next;
+
+	for(it = list->head; it != NULL; it = next) {
+		next = it->next;
+		free(it);
+	}
+	memset(list, 0, sizeof(*list));
+}
+
+int command_hook_read(const HookRegisters *hook, const FetcherPacket *packet, uint64_t *value)
+{
+	if(arm_cp_read(hook->reg, packet, value) < 0) {
+		return -1;
+	}
+	*value = (*value & hook->mask) >> hook->start_bit;
+
+	return 0;
+}
+
+void command_hook_format(const HookRegisters *hook, const FetcherPacket *packet, char *buf, size_t len)
+{
+	char tmp[FORMAT_MAX_DIGITS];
+	uint64_t value;
+	int n;
+
+	if(command_hook_read(hook, packet, &value) < 0) {
+		snprintf(buf, len, "%s", arm_cp_implemented(hook->reg) ? "N/A" : "UNIMPLEMENTED");
+		return;
+	}
+	if(len == 0) {
+		return;
+	}
+
+	/* Once per display a packet, no format string to parse */
+	n = format_value(tmp, value, hook->format);
+	n = n < len ? n : len - 1;
+	memcpy(buf, tmp, n);
+	buf[n] = '\0';
+	if(hook->format == FORMAT_ADDR) {
+		symbols_format(value, buf, len);
+		lines_format(value, buf, len);
+	}
+}
+
+void command_for_each_hook(void (*fn)(const HookRegisters *, void *), void *arg)
+{
+	const HookPlan *p = plan_enter();
+	int i;
+
+	for(i = 0; i < p->nr_displays; i++) {
+		fn(p->displays[i], arg);
+	}
+	plan_exit();
+}
+
+int command_for_each_visible_hook(int first, int count, void (*fn)(const HookRegisters *, int, void *), void *arg)
+{
+	const HookPlan *p = plan_enter();
+	int i, total = p->nr_visible;
+
+	/* Rows off the window are not even touched */
+	for(i = first > 0 ? first : 0; i < total && i - first < count; i++) {
+		fn(p->visible[i], i - first, arg);
+	}
+	plan_exit();
+
+	return total;
+}
+
+/* One structured record of the display list */
+static void command_emit(const HookPlan *p, const FetcherPacket *new_packet, uint64_t timestamp)
+{
+	HookRegisters *it;
+	uint64_t value = 0;
+	int valid, i;
+
+	if(emit_names_wanted()) {
+		emit_names_begin();
+		for(i = 0; i < p->nr_displays; i++) {
+			emit_name(p->displays[i]->id, p->displays[i]->name);
+		}
+		emit_end();
+	}
+
+	emit_begin(nr_packets, timestamp, new_packet);
+	for(i = 0; i < p->nr_displays; i++) {
+		it = p->displays[i];
+		valid = command_hook_read(it, new_packet, &value) == 0;
+		emit_value(it->id, it->name, valid, value);
+	}
+	emit_end();
+}
+
+void command_update(const FetcherPacket *new_packet, uint64_t timestamp)
+{
+	const HookPlan *p;
+	CMDAssert *a;
+	HookRegisters *it;
+	uint64_t value;
+	int i;
+
+	packet_publish(new_packet);
+	/* Replay seeks are not in step order, the trace is scanned instead */
+	if(!replay_active()) {
+		context_update(nr_packets, new_packet);
+		/* Guest memory is live, a replayed packet has none of its own */
+		track_update(nr_packets, new_packet);
+	}
+
+	p = plan_enter();
+	/* Output is the one shared resource, emit stop closes it under emit_lock */
+	if(emit_active()) {
+		pthread_mutex_lock(&emit_lock);
+		if(emit_active()) {
+			command_emit(p, new_packet, timestamp);
+		}
+		pthread_mutex_unlock(&emit_lock);
+	}
+	for(i = 0; i < p->nr_watches; i++) {
+		it = p->watches[i];
+		if(command_hook_read(it, new_packet, &value) < 0) {
+			continue;
+		}
+		if(it->seen && value != it->last) {
+			it->hits++;
+			cmd_out("Watch %d: %s 0x%lx -> 0x%lx\n", it->id, it->name, it->last, value);
+			/* Same output as the records, emit stop may be closing it */
+			if(emit_active()) {
+				pthread_mutex_lock(&emit_lock);
+				if(emit_active()) {
+					emit_watch(it->id, it->name, it->last, value);
+				}
+				pthread_mutex_unlock(&emit_lock);
+			}
+		}
+		it->last = value;
+		it->seen = 1;
+	}
+	for(i = 0; i < p->nr_asserts; i++) {
+		a = p->asserts[i];
+		if(query_match(a->query, new_packet)) {
+			continue;
+		}
+		if(a->failures++ < ASSERT_REPORT_LIMIT) {
+			cmd_out("Assertion %d failed at packet %lu: %s\n", a->id, nr_packets, a->expr);
+		}
+	}
+	plan_exit();
+	__atomic_store_n(&nr_packets, nr_packets + 1, __ATOMIC_RELAXED);
+}
+
+/* Called by the packet path between packets */
+void command_resync(void)
+{
+	const HookPlan *p = plan_enter();
+	int i;
+
+	for(i = 0; i < p->nr_watches; i++) {
+		p->watches[i]->seen = 0;
+	}
+	plan_exit();
+}
+
+void command_init(const CMDFrontend *fe)
+{
+	frontend = fe;
+}
+
+void command_subscribe(void (*fn)(uint32_t flags))
+{
+	pthread_mutex_lock(&lock);
+	subscribe = fn;
+	pthread_mutex_unlock(&lock);
+}
+
+uint32_t command_subscription(void)
+{
+	const HookPlan *p = plan_enter();
+	uint32_t flags = p->subscription;
+
+	plan_exit();
+
+	return flags;
+}
+
+int command_results(void)
+{
+	CMDAssert *a;
+	HookRegisters *it;
+	int status = nr_errors ? COMMAND_ERROR : 0;
+
+	pthread_mutex_lock(&lock);
+	cmd_out("%lu packets\n", nr_packets);
+	for(a = asserts; a != NULL; a = a->next) {
+		cmd_out("Assertion %d: %s: %s\n", a->id, a->expr, a->failures ? "FAILED" : "passed");
+		if(a->failures) {
+			cmd_out("  %lu failures\n", a->failures);
+			status |= COMMAND_ASSERT_FAILED;
+		}
+	}
+	for(it = watches.head; it != NULL; it = it->next) {
+		cmd_out("Watch %d: %s: %lu change%s\n", it->id, it->name, it->hits, it->hits == 1 ? "" : "s");
+		if(it->hits) {
+			status |= COMMAND_WATCH_HIT;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	return status;
+}
+
+void command_destroy(void)
+{
+	CMDCache *c, *next;
+	CMDAssert *a, *a_next;
+
+	/* Nothing may read the lists after the wait. A packet still in its
+	 * section may be waiting for emit_lock, so no lock is held here.
+	 */
+	epoch_retire(__atomic_exchange_n(&plan, &empty_plan, __ATOMIC_ACQ_REL), plan_free);
+	epoch_synchronize();
+	pthread_mutex_lock(&lock);
+	hook_clear(&displays);
+	hook_clear(&watches);
+	context_reset();
+	track_reset();
+	for(a = asserts; a != NULL; a = a_next) {
+		a_next = a->next;
+		query_free(a->query);
+		free(a->expr);
+		free(a);
+	}
+	asserts = asserts_tail = NULL;
+	pthread_mutex_lock(&emit_lock);
+	emit_stop();
+	pthread_mutex_unlock(&emit_lock);
+	pthread_mutex_unlock(&lock);
+
+	for(c = cache; c; c = next) {
+		next = c->next;
+		command_free(c->script);
+		free(c->path);
+		free(c);
+	}
+	cache = NULL;
+}
+
+/* Command handler implementation */
+static int parse_format(const char *arg, int *format)
+{
+	if(arg[0] != '/' || arg[2] != '\0') {
+		return -1;
+	}
+
+	switch(arg[1]) {
+	case 'd':
+		*format = FORMAT_DEC;
+		break;
+	case 'o':
+		*format = FORMAT_OCT;
+		break;
+	case 'x':
+		*format = FORMAT_HEX;
+		break;
+	case 'u':
+		*format = FORMAT_UNS;
+		break;
+	case 'a':
+		*format = FORMAT_ADDR;
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+/* display and watch: [/format] $register */
+static void hook_command(HookList *list, const char *what, int argc, char *argv[])
+{
+	HookRegisters *hook;
+	FetcherPacket now;
+	ARMCPOperand op;
+	int format = list == &displays ? FORMAT_DEC : FORMAT_HEX;
+
+	if(argc == 2) {
+		if(parse_format(argv[0], &format) < 0) {
+			cmd_error("Invalid format\n");
+			return;
+		}
+	}
+	else if(argc != 1) {
+		cmd_error("Invalid arguments\n");
+		return;
+	}
+
+	/* Parse register name.
+	 * Register name format: leading dollar sign and optional bit field
+	 * $reg_name, $reg_name[end_bit:start_bit], $reg_name.FIELD
+	 */
+	if(cmd_operand(argv[argc - 1], &op) < 0 || op.all) {
+		cmd_error("Invalid register name\n");
+		return;
+	}
+	/* Code addresses are shown with their symbol */
+	if(argc == 1 && op.field == NULL && op.shift == 0 && op.mask == ~0ULL
+	   && (!strcmp(op.reg->name, "pc") || !strcmp(op.reg->name, "x30"))) {
+		format = FORMAT_ADDR;
+	}
+
+	packet_current(&now);
+	pthread_mutex_lock(&lock);
+	hook = hook_add(list, argv[argc - 1] + 1, &op, format);
+	if(hook && command_hook_read(hook, &now, &hook->last) == 0) {
+		hook->seen = 1;
+	}
+	if(hook && list == &displays) {
+		names_dirty = 1;
+	}
+	if(hook) {
+		plan_changed();
+	}
+	pthread_mutex_unlock(&lock);
+
+	if(hook == NULL) {
+		cmd_error("Register \"%s\" has already in %s list\n", argv[argc - 1] + 1, what);
+		return;
+	}
+	cmd_info("Add register \"%s\" to %s list\n", argv[argc - 1], what);
+}
+
+static void unhook_command(HookList *list, const char *what, int argc, char *argv[])
+{
+	HookRegisters *hook;
+	int ret = -1;
+
+	if(argc != 1) {
+		cmd_error("Invalid arguments\n");
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	hook = hook_remove(list, atoi(argv[0]));
+	if(hook && list == &displays) {
+		names_dirty = 1;
+	}
+	/* Right away even in a script, the entry is freed once no plan has it */
+	if(hook) {
+		ret = plan_publish();
+	}
+	pthread_mutex_unlock(&lock);
+
+	if(hook == NULL) {
+		cmd_error("%s number %s is not in the list!\n", what, argv[0]);
+		return;
+	}
+	cmd_info("Remove \"%s\"\n", hook->name);
+	/* A packet may still be reading it, an unpublished one is left alone */
+	if(ret == 0) {
+		epoch_retire(hook, free);
+	}
+}
+
+static void changed(void)
+{
+	/* A script redraws once, when it is done */
+	if(frontend->changed && load_depth == 0) {
+		frontend->changed();
+	}
+}
+
+void cmd_display(int argc, char *argv[])
+{
+	hook_command(&displays, "display", argc, argv);
+	changed();
+}
+
+void cmd_undisplay(int argc, char *argv[])
+{
+	unhook_command(&displays, "Display", argc, argv);
+	changed();
+}
+
+void cmd_watch(int argc, char *argv[])
+{
+	HookRegisters *it;
+
+	if(argc > 0) {
+		hook_command(&watches, "watch", argc, argv);
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	for(it = watches.head; it != NULL; it = it->next) {
+		cmd_out("%2d: %-24s = 0x%lx, %lu change%s\n", it->id, it->name, it->last,
+		        it->hits, it->hits == 1 ? "" : "s");
+	}
+	if(watches.head == NULL) {
+		cmd_out("No watch\n");
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void cmd_unwatch(int argc, char *argv[])
+{
+	unhook_command(&watches, "Watch", argc, argv);
+}
+
+void cmd_print(int argc, char *argv[])
+{
+	ARMCPOperand op;
+	const ARMCPField *fields;
+	uint64_t value = 0;
+	char str[128];
+	char name[64];
+	char *reg;
+	char format = 'x'; // default format hexadecimal
+	FetcherPacket now;
+	int i, count;
+
+	/* Print register format:
+	 * print $MIDR[31:16]
+	 * print /x $MIDR[31:16] (x, d, u, o, a)
+	 * print $TCR_EL1.T0SZ
+	 * print $TCR_EL1.* (all fields)
+	 */
+	if(argc == 1) {
+		reg = argv[0];
+	}
+	else if(argc == 2) {
+		if(argv[0][0] != '/') {
+			cmd_error("Invalid format\n");
+			return;
+		}
+		format = argv[0][1];
+		reg = argv[1];
+	}
+	else {
+		cmd_error("Invalid arguments\n");
+		return;
+	}
+
+	if(cmd_operand(reg, &op) < 0) {
+		cmd_error("Invalid register name\n");
+		return;
+	}
+
+	packet_current(&now);
+	if(arm_cp_read(op.reg, &now, &value) < 0) {
+		cmd_out("%s\n", arm_cp_implemented(op.reg) ? "N/A" : "UNIMPLEMENTED");
+		return;
+	}
+
+	if(!op.all) {
+		if(arm_cp_format(str, sizeof(str), reg + 1, (value & op.mask) >> op.shift, format, op.field) < 0) {
+			cmd_error("Invalid format\n");
+			return;
+		}
+		cmd_out("%s\n", str);
+		return;
+	}
+
+	/* Decode every field from the one value */
+	fields = arm_cp_field_list(op.reg->name, &count);
+	for(i = 0; i < count; i++) {
+		snprintf(name, sizeof(name), "%s.%s", fields[i].reg, fields[i].name);
+		if(arm_cp_format(str, sizeof(str), name, (value & fields[i].mask) >> fields[i].shift,
+		                 format, &fields[i]) < 0) {
+			cmd_error("Invalid format\n");
+			return;
+		}
+		cmd_out("%s\n", str);
+	}
+}
+
+/* "0x%-16lx", `buf` holds at least 19 characters */
+static void list_value(const ARMCPRegInfo *ri, const FetcherPacket *now, char *buf, size_t len)
+{
+	uint64_t value;
+
+	if(arm_cp_read(ri, now, &value) < 0) {
+		snprintf(buf, len, "%-18s", arm_cp_implemented(ri) ? "N/A" : "UNIMPLEMENTED");
+		return;
+	}
+	buf[0] = '0';
+	buf[1] = 'x';
+	buf[format_pad(buf + 2, format_hex_digits(buf + 2, value), 16) + 2] = '\0';
+}
+
+void cmd_list(int argc, char *argv[])
+{
+	char left[32], right[32];
+	FetcherPacket now;
+	int i, j;
+
+	/* One packet for the whole list */
+	packet_current(&now);
+	for(i = 0; i < sizeof(reg_array) / sizeof(struct ARMCPRegArray); i++) {
+		cmd_out("======== %s\n", reg_array[i].name);
+		for(j = 0; j < reg_array[i].size; j += 2) {
+			list_value(&reg_array[i].array[j], &now, left, sizeof(left));
+			if(j + 1 == reg_array[i].size) {
+				cmd_out("%-16s = %s\n", reg_array[i].array[j].name, left);
+				break;
+			}
+			list_value(&reg_array[i].array[j + 1], &now, right, sizeof(right));
+			cmd_out("%-16s = %s | %-16s = %s\n", reg_array[i].array[j].name, left,
+			        reg_array[i].array[j + 1].name, right);
+		}
+	}
+}
+
+static void store_list(FILE *fout, const char *command, const HookList *list)
+{
+	static const char format[] = {[FORMAT_DEC] = 'd', [FORMAT_HEX] = 'x',
+	                              [FORMAT_OCT] = 'o', [FORMAT_UNS] = 'u', [FORMAT_ADDR] = 'a'};
+	HookRegisters *it;
+
+	for(it = list->head; it != NULL; it = it->next) {
+		fprintf(fout, "%s /%c $%s\n", command, format[it->format], it->name);
+	}
+}
+
+void cmd_store(int argc, char *argv[])
+{
+	const char *filename = "cli.cmd"; // default output file name
+	FILE *fout;
+
+	if(argc > 1) {
+		cmd_error("Invalid arguments\n");
+		return;
+	}
+
+	if(argc == 1) {
+		filename = argv[0];
+	}
+
+	if((fout = fopen(filename, "w")) == NULL) {
+		cmd_error("Can not open \"%s\"\n", filename);
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	store_list(fout, "display", &displays);
+	store_list(fout, "watch", &watches);
+	pthread_mutex_unlock(&lock);
+
+	cmd_info("Store display list to \"%s\"\n", filename);
+	fclose(fout);
+}
+
+void cmd_load(int argc, char *argv[])
+{
+	const char *filename = "cli.cmd"; // default input file name
+	int ret;
+
+	if(argc > 1) {
+		cmd_error("Invalid arguments\n");
+		return;
+	}
+
+	if(argc == 1) {
+		filename = argv[0];
+	}
+
+	if(load_depth == MAX_LOAD_DEPTH) {
+		cmd_error("Scripts nested too deep\n");
+		return;
+	}
+
+	cmd_info("Load command script from \"%s\"\n", filename);
+	if((ret = command_load(filename)) < 0) {
+		cmd_error("Can not load \"%s\"\n", filename);
+		return;
+	}
+	changed();
+}
+
+void cmd_record(int argc, char *argv[])
+{
+	int format = TRACE_FORMAT_RAW;
+
+	if(argc == 1 && !strcmp(argv[0], "stop")) {
+		if(record_stop() < 0) {
+			cmd_error("Not recording\n");
+			return;
+		}
+		cmd_info("Recording stopped\n");
+		return;
+	}
+
+	if(argc == 2) {
+		if(strcmp(argv[0], "/c")) {
+			cmd_error("Invalid format\n");
+			return;
+		}
+		format = TRACE_FORMAT_COLUMNAR;
+	}
+	else if(argc != 1) {
+		cmd_error("Invalid arguments\n");
+		return;
+	}
+
+	if(record_start(argv[argc - 1], format) < 0) {
+		cmd_error("Can not open \"%s\"\n", argv[argc - 1]);
+		return;
+	}
+	cmd_info("Record packets to \"%s\"\n", argv[argc - 1]);
+}
+
+void cmd_emit(int argc, char *argv[])
+{
+	int format = EMIT_FORMAT_JSON, ret;
+
+	if(argc == 1 && !strcmp(argv[0], "stop")) {
+		pthread_mutex_lock(&emit_lock);
+		ret = emit_stop();
+		pthread_mutex_unlock(&emit_lock);
+		if(ret < 0) {
+			cmd_error("Not emitting\n");
+			return;
+		}
+		cmd_info("Emit stopped\n");
+		return;
+	}
+
+	if(argc == 2) {
+		if(!strcmp(argv[0], "/b")) {
+			format = EMIT_FORMAT_BINARY;
+		}
+		else if(!strcmp(argv[0], "/t")) {
+			format = EMIT_FORMAT_TIMELINE;
+		}
+		else if(strcmp(argv[0], "/j")) {
+			cmd_error("Invalid format\n");
+			return;
+		}
+	}
+	else if(argc != 1) {
+		cmd_error("Invalid arguments\n");
+		return;
+	}
+
+	pthread_mutex_lock(&emit_lock);
+	ret = emit_start(argv[argc - 1], format);
+	pthread_mutex_unlock(&emit_lock);
+	if(ret < 0) {
+		cmd_error("Can not open \"%s\"\n", argv[argc - 1]);
+		return;
+	}
+	cmd_info("Emit the display list to \"%s\"\n", argv[argc - 1]);
+}
+
+static void replay_show(int64_t step)
+{
+	FetcherPacket step_packet;
+
+	if(!replay_active()) {
+		cmd_error("Not in replay mode\n");
+		return;
+	}
+
+	if(replay_seek(step, &step_packet) < 0) {
+		cmd_error("Can not read step %ld\n", step);
+		return;
+	}
+
+	command_update(&step_packet, 0);
+	cmd_out("Step %lu/%lu\n", replay_step(), replay_steps());
+	if(frontend->show) {
+		frontend->show(&step_packet);
+	}
+}
+
+void command_replay(void)
+{
+	replay_show(0);
+}
+
+void cmd_goto(int argc, char *argv[])
+{
+	if(argc != 1) {
+		cmd_error("Invalid arguments\n");
+		return;
+	}
+
+	replay_show(strtoll(argv[0], NULL, 0));
+}
+
+void cmd_next(int argc, char *argv[])
+{
+	replay_show(replay_step() + (argc ? strtoll(argv[0], NULL, 0) : 1));
+}
+
+void cmd_prev(int argc, char *argv[])
+{
+	replay_show((int64_t)replay_step() - (argc ? strtoll(argv[0], NULL, 0) : 1));
+}
+
+/* Words of an expression back in one malloc()ed string */
+static char *join_words(int argc, char *argv[])
+{
+	char *expr;
+	size_t len = 1;
+	int i;
+
+	for(i = 0; i < argc; i++) {
+		len += strlen(argv[i]) + 1;
+	}
+	if((expr = malloc(len)) == NULL) {
+		return NULL;
+	}
+	expr[0] = '\0';
+	for(i = 0; i < argc; i++) {
+		strcat(expr, argv[i]);
+		strcat(expr, i + 1 < argc ? " " : "");
+	}
+
+	return expr;
+}
+
+void cmd_assert(int argc, char *argv[])
+{
+	CMDAssert *a;
+	char err[128];
+
+	if(argc == 0) {
+		pthread_mutex_lock(&lock);
+		for(a = asserts; a != NULL; a = a->next) {
+			cmd_out("%2d: %s, %lu failure%s\n", a->id, a->expr, a->failures, a->failures == 1 ? "" : "s");
+		}
+		if(asserts == NULL) {
+			cmd_out("No assertion\n");
+		}
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+
+	if((a = calloc(1, sizeof(CMDAssert))) == NULL || (a->expr = join_words(argc, argv)) == NULL) {
+		free(a);
+		return;
+	}
+	if((a->query = query_compile(a->expr, err, sizeof(err))) == NULL) {
+		cmd_error("%s\n", err);
+		free(a->expr);
+		free(a);
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	a->id = asserts_tail ? asserts_tail->id + 1 : 0;
+	if(asserts_tail) {
+		asserts_tail->next = a;
+	}
+	else {
+		asserts = a;
+	}
+	asserts_tail = a;
+	plan_changed();
+	pthread_mutex_unlock(&lock);
+
+	cmd_info("Assertion %d: %s\n", a->id, a->expr);
+}
+
+void cmd_query(int argc, char *argv[])
+{
+	Query *q;
+	char *expr;
+	char err[128];
+	uint64_t *steps, count, step;
+	int i;
+
+	if(!replay_active()) {
+		cmd_error("Not in replay mode\n");
+		return;
+	}
+
+	/* Run a new query, or reuse the last result */
+	if(argc > 0) {
+		if((expr = join_words(argc, argv)) == NULL) {
+			return;
+		}
+		q = query_compile(expr, err, sizeof(err));
+		free(expr);
+		if(q == NULL) {
+			cmd_error("%s\n", err);
+			return;
+		}
+		steps = query_run(q, replay_reader(), 0, &count);
+		query_free(q);
+		if(steps == NULL) {
+			cmd_error("Can not scan the trace\n");
+			return;
+		}
+
+		cmd_out("%lu matches:", count);
+		for(i = 0; i < count && i < 16; i++) {
+			cmd_out(" %lu", steps[i]);
+		}
+		cmd_out(count > 16 ? " ...\n" : "\n");
+		replay_set_matches(steps, count);
+	}
+
+	if(replay_next_match(&step) < 0) {
+		cmd_out("No match\n");
+		return;
+	}
+	replay_show(step);
+}
+
+static void contexts_summary(void)
+{
+	ContextResidency *r;
+	uint64_t count, steps = context_steps(), i;
+
+	r = context_residency(&count);
+	cmd_out("%lu switch%s, %lu context%s in %lu steps\n", context_count(), context_count() == 1 ? "" : "es",
+	        count, count == 1 ? "" : "s", steps);
+	for(i = 0; i < count; i++) {
+		cmd_out("  ASID %5u CONTEXTIDR %#10x %12lu steps %5.1f%% %8lu switch%s\n", r[i].asid, r[i].contextidr,
+		        r[i].steps, steps ? 100.0 * r[i].steps / steps : 0.0, r[i].switches, r[i].switches == 1 ? "" : "es");
+	}
+	free(r);
+}
+
+void cmd_contexts(int argc, char *argv[])
+{
+	ContextSwitch sw;
+	int64_t index;
+	int ret;
+	uint64_t step = replay_step();
+
+	if(argc > 1) {
+		cmd_error("Invalid arguments\n");
+		return;
+	}
+
+	pthread_mutex_lock(&contexts_lock);
+	if(replay_active() && !contexts_scanned) {
+		if(context_scan(replay_reader()) < 0) {
+			pthread_mutex_unlock(&contexts_lock);
+			cmd_error("Can not index the trace\n");
+			return;
+		}
+		contexts_scanned = 1;
+	}
+	pthread_mutex_unlock(&contexts_lock);
+	/* The timeline takes its own lock */
+	if(argc == 0) {
+		contexts_summary();
+		return;
+	}
+
+	if(!strcmp(argv[0], "next")) {
+		index = context_find(step) + 1;
+	}
+	else if(!strcmp(argv[0], "prev")) {
+		/* The switch in effect just before the cursor */
+		index = step ? context_find(step - 1) : -1;
+	}
+	else {
+		index = strtoll(argv[0], NULL, 0);
+	}
+	ret = index >= 0 ? context_get(index, &sw) : -1;
+
+	if(!replay_active()) {
+		cmd_error("Not in replay mode\n");
+		return;
+	}
+	if(ret < 0) {
+		cmd_error("No such context switch\n");
+		return;
+	}
+	cmd_out("Switch %ld: ASID %u CONTEXTIDR %#x\n", index, sw.asid, sw.contextidr);
+	replay_show(sw.step);
+}
+
+/* Readers for x, `arg` is the MMUContext of a virtual address */
+static int examine_virtual(const void *arg, uint64_t va, void *buf, size_t len)
+{
+	return mmu_read(arg, va, buf, len);
+}
+
+static int examine_physical(const void *arg, uint64_t pa, void *buf, size_t len)
+{
+	return guest_mem_read(pa, buf, len);
+}
+
+void cmd_x(int argc, char *argv[])
+{
+	int count = 1, unit = 4;
+	char format = 'x';
+	uint64_t addr;
+	FetcherPacket now;
+	MMUContext ctx;
+
+	if(argc == 2) {
+		if(guest_mem_parse_format(argv[0], &count, &format, &unit) < 0) {
+			cmd_error("Invalid format\n");
+			return;
+		}
+	}
+	else if(argc != 1) {
+		cmd_error("Invalid arguments\n");
+		return;
+	}
+
+	packet_current(&now);
+	if(arm_cp_eval(argv[argc - 1], &now, &addr) < 0) {
+		cmd_error("Invalid address\n");
+		return;
+	}
+
+	/* A register holds a virtual address, walked in the packet it is from */
+	if(argv[argc - 1][0] == '$') {
+		mmu_context(&ctx, &now);
+		guest_mem_examine(addr, count, format, unit, examine_virtual, &ctx, frontend->out);
+	}
+	else {
+		guest_mem_examine(addr, count, format, unit, examine_physical, NULL, frontend->out);
+	}
+}
+
+void cmd_mem(int argc, char *argv[])
+{
+	uint64_t base, size;
+	int i;
+
+	if(argc == 3 && !strcmp(argv[0], "attach")) {
+		if(guest_mem_attach(argv[1], strtoull(argv[2], NULL, 0), 0, 0) < 0) {
+			cmd_error("Can not map \"%s\"\n", argv[1]);
+			return;
+		}
+	}
+	else if(argc != 0) {
+		cmd_error("Invalid arguments\n");
+		return;
+	}
+
+	for(i = 0; guest_mem_regions(i, &base, &size) == 0; i++) {
+		cmd_out("0x%016lx - 0x%016lx (%lu MiB)\n", base, base + size, size >> 20);
+	}
+	if(i == 0) {
+		cmd_out("No guest memory shared\n");
+	}
+}
+
+void cmd_translate(int argc, char *argv[])
+{
+	MMUTranslation t;
+	MMUContext ctx;
+	FetcherPacket now;
+	uint64_t va, hits, misses, flushes;
+	char str[256];
+	int ret;
+
+	if(argc == 0) {
+		mmu_stats(&hits, &misses, &flushes);
+		cmd_out("TLB: %lu hits, %lu misses, %lu flushes\n", hits, misses, flushes);
+		return;
+	}
+	packet_current(&now);
+	if(argc != 1 || arm_cp_eval(argv[0], &now, &va) < 0) {
+		cmd_error("Invalid address\n");
+		return;
+	}
+
+	mmu_context(&ctx, &now);
+	if((ret = mmu_translate(&ctx, va, &t)) != MMU_OK) {
+		cmd_out("0x%lx: %s at level %d\n", va, mmu_fault_name(ret), t.level);
+		return;
+	}
+	mmu_describe(&t, str, sizeof(str));
+	cmd_out("%s\n", str);
+}
+
+void cmd_snapshot(int argc, char *argv[])
+{
+	FetcherPacket now;
+	int ret;
+
+	packet_current(&now);
+	if(argc == 2 && !strcmp(argv[0], "save")) {
+		if(snapshot_save(argv[1], &now) < 0) {
+			cmd_error("Invalid snapshot name\n");
+			return;
+		}
+		cmd_info("Snapshot \"%s\" saved\n", argv[1]);
+	}
+	else if((argc == 2 || argc == 3) && !strcmp(argv[0], "diff")) {
+		ret = snapshot_diff(argv[1], argc == 3 ? argv[2] : SNAPSHOT_CURRENT, &now, frontend->out);
+		if(ret == -1) {
+			cmd_error("No such snapshot\n");
+		}
+		else if(ret < 0) {
+			cmd_error("Out of memory\n");
+		}
+	}
+	else if(argc == 1 && !strcmp(argv[0], "list")) {
+		snapshot_list(frontend->out);
+	}
+	else {
+		cmd_error("Invalid arguments\n");
+	}
+}
+
+void cmd_track(int argc, char *argv[])
+{
+	ARMCPOperand op;
+	uint64_t addr = 0, length = TRACK_PAGE_SIZE, step = UINT64_MAX;
+	int id, count = 0, unit = 8;
+	char format = 'x';
+	char *end;
+
+	if(argc == 0) {
+		track_list(frontend->out);
+		return;
+	}
+
+	if(!strcmp(argv[0], "mem") && (argc == 2 || argc == 3)) {
+		op.reg = NULL;
+		if(argv[1][0] == '$') {
+			/* A whole register, read again in every packet */
+			if(arm_cp_parse(argv[1], &op) != (int)strlen(argv[1]) || op.field || op.all || op.shift
+			   || op.mask != 0xFFFFFFFFFFFFFFFFULL || !arm_cp_implemented(op.reg)) {
+				cmd_error("Invalid register\n");
+				return;
+			}
+		}
+		else {
+			addr = strtoull(argv[1], &end, 0);
+			if(*end != '\0') {
+				cmd_error("Invalid address\n");
+				return;
+			}
+		}
+		if(argc == 3) {
+			length = strtoull(argv[2], &end, 0);
+			if(*end != '\0' || length == 0 || length > TRACK_MAX_LENGTH) {
+				cmd_error("Invalid length, at most %d bytes\n", TRACK_MAX_LENGTH);
+				return;
+			}
+		}
+		if((id = track_add(argv[1], op.reg, addr, length)) < 0) {
+			cmd_error("Can not track \"%s\"\n", argv[1]);
+			return;
+		}
+		cmd_info("Track %d: %s, %lu bytes\n", id, argv[1], length);
+	}
+	else if(!strcmp(argv[0], "history") && argc == 2) {
+		if(track_history(strtol(argv[1], NULL, 0), frontend->out) < 0) {
+			cmd_error("No such track\n");
+		}
+	}
+	else if(!strcmp(argv[0], "show") && argc >= 2 && argc <= 4) {
+		argv++;
+		argc--;
+		if(argv[0][0] == '/') {
+			if(guest_mem_parse_format(argv[0], &count, &format, &unit) < 0) {
+				cmd_error("Invalid format\n");
+				return;
+			}
+			argv++;
+			argc--;
+		}
+		if(argc == 2) {
+			step = strtoull(argv[1], NULL, 0);
+		}
+		if(argc < 1 || argc > 2 || track_show(strtol(argv[0], NULL, 0), step, count, format, unit, frontend->out) < 0) {
+			cmd_error("No such track or packet\n");
+		}
+	}
+	else {
+		cmd_error("Invalid arguments\n");
+	}
+}
+
+void cmd_untrack(int argc, char *argv[])
+{
+	if(argc != 1) {
+		cmd_error("Invalid arguments\n");
+		return;
+	}
+	if(track_remove(strtol(argv[0], NULL, 0)) < 0) {
+		cmd_error("No such track\n");
+		return;
+	}
+	cmd_info("Track %s removed\n", argv[0]);
+}
+
+void cmd_refresh(int argc, char *argv[])
+{
+	FetcherPacket now;
+
+	if(frontend->show) {
+		packet_current(&now);
+		frontend->show(&now);
+	}
+}
+
+void cmd_view(int argc, char *argv[])
+{
+	HookRegisters *it;
+	int shown = 0, total = 0, lines;
+
+	if(argc == 0) {
+		pthread_mutex_lock(&lock);
+		for(it = displays.head; it != NULL; it = it->next) {
+			shown += !it->hidden;
+			total++;
+		}
+		pthread_mutex_unlock(&lock);
+		cmd_out("%d of %d displays shown%s%s\n", shown, total, view_filter[0] ? ", filter " : "", view_filter);
+		return;
+	}
+
+	if(!strcmp(argv[0], "filter") && argc <= 2) {
+		pthread_mutex_lock(&lock);
+		snprintf(view_filter, sizeof(view_filter), "%s", argc == 2 ? argv[1] : "");
+		for(it = displays.head; it != NULL; it = it->next) {
+			it->hidden = !view_match(it->name);
+		}
+		plan_changed();
+		pthread_mutex_unlock(&lock);
+		/* Start from the top of the new list */
+		if(frontend->scroll) {
+			frontend->scroll(-(1 << 30));
+		}
+		changed();
+		return;
+	}
+
+	if((!strcmp(argv[0], "up") || !strcmp(argv[0], "down")) && argc <= 2) {
+		if(frontend->scroll == NULL) {
+			cmd_error("The display list is not scrollable here\n");
+			return;
+		}
+		lines = argc == 2 ? strtol(argv[1], NULL, 0) : 1;
+		frontend->scroll(argv[0][0] == 'u' ? -lines : lines);
+		return;
+	}
+
+	cmd_error("Invalid arguments\n");
+}
+
+void cmd_symbol_file(int argc, char *argv[])
+{
+	int ret;
+
+	if(argc == 0) {
+		cmd_out("%u symbols, %u line rows\n", symbols_count(), lines_count());
+		return;
+	}
+	if(argc != 1) {
+		cmd_error("Invalid arguments\n");
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	ret = symbols_load(argv[0]);
+	/* The first load of a build decodes .debug_line, later ones map it */
+	if(ret == 0 && lines_load(argv[0]) < 0) {
+		ret = 1;
+	}
+	pthread_mutex_unlock(&lock);
+	if(ret < 0) {
+		cmd_error("Can not read symbols from \"%s\"\n", argv[0]);
+		return;
+	}
+	cmd_info("Read %u symbols from \"%s\"\n", symbols_count(), argv[0]);
+	if(ret == 0) {
+		cmd_info("Read %u line rows\n", lines_count());
+	}
+	else {
+		cmd_info("No line table, build with debug info for file:line\n");
+	}
+	changed();
+}
+
+void cmd_stats(int argc, char *argv[])
+{
+	if(argc == 0) {
+		stats_print(frontend->out);
+	}
+	else if(argc == 1 && !strcmp(argv[0], "reset")) {
+		stats_reset();
+		cmd_info("Latency counters cleared\n");
+	}
+	else {
+		cmd_error("Invalid arguments\n");
+	}
+}
+
+void cmd_quit(int argc, char *argv[])
+{
+	record_stop();
+	quitting = 1;
+	if(frontend->quit) {
+		frontend->quit();
+		return;
+	}
+	pthread_exit(0);
+}
+
+void cmd_help(int argc, char *argv[])
+{
+	int i;
+
+	for(i = 0; i < NR_COMMANDS; i++) {
+		cmd_out("%s\n", cmd[i].desc);
+	}
+}
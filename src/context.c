@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "context.h"
+#include "fields.h"
+
+#define CONTEXT_GROW		1024
+
+/* Taken to append and to read, never for a packet in the same context */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static ContextSwitch *switches;
+static uint64_t nr_switches, switches_size;
+/* One past the last step fed */
+static uint64_t end_step;
+
+static uint32_t context_asid(uint64_t ttbr0, uint64_t ttbr1, uint64_t tcr)
+{
+	uint64_t ttbr = FIELD_GET(tcr, TCR_EL1, A1) ? ttbr1 : ttbr0;
+
+	/* TCR_EL1.AS selects 16-bit ASIDs */
+	return FIELD_GET(ttbr, TTBR0_EL1, ASID) & (FIELD_GET(tcr, TCR_EL1, AS) ? 0xffff : 0xff);
+}
+
+static void context_add(uint64_t step, uint32_t asid, uint32_t contextidr)
+{
+	ContextSwitch *last = nr_switches ? &switches[nr_switches - 1] : NULL, *p;
+
+	/* Only the feeding thread writes, it reads without the lock */
+	__atomic_store_n(&end_step, step + 1, __ATOMIC_RELAXED);
+	if(last && last->asid == asid && last->contextidr == contextidr) {
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	if(nr_switches == switches_size) {
+		if((p = realloc(switches, (switches_size * 2 + CONTEXT_GROW) * sizeof(ContextSwitch))) == NULL) {
+			pthread_mutex_unlock(&lock);
+			return;
+		}
+		switches = p;
+		switches_size = switches_size * 2 + CONTEXT_GROW;
+	}
+	switches[nr_switches].step = step;
+	switches[nr_switches].asid = asid;
+	switches[nr_switches].contextidr = contextidr;
+	nr_switches++;
+	pthread_mutex_unlock(&lock);
+}
+
+void context_reset(void)
+{
+	pthread_mutex_lock(&lock);
+	free(switches);
+	switches = NULL;
+	nr_switches = switches_size = 0;
+	end_step = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+void context_update(uint64_t step, const FetcherPacket *packet)
+{
+	context_add(step, context_asid(packet->TTBR0_EL1, packet->TTBR1_EL1, packet->TCR_EL1),
+	            packet->CONTEXTIDR_EL1);
+}
+
+int context_scan(const TraceReader *tr)
+{
+	static const int cols[4] = {
+		offsetof(FetcherPacket, TTBR0_EL1), offsetof(FetcherPacket, TTBR1_EL1),
+		offsetof(FetcherPacket, TCR_EL1), offsetof(FetcherPacket, CONTEXTIDR_EL1),
+	};
+	uint64_t *values[4] = {NULL}, min = 0, max = 0, first_step;
+	uint32_t chunk, steps, i;
+	int c, same, ret = -1;
+
+	context_reset();
+	for(c = 0; c < 4; c++) {
+		if((values[c] = malloc(TRACE_CHUNK_STEPS * sizeof(uint64_t))) == NULL) {
+			goto out;
+		}
+	}
+
+	for(chunk = 0; chunk < trace_nr_chunks(tr); chunk++) {
+		trace_chunk_info(tr, chunk, &first_step, &steps);
+		if(steps == 0 || steps > TRACE_CHUNK_STEPS) {
+			goto out;
+		}
+
+		/* A chunk with constant columns is one step of the timeline */
+		for(c = 0, same = 1; c < 4 && same; c++) {
+			same = trace_chunk_range(tr, chunk, trace_column(cols[c]), &min, &max) == 0 && min == max;
+			values[c][0] = min;
+		}
+		if(same) {
+			context_add(first_step, context_asid(values[0][0], values[1][0], values[2][0]), values[3][0]);
+			__atomic_store_n(&end_step, first_step + steps, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		for(c = 0; c < 4; c++) {
+			if(trace_chunk_column(tr, chunk, trace_column(cols[c]), values[c]) < 0) {
+				goto out;
+			}
+		}
+		for(i = 0; i < steps; i++) {
+			context_add(first_step + i, context_asid(values[0][i], values[1][i], values[2][i]), values[3][i]);
+		}
+	}
+	ret = 0;
+
+out:
+	for(c = 0; c < 4; c++) {
+		free(values[c]);
+	}
+
+	return ret;
+}
+
+uint64_t context_count(void)
+{
+	uint64_t count;
+
+	pthread_mutex_lock(&lock);
+	count = nr_switches;
+	pthread_mutex_unlock(&lock);
+
+	return count;
+}
+
+int context_get(uint64_t index, ContextSwitch *sw)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&lock);
+	if(index < nr_switches) {
+		*sw = switches[index];
+		ret = 0;
+	}
+	pthread_mutex_unlock(&lock);
+
+	return ret;
+}
+
+int64_t context_find(uint64_t step)
+{
+	uint64_t lo = 0, hi, mid;
+
+	pthread_mutex_lock(&lock);
+	hi = nr_switches;
+	/* First switch after `step` */
+	while(lo < hi) {
+		mid = (lo + hi) / 2;
+		if(switches[mid].step <= step) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	return (int64_t)lo - 1;
+}
+
+uint64_t context_steps(void)
+{
+	return __atomic_load_n(&end_step, __ATOMIC_RELAXED);
+}
+
+static int residency_key_cmp(const void *a, const void *b)
+{
+	const ContextResidency *x = a, *y = b;
+
+	if(x->asid != y->asid) {
+		return x->asid < y->asid ? -1 : 1;
+	}
+	if(x->contextidr != y->contextidr) {
+		return x->contextidr < y->contextidr ? -1 : 1;
+	}
+
+	return 0;
+}
+
+static int residency_steps_cmp(const void *a, const void *b)
+{
+	const ContextResidency *x = a, *y = b;
+
+	if(x->steps != y->steps) {
+		return x->steps > y->steps ? -1 : 1;
+	}
+
+	return residency_key_cmp(a, b);
+}
+
+ContextResidency *context_residency(uint64_t *count)
+{
+	ContextResidency *r;
+	uint64_t i, n = 0, total;
+
+	*count = 0;
+	pthread_mutex_lock(&lock);
+	total = nr_switches;
+	if(total == 0 || (r = malloc(total * sizeof(ContextResidency))) == NULL) {
+		pthread_mutex_unlock(&lock);
+		return NULL;
+	}
+
+	for(i = 0; i < total; i++) {
+		r[i].asid = switches[i].asid;
+		r[i].contextidr = switches[i].contextidr;
+		r[i].steps = (i + 1 < total ? switches[i + 1].step : context_steps()) - switches[i].step;
+		r[i].switches = 1;
+	}
+	pthread_mutex_unlock(&lock);
+
+	/* Merge the entries of each pair */
+	qsort(r, total, sizeof(ContextResidency), residency_key_cmp);
+	for(i = 0; i < total; i++) {
+		if(n && !residency_key_cmp(&r[n - 1], &r[i])) {
+			r[n - 1].steps += r[i].steps;
+			r[n - 1].switches++;
+			continue;
+		}
+		r[n++] = r[i];
+	}
+	qsort(r, n, sizeof(ContextResidency), residency_steps_cmp);
+	*count = n;
+
+	return r;
+}
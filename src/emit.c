@@ -0,0 +1,451 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <stddef.h>
+#include <endian.h>
+
+#include "emit.h"
+#include "format.h"
+
+/* Session emitter, driven by the command engine under its emit lock */
+static int fd = -1;
+static int format;
+static int names_wanted;
+static char *buf;
+static size_t buf_size, buf_len;
+static size_t record; /* offset of the open record's EmitHeader */
+static uint32_t count;
+static int first; /* JSON: no comma before the next value */
+static uint64_t last_flush;
+
+/* Timeline state, counters are indexed by position in the display list */
+#define TRACK_EL	1
+#define TRACK_CONTEXT	2
+#define TRACK_WATCH	3
+
+typedef struct EmitCounter {
+	uint64_t value;
+	int valid;
+} EmitCounter;
+
+static EmitCounter *counters;
+static size_t nr_counters;
+static uint64_t base_ts, cur_ts;
+static int started; /* slices are open */
+static uint32_t el_mode, context;
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* The buffer only grows when a record is larger than anything so far */
+static char *reserve(size_t len)
+{
+	char *p;
+
+	if(buf_len + len > buf_size) {
+		if((p = realloc(buf, (buf_len + len) * 2)) == NULL) {
+			return NULL;
+		}
+		buf = p;
+		buf_size = (buf_len + len) * 2;
+	}
+
+	return buf + buf_len;
+}
+
+static void put(const void *data, size_t len)
+{
+	char *p;
+
+	if((p = reserve(len)) != NULL) {
+		memcpy(p, data, len);
+		buf_len += len;
+	}
+}
+
+#define put_str(s)	put(s, sizeof(s) - 1)
+
+static void put_dec(uint64_t v)
+{
+	char tmp[FORMAT_MAX_DIGITS];
+
+	put(tmp, format_udec(tmp, v));
+}
+
+/* Always prefixed, "0x0" for zero */
+static void put_hex(uint64_t v)
+{
+	char tmp[FORMAT_MAX_DIGITS];
+
+	tmp[0] = '0';
+	tmp[1] = 'x';
+	put(tmp, 2 + format_hex_digits(tmp + 2, v));
+}
+
+/* Register names are checked by the parser, only quotes need care */
+static void put_name(const char *name)
+{
+	const char *s;
+
+	for(s = name; *s; s++) {
+		if(*s == '"' || *s == '\\') {
+			put(name, s - name);
+			put_str("\\");
+			name = s;
+		}
+	}
+	put(name, s - name);
+}
+
+static void emit_close(void)
+{
+	if(fd != STDOUT_FILENO) {
+		close(fd);
+	}
+	fd = -1;
+	buf_len = 0;
+}
+
+/* Microseconds since the first event, the format's unit */
+static void put_ts(uint64_t ns)
+{
+	char frac[4];
+
+	ns -= base_ts;
+	frac[0] = '.';
+	frac[1] = '0' + ns / 100 % 10;
+	frac[2] = '0' + ns / 10 % 10;
+	frac[3] = '0' + ns % 10;
+	put_dec(ns / 1000);
+	put(frac, sizeof(frac));
+}
+
+/* Open a trace event, the caller adds "name" and "args" and closes it */
+static void event(char ph, int tid, uint64_t ts)
+{
+	put_str(",\n{\"ph\":\"");
+	put(&ph, 1);
+	put_str("\",\"pid\":1,\"tid\":");
+	put_dec(tid);
+	put_str(",\"ts\":");
+	put_ts(ts);
+}
+
+static void thread_name(int tid, const char *name)
+{
+	put_str(",\n{\"ph\":\"M\",\"pid\":1,\"tid\":");
+	put_dec(tid);
+	put_str(",\"name\":\"thread_name\",\"args\":{\"name\":\"");
+	put_name(name);
+	put_str("\"}}");
+}
+
+static void timeline_start(void)
+{
+	put_str("[\n{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"qemu-monitor\"}}");
+	thread_name(TRACK_EL, "Exception level");
+	thread_name(TRACK_CONTEXT, "CONTEXTIDR_EL1");
+	thread_name(TRACK_WATCH, "Watches");
+	started = 0;
+	nr_counters = 0;
+}
+
+static void el_slice(uint32_t spsr)
+{
+	char name[4] = { 'E', 'L', '0' + ((spsr & SPSR_M) >> 2), spsr & 1 ? 'h' : 't' };
+
+	event('B', TRACK_EL, cur_ts);
+	put_str(",\"name\":\"");
+	put(name, sizeof(name));
+	put_str("\"}");
+}
+
+static void context_slice(uint32_t ctx)
+{
+	event('B', TRACK_CONTEXT, cur_ts);
+	put_str(",\"name\":\"");
+	put_hex(ctx);
+	put_str("\"}");
+}
+
+static void slice_end(int tid)
+{
+	event('E', tid, cur_ts);
+	put_str("}");
+}
+
+/* Open slices, then the closing bracket */
+static void timeline_stop(void)
+{
+	if(started) {
+		slice_end(TRACK_EL);
+		slice_end(TRACK_CONTEXT);
+	}
+	put_str("\n]\n");
+}
+
+static void timeline_packet(uint64_t seq, uint64_t timestamp, const FetcherPacket *packet)
+{
+	/* Replayed steps have no capture time, one microsecond a step */
+	cur_ts = timestamp ? timestamp : seq * 1000;
+	if(!started) {
+		base_ts = cur_ts;
+		el_mode = packet->spsr & SPSR_M;
+		context = packet->CONTEXTIDR_EL1;
+		el_slice(el_mode);
+		context_slice(context);
+		started = 1;
+	}
+	if((packet->spsr & SPSR_M) != el_mode) {
+		el_mode = packet->spsr & SPSR_M;
+		slice_end(TRACK_EL);
+		el_slice(el_mode);
+	}
+	if(packet->CONTEXTIDR_EL1 != context) {
+		context = packet->CONTEXTIDR_EL1;
+		slice_end(TRACK_CONTEXT);
+		context_slice(context);
+	}
+}
+
+static void timeline_counter(const char *name, int valid, uint64_t value)
+{
+	EmitCounter *c;
+
+	if(count >= nr_counters) {
+		if((c = realloc(counters, (count + 1) * 2 * sizeof(EmitCounter))) == NULL) {
+			return;
+		}
+		counters = c;
+		memset(counters + nr_counters, 0, ((count + 1) * 2 - nr_counters) * sizeof(EmitCounter));
+		nr_counters = (count + 1) * 2;
+	}
+	c = &counters[count++];
+	if(!valid || (c->valid && c->value == value)) {
+		return;
+	}
+	c->valid = 1;
+	c->value = value;
+
+	event('C', 0, cur_ts);
+	put_str(",\"name\":\"");
+	put_name(name);
+	put_str("\",\"args\":{\"value\":");
+	put_dec(value);
+	put_str("}}");
+}
+
+void emit_watch(int id, const char *name, uint64_t old, uint64_t new)
+{
+	if(fd < 0 || format != EMIT_FORMAT_TIMELINE || !started) {
+		return;
+	}
+
+	event('i', TRACK_WATCH, cur_ts);
+	put_str(",\"s\":\"t\",\"name\":\"");
+	put_name(name);
+	put_str("\",\"args\":{\"old\":\"");
+	put_hex(old);
+	put_str("\",\"new\":\"");
+	put_hex(new);
+	put_str("\"}}");
+}
+
+void emit_flush(void)
+{
+	size_t off = 0;
+	ssize_t n;
+
+	while(fd >= 0 && off < buf_len) {
+		if((n = write(fd, buf + off, buf_len - off)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			/* The reader went away, stop instead of failing every packet */
+			emit_close();
+			return;
+		}
+		off += n;
+	}
+	buf_len = 0;
+	last_flush = now();
+}
+
+int emit_start(const char *path, int fmt)
+{
+	int new_fd;
+
+	if(!strcmp(path, "-")) {
+		new_fd = STDOUT_FILENO;
+	}
+	else if((new_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		return -1;
+	}
+
+	/* A closed pipe must not kill the monitor */
+	signal(SIGPIPE, SIG_IGN);
+
+	emit_stop();
+	fd = new_fd;
+	format = fmt;
+	names_wanted = format == EMIT_FORMAT_BINARY;
+	buf_len = 0;
+	last_flush = now();
+	if(format == EMIT_FORMAT_TIMELINE) {
+		timeline_start();
+	}
+
+	return 0;
+}
+
+int emit_stop(void)
+{
+	if(fd < 0) {
+		return -1;
+	}
+
+	if(format == EMIT_FORMAT_TIMELINE) {
+		timeline_stop();
+	}
+	emit_flush();
+	if(fd >= 0) {
+		emit_close();
+	}
+
+	return 0;
+}
+
+int emit_active(void)
+{
+	return fd >= 0;
+}
+
+int emit_stdout(void)
+{
+	return fd == STDOUT_FILENO;
+}
+
+void emit_names_changed(void)
+{
+	names_wanted = format == EMIT_FORMAT_BINARY;
+	/* Positions moved, every counter is written again */
+	nr_counters = 0;
+}
+
+int emit_names_wanted(void)
+{
+	return fd >= 0 && names_wanted;
+}
+
+static void begin(uint32_t type, uint64_t seq, uint64_t timestamp, uint64_t pc)
+{
+	EmitHeader hdr = {
+		.type = htole32(type),
+		.seq = htole64(seq),
+		.timestamp = htole64(timestamp),
+		.pc = htole64(pc),
+	};
+
+	record = buf_len;
+	count = 0;
+	put(&hdr, sizeof(hdr));
+}
+
+void emit_names_begin(void)
+{
+	begin(EMIT_RECORD_NAMES, 0, 0, 0);
+	names_wanted = 0;
+}
+
+void emit_name(int id, const char *name)
+{
+	EmitName n = { .id = htole32(id) };
+
+	memcpy(n.name, name, strnlen(name, sizeof(n.name) - 1));
+	put(&n, sizeof(n));
+	count++;
+}
+
+void emit_begin(uint64_t seq, uint64_t timestamp, const FetcherPacket *packet)
+{
+	if(format == EMIT_FORMAT_BINARY) {
+		begin(EMIT_RECORD_VALUES, seq, timestamp, packet->pc);
+		return;
+	}
+	if(format == EMIT_FORMAT_TIMELINE) {
+		count = 0;
+		timeline_packet(seq, timestamp, packet);
+		return;
+	}
+
+	put_str("{\"seq\":");
+	put_dec(seq);
+	put_str(",\"ts\":");
+	put_dec(timestamp);
+	put_str(",\"pc\":\"");
+	put_hex(packet->pc);
+	put_str("\",\"regs\":{");
+	first = 1;
+}
+
+void emit_value(int id, const char *name, int valid, uint64_t value)
+{
+	EmitValue v;
+
+	if(format == EMIT_FORMAT_TIMELINE) {
+		timeline_counter(name, valid, value);
+		return;
+	}
+	if(format == EMIT_FORMAT_BINARY) {
+		v.id = htole32(id);
+		v.valid = htole32(valid);
+		v.value = htole64(valid ? value : 0);
+		put(&v, sizeof(v));
+		count++;
+		return;
+	}
+
+	if(!first) {
+		put_str(",");
+	}
+	first = 0;
+	put_str("\"");
+	put_name(name);
+	if(valid) {
+		put_str("\":\"");
+		put_hex(value);
+		put_str("\"");
+	}
+	else {
+		put_str("\":null");
+	}
+}
+
+void emit_end(void)
+{
+	uint32_t le_count = htole32(count);
+
+	if(format == EMIT_FORMAT_BINARY) {
+		if(record + sizeof(EmitHeader) <= buf_len) {
+			memcpy(buf + record + offsetof(EmitHeader, count), &le_count, sizeof(le_count));
+		}
+	}
+	else if(format == EMIT_FORMAT_JSON) {
+		put_str("}}\n");
+	}
+
+	if(buf_len >= EMIT_BUFFER_SIZE || now() - last_flush >= EMIT_FLUSH_NS) {
+		emit_flush();
+	}
+}
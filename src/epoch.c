@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "epoch.h"
+
+/* Epoch of the section a thread is in, 0 outside. One cache line each so
+ * readers never share a line.
+ */
+typedef struct EpochSlot {
+	uint64_t epoch;
+	int used;
+} __attribute__((aligned(64))) EpochSlot;
+
+typedef struct EpochRetired {
+	void *p;
+	void (*destroy)(void *);
+	uint64_t epoch; /* last epoch a reader could have found it in */
+	struct EpochRetired *next;
+} EpochRetired;
+
+static uint64_t global_epoch = 1;
+static EpochSlot slots[EPOCH_MAX_THREADS];
+static __thread EpochSlot *slot;
+static __thread int depth;
+/* Writers only */
+static pthread_mutex_t retired_lock = PTHREAD_MUTEX_INITIALIZER;
+static EpochRetired *retired;
+
+static EpochSlot *epoch_slot(void)
+{
+	int i, expected;
+
+	for(i = 0; i < EPOCH_MAX_THREADS; i++) {
+		expected = 0;
+		if(__atomic_compare_exchange_n(&slots[i].used, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			return &slots[i];
+		}
+	}
+
+	fprintf(stderr, "epoch: more than %d reader threads\n", EPOCH_MAX_THREADS);
+	abort();
+}
+
+void epoch_enter(void)
+{
+	if(depth++) {
+		return;
+	}
+	if(slot == NULL) {
+		slot = epoch_slot();
+	}
+
+	__atomic_store_n(&slot->epoch, __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+	/* The slot is visible before any shared pointer is loaded */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_exit(void)
+{
+	if(--depth) {
+		return;
+	}
+
+	__atomic_store_n(&slot->epoch, 0, __ATOMIC_RELEASE);
+}
+
+void epoch_retire(void *p, void (*destroy)(void *))
+{
+	EpochRetired *r;
+
+	if(p == NULL) {
+		return;
+	}
+	if((r = malloc(sizeof(EpochRetired))) == NULL) {
+		/* Leak rather than free under a reader */
+		return;
+	}
+	r->p = p;
+	r->destroy = destroy;
+	/* The caller already unpublished p, readers entering from now on
+	 * see the new epoch and can not find it
+	 */
+	r->epoch = __atomic_fetch_add(&global_epoch, 1, __ATOMIC_SEQ_CST);
+
+	pthread_mutex_lock(&retired_lock);
+	r->next = retired;
+	retired = r;
+	pthread_mutex_unlock(&retired_lock);
+}
+
+/* Oldest epoch a reader is in, UINT64_MAX if none */
+static uint64_t epoch_oldest(void)
+{
+	uint64_t oldest = UINT64_MAX, e;
+	int i;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for(i = 0; i < EPOCH_MAX_THREADS; i++) {
+		e = __atomic_load_n(&slots[i].epoch, __ATOMIC_ACQUIRE);
+		if(e && e < oldest) {
+			oldest = e;
+		}
+	}
+
+	return oldest;
+}
+
+void epoch_reclaim(void)
+{
+	EpochRetired *r, **pp, *free_list = NULL;
+	uint64_t oldest = epoch_oldest();
+
+	pthread_mutex_lock(&retired_lock);
+	for(pp = &retired; (r = *pp) != NULL;) {
+		if(r->epoch < oldest) {
+			*pp = r->next;
+			r->next = free_list;
+			free_list = r;
+		}
+		else {
+			pp = &r->next;
+		}
+	}
+	pthread_mutex_unlock(&retired_lock);
+
+	for(r = free_list; r != NULL; r = free_list) {
+		free_list = r->next;
+		r->destroy(r->p);
+		free(r);
+	}
+}
+
+void epoch_synchronize(void)
+{
+	uint64_t target = __atomic_add_fetch(&global_epoch, 1, __ATOMIC_SEQ_CST);
+
+	/* The caller's own section would never end */
+	while(epoch_oldest() < target && depth == 0) {
+		sched_yield();
+	}
+	epoch_reclaim();
+}
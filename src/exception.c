@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <string.h>
+#include <endian.h>
+#include <pthread.h>
+
+#include "exception.h"
+
+/* The receive thread updates the record while the prompt thread prints */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static ExceptionRecord record;
+static int valid;
+
+void exception_update(const FetcherWireException *exc)
+{
+	pthread_mutex_lock(&lock);
+	if((valid = exc != NULL)) {
+		record.esr = le64toh(exc->esr);
+		record.far = le64toh(exc->far);
+		record.elr = le64toh(exc->elr);
+		record.vector = le32toh(exc->vector);
+		record.dropped = le32toh(exc->dropped);
+		record.kind = exc->kind;
+		record.el = exc->el;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/* Read a field of the latest record, -1 if the packet has none */
+int exception_read(uint32_t offset, int size, uint64_t *value)
+{
+	uint32_t v32;
+	int ret = -1;
+
+	pthread_mutex_lock(&lock);
+	if(valid && (uint64_t)offset + size <= sizeof(record)) {
+		if(size == 8) {
+			memcpy(value, (uint8_t *)&record + offset, 8);
+		}
+		else {
+			memcpy(&v32, (uint8_t *)&record + offset, 4);
+			*value = v32;
+		}
+		ret = 0;
+	}
+	pthread_mutex_unlock(&lock);
+
+	return ret;
+}
@@ -0,0 +1,61 @@
+#include <stddef.h>
+#include <strings.h>
+
+#include "fields.h"
+
+/* Value names of every field, indexed by value */
+#define E(value, name) [value] = name,
+#define FIELD(REG, FLD, END, START, ENUMS) \
+	static const char *const REG##_##FLD##_enums[] = { ENUMS(E) };
+#include "fields.def"
+#undef FIELD
+#undef E
+
+const ARMCPField arm_cp_fields[NR_ARM_CP_FIELDS] = {
+#define FIELD(REG, FLD, END, START, ENUMS) \
+	[FIELD_##REG##_##FLD] = { \
+		.reg = #REG, \
+		.name = #FLD, \
+		.mask = FIELD_MASK(REG, FLD), \
+		.shift = START, \
+		.width = END - START + 1, \
+		.nr_enums = sizeof(REG##_##FLD##_enums) / sizeof(const char *), \
+		.enums = REG##_##FLD##_enums, \
+	},
+#include "fields.def"
+#undef FIELD
+};
+
+const ARMCPField *arm_cp_field_find(const char *reg, const char *field)
+{
+	int i;
+
+	for(i = 0; i < NR_ARM_CP_FIELDS; i++) {
+		if(!strcasecmp(arm_cp_fields[i].reg, reg) && !strcasecmp(arm_cp_fields[i].name, field)) {
+			return &arm_cp_fields[i];
+		}
+	}
+
+	return NULL;
+}
+
+const ARMCPField *arm_cp_field_list(const char *reg, int *count)
+{
+	int i, j;
+
+	for(i = 0; i < NR_ARM_CP_FIELDS; i++) {
+		if(!strcasecmp(arm_cp_fields[i].reg, reg)) {
+			for(j = i + 1; j < NR_ARM_CP_FIELDS && !strcasecmp(arm_cp_fields[j].reg, reg); j++);
+			*count = j - i;
+			return &arm_cp_fields[i];
+		}
+	}
+
+	*count = 0;
+	return NULL;
+}
+
+const char *arm_cp_field_enum(const ARMCPField *f, uint64_t value)
+{
+	return value < f->nr_enums ? f->enums[value] : NULL;
+}
@@ -0,0 +1,143 @@
+#include <string.h>
+
+#include "format.h"
+#include "types.h"
+
+/* "00" to "ff", the two digits of a byte */
+static const char hex_pairs[513] =
+	"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+	"202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+	"404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+	"606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+	"808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+	"a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+	"c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+	"e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+/* "00" to "99" */
+static const char dec_pairs[201] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/* "00" to "77", the two digits of six bits */
+static const char oct_pairs[129] =
+	"0001020304050607101112131415161720212223242526273031323334353637"
+	"4041424344454647505152535455565760616263646566677071727374757677";
+
+static const uint64_t powers_of_10[20] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+	100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+	10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+	100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+int format_hex_digits(char *buf, uint64_t value)
+{
+	int n = value ? (67 - __builtin_clzll(value)) / 4 : 1, i;
+
+	for(i = n; i >= 2; i -= 2, value >>= 8) {
+		memcpy(buf + i - 2, hex_pairs + (value & 0xff) * 2, 2);
+	}
+	if(i) {
+		buf[0] = hex_pairs[(value & 0xf) * 2 + 1];
+	}
+
+	return n;
+}
+
+int format_hex(char *buf, uint64_t value)
+{
+	/* %#lx prints a zero without the prefix */
+	if(value == 0) {
+		buf[0] = '0';
+		return 1;
+	}
+	buf[0] = '0';
+	buf[1] = 'x';
+
+	return 2 + format_hex_digits(buf + 2, value);
+}
+
+int format_oct(char *buf, uint64_t value)
+{
+	int n = value ? (66 - __builtin_clzll(value)) / 3 : 0, i;
+
+	/* The leading zero of %#lo */
+	buf[0] = '0';
+	for(i = n + 1; i >= 3; i -= 2, value >>= 6) {
+		memcpy(buf + i - 2, oct_pairs + (value & 0x3f) * 2, 2);
+	}
+	if(i == 2) {
+		buf[1] = oct_pairs[(value & 0x7) * 2 + 1];
+	}
+
+	return n + 1;
+}
+
+int format_udec(char *buf, uint64_t value)
+{
+	/* Digits from the bit length, fixed by one compare */
+	int t = (64 - __builtin_clzll(value | 1)) * 1233 >> 12;
+	int n = t + 1 - ((value | 1) < powers_of_10[t]), i;
+
+	for(i = n; value >= 100; i -= 2, value /= 100) {
+		memcpy(buf + i - 2, dec_pairs + (value % 100) * 2, 2);
+	}
+	if(value >= 10) {
+		memcpy(buf, dec_pairs + value * 2, 2);
+	}
+	else {
+		buf[0] = '0' + value;
+	}
+
+	return n;
+}
+
+int format_dec(char *buf, int64_t value)
+{
+	if(value < 0) {
+		buf[0] = '-';
+		return 1 + format_udec(buf + 1, -(uint64_t)value);
+	}
+
+	return format_udec(buf, value);
+}
+
+int format_value(char *buf, uint64_t value, int format)
+{
+	switch(format) {
+	case FORMAT_HEX:
+	case FORMAT_ADDR:
+		return format_hex(buf, value);
+	case FORMAT_OCT:
+		return format_oct(buf, value);
+	case FORMAT_UNS:
+		return format_udec(buf, value);
+	default:
+		return format_dec(buf, value);
+	}
+}
+
+int format_pad(char *buf, int len, int width)
+{
+	if(len < width) {
+		memset(buf + len, ' ', width - len);
+		len = width;
+	}
+
+	return len;
+}
+
+int format_udec_width(char *buf, uint64_t value, int width)
+{
+	char tmp[FORMAT_MAX_DIGITS];
+	int n = format_udec(tmp, value), pad = width > n ? width - n : 0;
+
+	memset(buf, ' ', pad);
+	memcpy(buf + pad, tmp, n);
+
+	return pad + n;
+}
@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <string.h>
+#include <endian.h>
+#include <pthread.h>
+
+#include "fpsimd.h"
+
+/* The receive thread updates the state while the prompt thread prints */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static FPSIMDState state;
+static int valid;
+
+void fpsimd_update(const FetcherWireFPSIMD *fp)
+{
+	int i;
+
+	pthread_mutex_lock(&lock);
+	if((valid = fp != NULL)) {
+		for(i = 0; i < 32; i++) {
+			state.v[i][0] = le64toh(fp->v[i][0]);
+			state.v[i][1] = le64toh(fp->v[i][1]);
+		}
+		state.fpsr = le32toh(fp->fpsr);
+		state.fpcr = le32toh(fp->fpcr);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/* Read a register of the latest packet, -1 if it has no section */
+int fpsimd_read(uint32_t offset, int size, uint64_t *value)
+{
+	uint32_t v32;
+	int ret = -1;
+
+	pthread_mutex_lock(&lock);
+	if(valid && (uint64_t)offset + size <= sizeof(state)) {
+		if(size == 8) {
+			memcpy(value, (uint8_t *)&state + offset, 8);
+		}
+		else {
+			memcpy(&v32, (uint8_t *)&state + offset, 4);
+			*value = v32;
+		}
+		ret = 0;
+	}
+	pthread_mutex_unlock(&lock);
+
+	return ret;
+}
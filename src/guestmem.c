@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "guestmem.h"
+
+typedef struct GuestMemRegion {
+	uint64_t base; /* guest physical address */
+	uint64_t size;
+	const uint8_t *host;
+} GuestMemRegion;
+
+/* Regions are attached from the receive thread and read from the prompt
+ * thread, the lock only keeps a mapping alive while it is copied from.
+ */
+static pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+static GuestMemRegion regions[GUEST_MEM_MAX_REGIONS];
+static int nr_regions;
+
+static int guest_mem_map(int fd, uint64_t base, uint64_t size, uint64_t offset)
+{
+	struct stat st;
+	void *host;
+	int i;
+
+	if(size == 0) {
+		if(fstat(fd, &st) < 0 || st.st_size <= offset) {
+			return -1;
+		}
+		size = st.st_size - offset;
+	}
+
+	host = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, offset);
+	if(host == MAP_FAILED) {
+		return -1;
+	}
+
+	pthread_rwlock_wrlock(&lock);
+	/* A region at the same base replaces the old mapping, ex. QEMU restarted */
+	for(i = 0; i < nr_regions; i++) {
+		if(regions[i].base == base) {
+			munmap((void *)regions[i].host, regions[i].size);
+			break;
+		}
+	}
+	if(i == GUEST_MEM_MAX_REGIONS) {
+		pthread_rwlock_unlock(&lock);
+		munmap(host, size);
+		return -1;
+	}
+	if(i == nr_regions) {
+		nr_regions++;
+	}
+	regions[i].base = base;
+	regions[i].size = size;
+	regions[i].host = host;
+	pthread_rwlock_unlock(&lock);
+
+	return 0;
+}
+
+/* Map a file holding guest memory, ex. a memory-backend-file with share=on.
+ * A zero size maps the whole file from offset.
+ */
+int guest_mem_attach(const char *path, uint64_t base, uint64_t size, uint64_t offset)
+{
+	int fd, ret;
+
+	if((fd = open(path, O_RDONLY)) < 0) {
+		return -1;
+	}
+	ret = guest_mem_map(fd, base, size, offset);
+	close(fd);
+
+	return ret;
+}
+
+/* Map a descriptor owned by the QEMU process through /proc */
+int guest_mem_attach_fd(uint32_t pid, uint32_t fd, uint64_t base, uint64_t size, uint64_t offset)
+{
+	char path[64];
+
+	snprintf(path, sizeof(path), "/proc/%u/fd/%u", pid, fd);
+	return guest_mem_attach(path, base, size, offset);
+}
+
+void guest_mem_detach(void)
+{
+	int i;
+
+	pthread_rwlock_wrlock(&lock);
+	for(i = 0; i < nr_regions; i++) {
+		munmap((void *)regions[i].host, regions[i].size);
+	}
+	nr_regions = 0;
+	pthread_rwlock_unlock(&lock);
+}
+
+/* Copy guest physical memory, fail if any byte is not mapped */
+int guest_mem_read(uint64_t paddr, void *buf, size_t len)
+{
+	int i, ret = -1;
+
+	pthread_rwlock_rdlock(&lock);
+	for(i = 0; i < nr_regions; i++) {
+		if(paddr >= regions[i].base && paddr - regions[i].base < regions[i].size
+		   && len <= regions[i].size - (paddr - regions[i].base)) {
+			memcpy(buf, regions[i].host + (paddr - regions[i].base), len);
+			ret = 0;
+			break;
+		}
+	}
+	pthread_rwlock_unlock(&lock);
+
+	return ret;
+}
+
+/* Iterate attached regions, return -1 past the last one */
+int guest_mem_regions(int index, uint64_t *base, uint64_t *size)
+{
+	int ret = -1;
+
+	pthread_rwlock_rdlock(&lock);
+	if(index < nr_regions) {
+		*base = regions[index].base;
+		*size = regions[index].size;
+		ret = 0;
+	}
+	pthread_rwlock_unlock(&lock);
+
+	return ret;
+}
+
+/* Parse "/NFU": count, format(x, d, u, o) and unit size(b, h, w, g) */
+int guest_mem_parse_format(const char *arg, int *count, char *format, int *unit)
+{
+	if(*arg++ != '/') {
+		return -1;
+	}
+
+	if(isdigit((unsigned char)*arg)) {
+		*count = strtol(arg, (char **)&arg, 10);
+	}
+
+	for(; *arg; arg++) {
+		switch(*arg) {
+		case 'x':
+		case 'd':
+		case 'u':
+		case 'o':
+			*format = *arg;
+			break;
+		case 'b':
+			*unit = 1;
+			break;
+		case 'h':
+			*unit = 2;
+			break;
+		case 'w':
+			*unit = 4;
+			break;
+		case 'g':
+			*unit = 8;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	return *count > 0 ? 0 : -1;
+}
+
+void guest_mem_examine(uint64_t start, int count, char format, int unit,
+                       int (*read)(const void *, uint64_t, void *, size_t), const void *arg,
+                       void (*out)(const char *))
+{
+	char line[256];
+	int per_line = unit >= 4 ? 16 / unit : 8;
+	int i, len = 0;
+
+	for(i = 0; i < count; i++) {
+		uint64_t addr = start + (uint64_t)i * unit;
+		uint64_t value = 0;
+		int64_t svalue;
+
+		if(read(arg, addr, &value, unit) < 0) {
+			if(len) {
+				strcpy(line + len, "\n");
+				out(line);
+			}
+			snprintf(line, sizeof(line), "Cannot access memory at address 0x%lx\n", addr);
+			out(line);
+			return;
+		}
+		/* Guest is little-endian */
+		value = le64toh(value);
+		svalue = (int64_t)(value << (64 - unit * 8)) >> (64 - unit * 8);
+
+		if(i % per_line == 0) {
+			len = snprintf(line, sizeof(line), "0x%lx:", addr);
+		}
+		switch(format) {
+		case 'd':
+			len += snprintf(line + len, sizeof(line) - len, "\t%ld", svalue);
+			break;
+		case 'u':
+			len += snprintf(line + len, sizeof(line) - len, "\t%lu", value);
+			break;
+		case 'o':
+			len += snprintf(line + len, sizeof(line) - len, "\t%#lo", value);
+			break;
+		default:
+			len += snprintf(line + len, sizeof(line) - len, "\t0x%0*lx", unit * 2, value);
+		}
+		if(i % per_line == per_line - 1 || i == count - 1) {
+			strcpy(line + len, "\n");
+			out(line);
+			len = 0;
+		}
+	}
+}
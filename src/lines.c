@@ -0,0 +1,1023 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lines.h"
+#include "epoch.h"
+
+/* DWARF constants used by the line program */
+#define DW_LNS_copy			1
+#define DW_LNS_advance_pc		2
+#define DW_LNS_advance_line		3
+#define DW_LNS_set_file			4
+#define DW_LNS_const_add_pc		8
+#define DW_LNS_fixed_advance_pc		9
+#define DW_LNE_end_sequence		1
+#define DW_LNE_set_address		2
+#define DW_LNE_define_file		3
+#define DW_LNCT_path			1
+#define DW_LNCT_directory_index		2
+#define DW_FORM_block			0x09
+#define DW_FORM_data1			0x0b
+#define DW_FORM_data2			0x05
+#define DW_FORM_data4			0x06
+#define DW_FORM_data8			0x07
+#define DW_FORM_data16			0x1e
+#define DW_FORM_string			0x08
+#define DW_FORM_strp			0x0e
+#define DW_FORM_udata			0x0f
+#define DW_FORM_line_strp		0x1f
+
+#define FILE_HASH_SIZE		(1 << 16)
+
+typedef struct Section {
+	const uint8_t *data;
+	uint64_t size;
+} Section;
+
+/* Bounds checked reader, an overrun sets `error` and reads zeros */
+typedef struct Cursor {
+	const uint8_t *p, *end;
+	int error;
+} Cursor;
+
+/* Row while the table is built, `order` keeps the decode order */
+typedef struct LineRow {
+	uint32_t addr;
+	uint32_t file;
+	uint32_t line;
+	uint32_t order;
+} LineRow;
+
+/* File entry of the unit being decoded */
+typedef struct UnitFile {
+	const char *name;
+	uint64_t dir;
+	uint32_t id; /* LINE_FILE_NONE until a row uses it */
+} UnitFile;
+
+typedef struct LineBuilder {
+	uint64_t lo, hi; /* executable sections */
+	Section line, line_str, str;
+	LineRow *rows;
+	size_t nr_rows, rows_size;
+	/* Interned paths */
+	char *strings;
+	size_t strings_len, strings_size;
+	uint32_t *files; /* offset of each path in strings */
+	uint32_t nr_files;
+	size_t files_size;
+	uint32_t *hash; /* file id + 1, 0 is empty */
+	/* Tables of the current unit */
+	const char **dirs;
+	size_t nr_dirs, dirs_size;
+	UnitFile *unit_files;
+	size_t nr_unit_files, unit_files_size;
+} LineBuilder;
+
+typedef struct LineTable {
+	void *image; /* mapped sidecar, or the freshly built image */
+	size_t size;
+	int mapped;
+	uint64_t base;
+	const LineFileRow *rows;
+	uint32_t nr_rows;
+	const uint32_t *files;
+	uint32_t nr_files;
+	const char *strings;
+	uint64_t strings_size;
+} LineTable;
+
+static LineTable empty_table;
+/* Published table, a reload swaps it and retires the old one */
+static LineTable *table = &empty_table;
+static __thread uint32_t last_hit;
+
+static uint64_t get(Cursor *c, int size)
+{
+	uint8_t u8;
+	uint16_t u16;
+	uint32_t u32;
+	uint64_t u64;
+
+	if(c->end - c->p < size) {
+		c->error = 1;
+		c->p = c->end;
+		return 0;
+	}
+	switch(size) {
+	case 1:
+		u8 = *c->p;
+		c->p += 1;
+		return u8;
+	case 2:
+		memcpy(&u16, c->p, 2);
+		c->p += 2;
+		return u16;
+	case 4:
+		memcpy(&u32, c->p, 4);
+		c->p += 4;
+		return u32;
+	case 8:
+		memcpy(&u64, c->p, 8);
+		c->p += 8;
+		return u64;
+	}
+	c->p += size;
+
+	return 0;
+}
+
+static uint64_t get_uleb(Cursor *c)
+{
+	uint64_t v = 0;
+	int shift = 0;
+	uint8_t b;
+
+	do {
+		if(c->p >= c->end) {
+			c->error = 1;
+			return 0;
+		}
+		b = *c->p++;
+		if(shift < 64) {
+			v |= (uint64_t)(b & 0x7f) << shift;
+		}
+		shift += 7;
+	} while(b & 0x80);
+
+	return v;
+}
+
+static int64_t get_sleb(Cursor *c)
+{
+	int64_t v = 0;
+	int shift = 0;
+	uint8_t b;
+
+	do {
+		if(c->p >= c->end) {
+			c->error = 1;
+			return 0;
+		}
+		b = *c->p++;
+		if(shift < 64) {
+			v |= (int64_t)(b & 0x7f) << shift;
+		}
+		shift += 7;
+	} while(b & 0x80);
+	if(shift < 64 && (b & 0x40)) {
+		v |= -((int64_t)1 << shift);
+	}
+
+	return v;
+}
+
+static const char *get_str(Cursor *c)
+{
+	const char *s = (const char *)c->p;
+	const uint8_t *nul = memchr(c->p, '\0', c->end - c->p);
+
+	if(nul == NULL) {
+		c->error = 1;
+		c->p = c->end;
+		return "";
+	}
+	c->p = nul + 1;
+
+	return s;
+}
+
+static const char *section_str(const Section *s, uint64_t offset)
+{
+	if(offset >= s->size || memchr(s->data + offset, '\0', s->size - offset) == NULL) {
+		return NULL;
+	}
+
+	return (const char *)s->data + offset;
+}
+
+static void *grow(void *array, size_t *size, size_t need, size_t elem)
+{
+	void *p;
+
+	if(need <= *size) {
+		return array;
+	}
+	if((p = realloc(array, (need * 2 + 16) * elem)) == NULL) {
+		return NULL;
+	}
+	*size = need * 2 + 16;
+
+	return p;
+}
+
+/* FNV-1a over the path */
+static uint32_t path_hash(const char *dir, const char *name)
+{
+	uint32_t h = 2166136261u;
+
+	for(; dir && *dir; dir++) {
+		h = (h ^ (uint8_t)*dir) * 16777619u;
+	}
+	h = (h ^ '/') * 16777619u;
+	for(; *name; name++) {
+		h = (h ^ (uint8_t)*name) * 16777619u;
+	}
+
+	return h;
+}
+
+/* Global id of dir/name, added on first use */
+static uint32_t file_intern(LineBuilder *b, const char *dir, const char *name)
+{
+	size_t dir_len, name_len, need;
+	uint32_t h, id, *files;
+	char *s;
+
+	if(name[0] == '/' || dir == NULL || dir[0] == '\0') {
+		dir = NULL;
+	}
+	dir_len = dir ? strlen(dir) : 0;
+	name_len = strlen(name);
+
+	for(h = path_hash(dir, name) & (FILE_HASH_SIZE - 1); b->hash[h]; h = (h + 1) & (FILE_HASH_SIZE - 1)) {
+		s = b->strings + b->files[b->hash[h] - 1];
+		if(dir == NULL && !strcmp(s, name)) {
+			return b->hash[h] - 1;
+		}
+		if(dir && !strncmp(s, dir, dir_len) && s[dir_len] == '/' && !strcmp(s + dir_len + 1, name)) {
+			return b->hash[h] - 1;
+		}
+	}
+	/* Keep the table at most half full */
+	if(b->nr_files >= FILE_HASH_SIZE / 2) {
+		return LINE_FILE_NONE;
+	}
+
+	need = b->strings_len + dir_len + name_len + 2;
+	if((s = grow(b->strings, &b->strings_size, need, 1)) == NULL) {
+		return LINE_FILE_NONE;
+	}
+	b->strings = s;
+	if((files = grow(b->files, &b->files_size, b->nr_files + 1, sizeof(uint32_t))) == NULL) {
+		return LINE_FILE_NONE;
+	}
+	b->files = files;
+
+	id = b->nr_files++;
+	b->files[id] = b->strings_len;
+	s = b->strings + b->strings_len;
+	if(dir) {
+		memcpy(s, dir, dir_len);
+		s[dir_len] = '/';
+		s += dir_len + 1;
+	}
+	memcpy(s, name, name_len + 1);
+	b->strings_len = need;
+	b->hash[h] = id + 1;
+
+	return id;
+}
+
+static void row_add(LineBuilder *b, uint64_t addr, uint32_t file, uint32_t line)
+{
+	LineRow *rows;
+
+	if(addr < b->lo || addr > b->hi) {
+		return;
+	}
+	if((rows = grow(b->rows, &b->rows_size, b->nr_rows + 1, sizeof(LineRow))) == NULL) {
+		return;
+	}
+	b->rows = rows;
+	rows[b->nr_rows].addr = addr - b->lo;
+	rows[b->nr_rows].file = file;
+	rows[b->nr_rows].line = line;
+	rows[b->nr_rows].order = b->nr_rows;
+	b->nr_rows++;
+}
+
+/* Global id of the unit's file `index` */
+static uint32_t unit_file(LineBuilder *b, uint64_t index)
+{
+	UnitFile *f;
+
+	if(index >= b->nr_unit_files) {
+		return LINE_FILE_NONE;
+	}
+	f = &b->unit_files[index];
+	if(f->id == LINE_FILE_NONE) {
+		f->id = file_intern(b, f->dir < b->nr_dirs ? b->dirs[f->dir] : NULL, f->name);
+	}
+
+	return f->id;
+}
+
+static int unit_add_dir(LineBuilder *b, const char *dir)
+{
+	const char **dirs;
+
+	if((dirs = grow(b->dirs, &b->dirs_size, b->nr_dirs + 1, sizeof(char *))) == NULL) {
+		return -1;
+	}
+	b->dirs = dirs;
+	b->dirs[b->nr_dirs++] = dir;
+
+	return 0;
+}
+
+static int unit_add_file(LineBuilder *b, const char *name, uint64_t dir)
+{
+	UnitFile *files;
+
+	if((files = grow(b->unit_files, &b->unit_files_size, b->nr_unit_files + 1,
+	                 sizeof(UnitFile))) == NULL) {
+		return -1;
+	}
+	b->unit_files = files;
+	files[b->nr_unit_files].name = name;
+	files[b->nr_unit_files].dir = dir;
+	files[b->nr_unit_files].id = LINE_FILE_NONE;
+	b->nr_unit_files++;
+
+	return 0;
+}
+
+/* One attribute of a DWARF 5 directory or file entry */
+static void read_form(LineBuilder *b, Cursor *c, uint64_t form, int offset_size,
+                      const char **str, uint64_t *value)
+{
+	*str = NULL;
+	*value = 0;
+
+	switch(form) {
+	case DW_FORM_string:
+		*str = get_str(c);
+		break;
+	case DW_FORM_line_strp:
+		*str = section_str(&b->line_str, get(c, offset_size));
+		break;
+	case DW_FORM_strp:
+		*str = section_str(&b->str, get(c, offset_size));
+		break;
+	case DW_FORM_udata:
+		*value = get_uleb(c);
+		break;
+	case DW_FORM_data1:
+		*value = get(c, 1);
+		break;
+	case DW_FORM_data2:
+		*value = get(c, 2);
+		break;
+	case DW_FORM_data4:
+		*value = get(c, 4);
+		break;
+	case DW_FORM_data8:
+		*value = get(c, 8);
+		break;
+	case DW_FORM_data16:
+		get(c, 16);
+		break;
+	case DW_FORM_block:
+		get(c, get_uleb(c));
+		break;
+	default:
+		/* str_offsets based forms are not supported */
+		c->error = 1;
+	}
+}
+
+/* DWARF 5 directory or file table */
+static int read_entries(LineBuilder *b, Cursor *c, int offset_size, int files)
+{
+	uint64_t formats[16][2], count, i, value, dir;
+	const char *str, *path;
+	int nr_formats, j;
+
+	nr_formats = get(c, 1);
+	if(nr_formats > 16) {
+		return -1;
+	}
+	for(j = 0; j < nr_formats; j++) {
+		formats[j][0] = get_uleb(c);
+		formats[j][1] = get_uleb(c);
+	}
+
+	count = get_uleb(c);
+	for(i = 0; i < count && !c->error; i++) {
+		path = NULL;
+		dir = 0;
+		for(j = 0; j < nr_formats; j++) {
+			read_form(b, c, formats[j][1], offset_size, &str, &value);
+			if(formats[j][0] == DW_LNCT_path) {
+				path = str;
+			}
+			else if(formats[j][0] == DW_LNCT_directory_index) {
+				dir = value;
+			}
+		}
+		if(path == NULL) {
+			path = "";
+		}
+		if((files ? unit_add_file(b, path, dir) : unit_add_dir(b, path)) < 0) {
+			return -1;
+		}
+	}
+
+	return c->error ? -1 : 0;
+}
+
+/* Decode one line program, `c` covers the unit */
+static int read_unit(LineBuilder *b, Cursor *c, int offset_size)
+{
+	uint8_t min_inst, default_is_stmt, line_range, opcode_base, op, lengths[256];
+	int8_t line_base;
+	uint64_t header_length, address = 0, file = 1, len, i;
+	int64_t line = 1;
+	const char *name;
+	Cursor ext;
+	size_t sequence = b->nr_rows;
+	int version, addr_size = 8;
+
+	version = get(c, 2);
+	if(version < 2 || version > 5) {
+		return -1;
+	}
+	if(version >= 5) {
+		addr_size = get(c, 1);
+		get(c, 1); /* segment selector size */
+	}
+	header_length = get(c, offset_size);
+	if(header_length > c->end - c->p) {
+		return -1;
+	}
+	min_inst = get(c, 1);
+	if(version >= 4) {
+		get(c, 1); /* maximum operations per instruction, VLIW only */
+	}
+	default_is_stmt = get(c, 1);
+	line_base = get(c, 1);
+	line_range = get(c, 1);
+	opcode_base = get(c, 1);
+	if(line_range == 0 || opcode_base == 0) {
+		return -1;
+	}
+	memset(lengths, 0, sizeof(lengths));
+	for(i = 1; i < opcode_base; i++) {
+		lengths[i] = get(c, 1);
+	}
+	(void)default_is_stmt;
+
+	b->nr_dirs = 0;
+	b->nr_unit_files = 0;
+	if(version >= 5) {
+		if(read_entries(b, c, offset_size, 0) < 0 || read_entries(b, c, offset_size, 1) < 0) {
+			return -1;
+		}
+	}
+	else {
+		/* Directory 0 is the compilation directory, not listed */
+		unit_add_dir(b, NULL);
+		while(!c->error && *(name = get_str(c))) {
+			unit_add_dir(b, name);
+		}
+		/* Files are numbered from 1 */
+		unit_add_file(b, "", 0);
+		while(!c->error && *(name = get_str(c))) {
+			unit_add_file(b, name, get_uleb(c));
+			get_uleb(c);
+			get_uleb(c);
+		}
+		file = 1;
+	}
+	if(c->error) {
+		return -1;
+	}
+
+	while(c->p < c->end && !c->error) {
+		op = get(c, 1);
+		if(op >= opcode_base) {
+			/* Special opcode: advance both and emit a row */
+			op -= opcode_base;
+			address += (op / line_range) * min_inst;
+			line += line_base + op % line_range;
+			row_add(b, address, unit_file(b, file), line);
+			continue;
+		}
+
+		switch(op) {
+		case 0:
+			len = get_uleb(c);
+			if(len == 0 || len > c->end - c->p) {
+				return -1;
+			}
+			ext.p = c->p;
+			ext.end = c->p + len;
+			ext.error = 0;
+			c->p += len;
+			switch(get(&ext, 1)) {
+			case DW_LNE_end_sequence:
+				/* A row at the end address is past the code */
+				while(b->nr_rows > sequence && address >= b->lo
+				      && b->rows[b->nr_rows - 1].addr == address - b->lo) {
+					b->nr_rows--;
+				}
+				row_add(b, address, LINE_FILE_NONE, 0);
+				sequence = b->nr_rows;
+				address = 0;
+				file = 1;
+				line = 1;
+				break;
+			case DW_LNE_set_address:
+				address = get(&ext, len - 1 == 4 ? 4 : addr_size);
+				break;
+			case DW_LNE_define_file:
+				name = get_str(&ext);
+				unit_add_file(b, name, get_uleb(&ext));
+				break;
+			}
+			break;
+		case DW_LNS_copy:
+			row_add(b, address, unit_file(b, file), line);
+			break;
+		case DW_LNS_advance_pc:
+			address += get_uleb(c) * min_inst;
+			break;
+		case DW_LNS_advance_line:
+			line += get_sleb(c);
+			break;
+		case DW_LNS_set_file:
+			file = get_uleb(c);
+			break;
+		case DW_LNS_const_add_pc:
+			address += ((255 - opcode_base) / line_range) * min_inst;
+			break;
+		case DW_LNS_fixed_advance_pc:
+			address += get(c, 2);
+			break;
+		default:
+			/* Operands of the other standard opcodes are all ULEB128 */
+			for(i = 0; i < lengths[op]; i++) {
+				get_uleb(c);
+			}
+		}
+	}
+
+	return c->error ? -1 : 0;
+}
+
+static int row_cmp(const void *a, const void *b)
+{
+	const LineRow *x = a, *y = b;
+	int x_end = x->file == LINE_FILE_NONE, y_end = y->file == LINE_FILE_NONE;
+
+	if(x->addr != y->addr) {
+		return x->addr < y->addr ? -1 : 1;
+	}
+	/* At one address a sequence end sorts before a row, the last row wins */
+	if(x_end != y_end) {
+		return y_end - x_end;
+	}
+
+	return x->order < y->order ? -1 : 1;
+}
+
+/* Sorted rows, one per address, runs of the same line merged */
+static void rows_finish(LineBuilder *b)
+{
+	size_t i, n = 0;
+
+	qsort(b->rows, b->nr_rows, sizeof(LineRow), row_cmp);
+	for(i = 0; i < b->nr_rows; i++) {
+		if(n && b->rows[n - 1].addr == b->rows[i].addr) {
+			n--;
+		}
+		if(n && b->rows[n - 1].file == b->rows[i].file && b->rows[n - 1].line == b->rows[i].line) {
+			continue;
+		}
+		b->rows[n++] = b->rows[i];
+	}
+	b->nr_rows = n;
+}
+
+/* ELF sections needed to build the table, and the build id */
+static int elf_scan(const uint8_t *map, size_t size, LineBuilder *b, uint8_t *id, uint32_t *id_len)
+{
+	const Elf64_Ehdr *eh = (const Elf64_Ehdr *)map;
+	const Elf64_Shdr *sh;
+	const char *shstr, *name;
+	Cursor c;
+	uint32_t namesz, descsz, type;
+	int i;
+
+	if(size < sizeof(Elf64_Ehdr) || memcmp(eh->e_ident, ELFMAG, SELFMAG)
+	   || eh->e_ident[EI_CLASS] != ELFCLASS64
+	   || eh->e_ident[EI_DATA] != (__BYTE_ORDER == __LITTLE_ENDIAN ? ELFDATA2LSB : ELFDATA2MSB)
+	   || eh->e_shentsize != sizeof(Elf64_Shdr) || eh->e_shoff > size
+	   || eh->e_shnum > (size - eh->e_shoff) / sizeof(Elf64_Shdr) || eh->e_shstrndx >= eh->e_shnum) {
+		return -1;
+	}
+	sh = (const Elf64_Shdr *)(map + eh->e_shoff);
+	if(sh[eh->e_shstrndx].sh_offset > size) {
+		return -1;
+	}
+	shstr = (const char *)map + sh[eh->e_shstrndx].sh_offset;
+
+	b->lo = UINT64_MAX;
+	b->hi = 0;
+	for(i = 0; i < eh->e_shnum; i++) {
+		if(sh[i].sh_type != SHT_NOBITS && (sh[i].sh_offset > size || sh[i].sh_size > size - sh[i].sh_offset)) {
+			continue;
+		}
+		if(sh[i].sh_name >= sh[eh->e_shstrndx].sh_size) {
+			continue;
+		}
+		name = shstr + sh[i].sh_name;
+
+		if((sh[i].sh_flags & (SHF_ALLOC | SHF_EXECINSTR)) == (SHF_ALLOC | SHF_EXECINSTR) && sh[i].sh_addr) {
+			b->lo = sh[i].sh_addr < b->lo ? sh[i].sh_addr : b->lo;
+			b->hi = sh[i].sh_addr + sh[i].sh_size > b->hi ? sh[i].sh_addr + sh[i].sh_size : b->hi;
+		}
+		else if(!strcmp(name, ".debug_line")) {
+			b->line.data = map + sh[i].sh_offset;
+			b->line.size = sh[i].sh_size;
+		}
+		else if(!strcmp(name, ".debug_line_str")) {
+			b->line_str.data = map + sh[i].sh_offset;
+			b->line_str.size = sh[i].sh_size;
+		}
+		else if(!strcmp(name, ".debug_str")) {
+			b->str.data = map + sh[i].sh_offset;
+			b->str.size = sh[i].sh_size;
+		}
+		else if(sh[i].sh_type == SHT_NOTE && *id_len == 0) {
+			c.p = map + sh[i].sh_offset;
+			c.end = c.p + sh[i].sh_size;
+			c.error = 0;
+			while(c.p < c.end && !c.error) {
+				namesz = get(&c, 4);
+				descsz = get(&c, 4);
+				type = get(&c, 4);
+				name = (const char *)c.p;
+				get(&c, (namesz + 3) & ~3);
+				if(!c.error && type == NT_GNU_BUILD_ID && namesz == 4 && !memcmp(name, "GNU", 4)
+				   && descsz <= LINE_BUILD_ID_LEN && descsz <= c.end - c.p) {
+					memcpy(id, c.p, descsz);
+					*id_len = descsz;
+				}
+				get(&c, (descsz + 3) & ~3);
+			}
+		}
+	}
+
+	if(b->lo >= b->hi) {
+		return -1;
+	}
+	if(b->hi - b->lo > UINT32_MAX) {
+		b->hi = b->lo + UINT32_MAX;
+	}
+
+	return 0;
+}
+
+static void builder_free(LineBuilder *b)
+{
+	free(b->rows);
+	free(b->strings);
+	free(b->files);
+	free(b->hash);
+	free(b->dirs);
+	free(b->unit_files);
+}
+
+/* Decode .debug_line into a sidecar image */
+static void *lines_build(const uint8_t *map, size_t size, const uint8_t *id, uint32_t id_len,
+                         size_t *image_size)
+{
+	LineBuilder b = {0};
+	LineFileHeader *hdr;
+	LineFileRow *rows;
+	uint8_t id_tmp[LINE_BUILD_ID_LEN];
+	uint32_t id_tmp_len = 0, i;
+	uint64_t unit_length;
+	Cursor all, unit;
+	uint8_t *image = NULL;
+	int offset_size;
+
+	if(elf_scan(map, size, &b, id_tmp, &id_tmp_len) < 0 || b.line.data == NULL
+	   || (b.hash = calloc(FILE_HASH_SIZE, sizeof(uint32_t))) == NULL) {
+		builder_free(&b);
+		return NULL;
+	}
+
+	all.p = b.line.data;
+	all.end = b.line.data + b.line.size;
+	all.error = 0;
+	while(all.p < all.end && !all.error) {
+		offset_size = 4;
+		unit_length = get(&all, 4);
+		if(unit_length == 0xffffffff) {
+			offset_size = 8;
+			unit_length = get(&all, 8);
+		}
+		if(all.error || unit_length > all.end - all.p) {
+			break;
+		}
+		unit.p = all.p;
+		unit.end = all.p + unit_length;
+		unit.error = 0;
+		all.p = unit.end;
+		/* A unit that can not be decoded is left out */
+		read_unit(&b, &unit, offset_size);
+	}
+	rows_finish(&b);
+
+	*image_size = sizeof(LineFileHeader) + b.nr_rows * sizeof(LineFileRow)
+	              + b.nr_files * sizeof(uint32_t) + b.strings_len;
+	if(b.nr_rows == 0 || (image = malloc(*image_size)) == NULL) {
+		builder_free(&b);
+		return NULL;
+	}
+
+	hdr = (LineFileHeader *)image;
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, LINE_MAGIC, sizeof(hdr->magic));
+	hdr->version = LINE_VERSION;
+	hdr->build_id_len = id_len;
+	memcpy(hdr->build_id, id, id_len);
+	hdr->base = b.lo;
+	hdr->nr_rows = b.nr_rows;
+	hdr->nr_files = b.nr_files;
+	hdr->strings_size = b.strings_len;
+
+	rows = (LineFileRow *)(hdr + 1);
+	for(i = 0; i < b.nr_rows; i++) {
+		rows[i].addr = b.rows[i].addr;
+		rows[i].file = b.rows[i].file;
+		rows[i].line = b.rows[i].line;
+	}
+	memcpy(rows + b.nr_rows, b.files, b.nr_files * sizeof(uint32_t));
+	memcpy((uint8_t *)(rows + b.nr_rows) + b.nr_files * sizeof(uint32_t), b.strings, b.strings_len);
+
+	builder_free(&b);
+
+	return image;
+}
+
+/* Point the table into an image, -1 if it is not consistent */
+static int lines_attach(LineTable *t, void *image, size_t size)
+{
+	const LineFileHeader *hdr = image;
+	uint64_t need;
+
+	if(size < sizeof(LineFileHeader) || memcmp(hdr->magic, LINE_MAGIC, sizeof(hdr->magic))
+	   || hdr->version != LINE_VERSION) {
+		return -1;
+	}
+	need = sizeof(LineFileHeader) + (uint64_t)hdr->nr_rows * sizeof(LineFileRow)
+	       + (uint64_t)hdr->nr_files * sizeof(uint32_t) + hdr->strings_size;
+	if(need != size || hdr->strings_size == 0 || ((const char *)image)[size - 1] != '\0') {
+		return -1;
+	}
+
+	t->image = image;
+	t->size = size;
+	t->base = hdr->base;
+	t->rows = (const LineFileRow *)(hdr + 1);
+	t->nr_rows = hdr->nr_rows;
+	t->files = (const uint32_t *)(t->rows + t->nr_rows);
+	t->nr_files = hdr->nr_files;
+	t->strings = (const char *)(t->files + t->nr_files);
+	t->strings_size = hdr->strings_size;
+
+	return 0;
+}
+
+static void lines_free(LineTable *t)
+{
+	if(t->mapped) {
+		munmap(t->image, t->size);
+	}
+	else {
+		free(t->image);
+	}
+	memset(t, 0, sizeof(*t));
+}
+
+static void lines_destroy(void *p)
+{
+	if(p != &empty_table) {
+		lines_free(p);
+		free(p);
+	}
+}
+
+static void sidecar_path(char *path, size_t len, const uint8_t *id, uint32_t id_len)
+{
+	const char *cache = getenv("XDG_CACHE_HOME");
+	size_t n;
+	uint32_t i;
+
+	if(cache && cache[0]) {
+		snprintf(path, len, "%s", cache);
+	}
+	else {
+		snprintf(path, len, "%s/.cache", getenv("HOME") ? getenv("HOME") : ".");
+	}
+	mkdir(path, 0755);
+	n = strlen(path);
+	n += snprintf(path + n, len - n, "/qemu-monitor");
+	mkdir(path, 0755);
+
+	n += snprintf(path + n, n < len ? len - n : 0, "/");
+	for(i = 0; i < id_len; i++) {
+		n += snprintf(path + n, n < len ? len - n : 0, "%02x", id[i]);
+	}
+	snprintf(path + n, n < len ? len - n : 0, ".lines");
+}
+
+/* Map an existing sidecar of the same build */
+static int sidecar_map(LineTable *t, const char *path, const uint8_t *id, uint32_t id_len)
+{
+	const LineFileHeader *hdr;
+	struct stat st;
+	void *map;
+	int fd;
+
+	if((fd = open(path, O_RDONLY)) < 0) {
+		return -1;
+	}
+	if(fstat(fd, &st) < 0 || st.st_size < sizeof(LineFileHeader)) {
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		return -1;
+	}
+
+	hdr = map;
+	if(hdr->build_id_len != id_len || memcmp(hdr->build_id, id, id_len)
+	   || lines_attach(t, map, st.st_size) < 0) {
+		munmap(map, st.st_size);
+		return -1;
+	}
+	t->mapped = 1;
+
+	return 0;
+}
+
+static void sidecar_write(const char *path, const void *image, size_t size)
+{
+	char tmp[4096 + 16];
+	FILE *fout;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	if((fout = fopen(tmp, "wb")) == NULL) {
+		return;
+	}
+	if(fwrite(image, size, 1, fout) != 1) {
+		fclose(fout);
+		unlink(tmp);
+		return;
+	}
+	fclose(fout);
+	/* Readers never see a partial file */
+	rename(tmp, path);
+}
+
+int lines_load(const char *path)
+{
+	LineTable t = {0}, *p;
+	LineBuilder scan = {0};
+	uint8_t id[LINE_BUILD_ID_LEN];
+	uint32_t id_len = 0;
+	char sidecar[4096];
+	struct stat st;
+	uint8_t *map;
+	void *image;
+	size_t size;
+	int fd, ret;
+
+	if((fd = open(path, O_RDONLY)) < 0) {
+		return -1;
+	}
+	if(fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		return -1;
+	}
+
+	/* Without a build id the file is keyed by its size and time */
+	if(elf_scan(map, st.st_size, &scan, id, &id_len) < 0) {
+		munmap(map, st.st_size);
+		return -1;
+	}
+	if(id_len == 0) {
+		memcpy(id, &st.st_size, sizeof(uint64_t));
+		memcpy(id + sizeof(uint64_t), &st.st_mtime, sizeof(uint64_t));
+		id_len = 2 * sizeof(uint64_t);
+	}
+	sidecar_path(sidecar, sizeof(sidecar), id, id_len);
+
+	ret = sidecar_map(&t, sidecar, id, id_len);
+	if(ret < 0 && (image = lines_build(map, st.st_size, id, id_len, &size)) != NULL) {
+		sidecar_write(sidecar, image, size);
+		if((ret = lines_attach(&t, image, size)) < 0) {
+			free(image);
+		}
+	}
+	munmap(map, st.st_size);
+	if(ret < 0) {
+		return -1;
+	}
+	if((p = malloc(sizeof(LineTable))) == NULL) {
+		lines_free(&t);
+		return -1;
+	}
+	*p = t;
+
+	/* A display being formatted may still read the old table */
+	epoch_retire(__atomic_exchange_n(&table, p, __ATOMIC_ACQ_REL), lines_destroy);
+	epoch_reclaim();
+
+	return 0;
+}
+
+uint32_t lines_count(void)
+{
+	uint32_t count;
+
+	epoch_enter();
+	count = __atomic_load_n(&table, __ATOMIC_ACQUIRE)->nr_rows;
+	epoch_exit();
+
+	return count;
+}
+
+const char *lines_lookup(uint64_t addr, uint32_t *line)
+{
+	const LineTable *t = __atomic_load_n(&table, __ATOMIC_ACQUIRE);
+	uint64_t off = addr - t->base;
+	uint32_t key, k = last_hit, lo, hi, mid;
+
+	if(t->nr_rows == 0 || addr < t->base || off > UINT32_MAX) {
+		return NULL;
+	}
+	key = off;
+
+	/* Rows of one function are met again and again */
+	if(k + 1 >= t->nr_rows || key < t->rows[k].addr || key >= t->rows[k + 1].addr) {
+		/* Last row at or below key */
+		lo = 0;
+		hi = t->nr_rows;
+		while(hi - lo > 1) {
+			mid = (lo + hi) / 2;
+			if(t->rows[mid].addr <= key) {
+				lo = mid;
+			}
+			else {
+				hi = mid;
+			}
+		}
+		if(t->rows[lo].addr > key) {
+			return NULL;
+		}
+		k = last_hit = lo;
+	}
+
+	if(t->rows[k].file >= t->nr_files || t->files[t->rows[k].file] >= t->strings_size) {
+		return NULL;
+	}
+	*line = t->rows[k].line;
+
+	return t->strings + t->files[t->rows[k].file];
+}
+
+void lines_format(uint64_t addr, char *buf, size_t len)
+{
+	const char *file;
+	uint32_t line;
+	size_t n = strlen(buf);
+
+	if(n >= len) {
+		return;
+	}
+
+	epoch_enter();
+	if((file = lines_lookup(addr, &line)) != NULL) {
+		snprintf(buf + n, len - n, " %s:%u", file, line);
+	}
+	epoch_exit();
+}
@@ -1,3 +1,5 @@
+/* pthread_setaffinity_np */
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -8,137 +10,504 @@
 #include <string.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sched.h>
 #include <ncurses.h>
 #include <errno.h>
+#include <endian.h>
 
 #include "types.h"
 #include "ui.h"
 #include "console.h"
+#include "trace.h"
+#include "replay.h"
+#include "query.h"
+#include "guestmem.h"
+#include "mmu.h"
+#include "sysregs.h"
+#include "exception.h"
+#include "fpsimd.h"
+#include "proxy.h"
+#include "command.h"
+#include "emit.h"
+#include "symbols.h"
+#include "lines.h"
+#include "stats.h"
 
 /* IPC socket address */
 #define ADDRESS "fetcher"
 
 /* Global variables */
 FILE *fp;
+/* What the fetcher is asked to capture, kept across connections */
+static uint32_t subscription;
+/* Connected socket, commands send a new subscription through it */
+static pthread_mutex_t conn_lock = PTHREAD_MUTEX_INITIALIZER;
+static int conn_fd = -1;
+/* gdb proxy mode, the gdbstub of a stock QEMU instead of the fetcher */
+static const char *proxy_target;
+static int proxy_port;
+/* --poll, the receive thread spins on the socket instead of sleeping in
+ * read(), optionally pinned to `poll_cpu`
+ */
+static int poll_mode;
+static int poll_cpu = -1;
+/* Longest pause backoff of an empty poll, in pause instructions */
+#define POLL_MAX_SPINS		1024
+/* Receive buffer of the poll mode, preallocated for the whole session */
+#define RX_BUFFER_SIZE		(1024 * 1024)
+static uint8_t rx_buf[RX_BUFFER_SIZE];
+static uint32_t rx_pos, rx_len;
+static int rx_fd = -1;
 
 /* Used for unused parameters to silence gcc warnings */
 #define UNUSED __attribute__((__unused__))
 
-/* IPC socket connection for TUI */
-static void tui_conn(void)
+/* Tell the core a spin loop is waiting */
+static inline void cpu_relax(void)
 {
-        int ns, s, len;
-	socklen_t fromlen UNUSED;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
 
-	fromlen = 0;
+/* Poll the socket until more bytes are in the receive buffer, backing off
+ * with pause instructions while it is empty. Return 0 on connection closed.
+ */
+static int rx_fill(void)
+{
+	uint32_t spins = 1, i;
+	ssize_t n;
+
+	/* Keep the unread tail of a message at the start */
+	if(rx_pos > 0) {
+		memmove(rx_buf, rx_buf + rx_pos, rx_len - rx_pos);
+		rx_len -= rx_pos;
+		rx_pos = 0;
+	}
 
-        struct sockaddr_un saun, fsaun;
-        if((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
-                console_puts("Server: Socket");
-        }
+	while(1) {
+		n = recv(rx_fd, rx_buf + rx_len, RX_BUFFER_SIZE - rx_len, MSG_DONTWAIT);
+		if(n > 0) {
+			rx_len += n;
+			return 1;
+		}
+		if(n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+			return 0;
+		}
+		for(i = 0; i < spins; i++) {
+			cpu_relax();
+		}
+		if(spins < POLL_MAX_SPINS) {
+			spins <<= 1;
+		}
+	}
+}
 
-        saun.sun_family = AF_UNIX;
-        strcpy(saun.sun_path, ADDRESS);
+/* Read `length` bytes of the connection. Return 1 on success, 0 on
+ * connection closed.
+ */
+static int conn_recv(void *dst, uint32_t length)
+{
+	uint8_t *p = dst;
+	uint32_t n;
 
-        unlink(ADDRESS);
-        len = sizeof(saun.sun_family) + strlen(saun.sun_path);
+	if(!poll_mode) {
+		return fread(dst, length, 1, fp) == 1;
+	}
 
-	// XXX bind() need a const struct sockaddr pointer as argument...
-	const struct sockaddr *saun_const = (struct sockaddr *)&saun;
-        if(bind(s, saun_const, len) < 0) {
-                console_puts("Server: Bind");
-        }
+	while(length > 0) {
+		if(rx_pos == rx_len && !rx_fill()) {
+			return 0;
+		}
+		n = rx_len - rx_pos < length ? rx_len - rx_pos : length;
+		memcpy(p, rx_buf + rx_pos, n);
+		rx_pos += n;
+		p += n;
+		length -= n;
+	}
 
-        if(listen(s, 5) < 0) {
-                console_puts("Server: Listen");
-        }
+	return 1;
+}
 
-        if((ns = accept(s, (struct sockaddr *)&fsaun, &fromlen)) < 0) {
-                console_puts("Server: Accept");
-        }
+static int conn_skip(uint32_t length)
+{
+	uint32_t n;
+
+	while(length > 0) {
+		if(!poll_mode) {
+			if(fgetc(fp) == EOF) {
+				return 0;
+			}
+			length--;
+			continue;
+		}
+		if(rx_pos == rx_len && !rx_fill()) {
+			return 0;
+		}
+		n = rx_len - rx_pos < length ? rx_len - rx_pos : length;
+		rx_pos += n;
+		length -= n;
+	}
 
-	fp = fdopen(ns, "r");
+	return 1;
 }
 
-static void *tui_conn_thread(void *arg)
+/* Read messages from QEMU until a register packet arrives.
+ * Messages of unknown type are skipped by length, so a newer fetcher can
+ * append sections we do not understand yet.
+ * Return 1 on success, 0 on connection closed or protocol error.
+ */
+static int packet_read(FetcherPacket *packet, uint64_t *timestamp)
 {
-	FetcherPacket packet = {0};
+	FetcherHeader hdr;
+	FetcherWireRegs wire;
+	FetcherWireMemMap map;
+	FetcherWireException exc;
+	FetcherWireFPSIMD fpsimd;
+	int exception = 0, fp_section = 0;
+	static uint8_t *payload;
+	static uint32_t payload_size;
+	uint8_t *p;
+
+	while(conn_recv(&hdr, sizeof(FetcherHeader))) {
+		uint32_t length = le32toh(hdr.length);
+
+		if(hdr.version != FETCHER_VERSION) {
+			return 0;
+		}
 
-	while(1) {
-		/* Connect to QEMU */
-		tui_conn();
-		display_status(1);
+		if(le16toh(hdr.type) == FETCHER_MSG_REGS && length == sizeof(FetcherWireRegs)) {
+			if(!conn_recv(&wire, sizeof(FetcherWireRegs))) {
+				return 0;
+			}
+			fetcher_regs_unpack(packet, &wire);
+			*timestamp = le64toh(hdr.timestamp);
+			/* A capture at a gdb stop clears the previous record */
+			exception_update(exception ? &exc : NULL);
+			fpsimd_update(fp_section ? &fpsimd : NULL);
+			return 1;
+		}
 
-		/* Handle each packet received from QEMU */
-		while(fread(&packet, sizeof(FetcherPacket), 1, fp)) {
-			display_update(packet);
+		/* Exception mode, the record belongs to the next register packet */
+		if(le16toh(hdr.type) == FETCHER_MSG_EXCEPTION && length == sizeof(FetcherWireException)) {
+			if(!conn_recv(&exc, sizeof(FetcherWireException))) {
+				return 0;
+			}
+			exception = 1;
+			/* Ask a restarted QEMU for the exception mode again */
+			__atomic_or_fetch(&subscription, FETCHER_SUBSCRIBE_EXCEPTIONS, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		/* FP/SIMD registers, sent while a display or watch reads them */
+		if(le16toh(hdr.type) == FETCHER_MSG_FPSIMD && length == sizeof(FetcherWireFPSIMD)) {
+			if(!conn_recv(&fpsimd, sizeof(FetcherWireFPSIMD))) {
+				return 0;
+			}
+			fp_section = 1;
+			continue;
+		}
+
+		/* Guest RAM shared by the fetcher */
+		if(le16toh(hdr.type) == FETCHER_MSG_MEMMAP && length == sizeof(FetcherWireMemMap)) {
+			if(!conn_recv(&map, sizeof(FetcherWireMemMap))) {
+				return 0;
+			}
+			guest_mem_attach_fd(le32toh(map.pid), le32toh(map.fd), le64toh(map.base),
+			                    le64toh(map.size), le64toh(map.offset));
+			/* Cached translations point into the old memory */
+			mmu_flush();
+			continue;
+		}
+
+		/* Raw system registers of the capture mode */
+		if(le16toh(hdr.type) == FETCHER_MSG_SYSREGS_LAYOUT || le16toh(hdr.type) == FETCHER_MSG_SYSREGS) {
+			if(length > payload_size) {
+				if((p = realloc(payload, length)) == NULL) {
+					if(!conn_skip(length)) {
+						return 0;
+					}
+					continue;
+				}
+				payload = p;
+				payload_size = length;
+			}
+			if(length && !conn_recv(payload, length)) {
+				return 0;
+			}
+			if(le16toh(hdr.type) == FETCHER_MSG_SYSREGS) {
+				sysregs_update(payload, length);
+			}
+			else {
+				sysregs_layout((FetcherWireSysreg *)payload, length / sizeof(FetcherWireSysreg),
+				               hdr.flags & FETCHER_FLAG_BIG_ENDIAN);
+				/* Ask a restarted QEMU for the capture mode again */
+				__atomic_or_fetch(&subscription, FETCHER_SUBSCRIBE_SYSREGS, __ATOMIC_RELAXED);
+			}
+			continue;
+		}
+
+		/* Skip unknown payload */
+		if(!conn_skip(length)) {
+			return 0;
 		}
-		display_status(1);
 	}
 
 	return 0;
 }
 
-static void *tui_prompt_thread(void *arg)
+/* One listening socket for the whole process, a restarted QEMU is
+ * accepted again right away
+ */
+static int listener = -1;
+
+static int listen_open(void (*report)(const char *))
 {
-	console_prompt();
+	struct sockaddr_un saun;
+	int s, len;
 
-	pthread_exit(0);
+	if(listener >= 0) {
+		return 0;
+	}
+
+	if((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		report("Server: Socket");
+		return -1;
+	}
+
+	saun.sun_family = AF_UNIX;
+	strcpy(saun.sun_path, ADDRESS);
+
+	unlink(ADDRESS);
+	len = sizeof(saun.sun_family) + strlen(saun.sun_path);
+
+	if(bind(s, (struct sockaddr *)&saun, len) < 0) {
+		report("Server: Bind");
+		close(s);
+		return -1;
+	}
+
+	if(listen(s, 5) < 0) {
+		report("Server: Listen");
+		close(s);
+		return -1;
+	}
+
+	listener = s;
+
+	return 0;
+}
+
+static void control_send(int fd, uint16_t type, const void *payload, uint32_t length)
+{
+	FetcherHeader hdr = {
+		.length = htole32(length),
+		.type = htole16(type),
+		.version = FETCHER_VERSION,
+	};
+
+	if(write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		return;
+	}
+	if(length && write(fd, payload, length) != length) {
+		return;
+	}
+}
+
+/* Push the subscription and ask for the current state */
+static void conn_resync(int fd)
+{
+	FetcherWireSubscribe sub;
+
+	command_resync();
+	pthread_mutex_lock(&conn_lock);
+	sub.flags = htole32(__atomic_load_n(&subscription, __ATOMIC_RELAXED) | command_subscription());
+	control_send(fd, FETCHER_MSG_SUBSCRIBE, &sub, sizeof(sub));
+	control_send(fd, FETCHER_MSG_KEYFRAME, NULL, 0);
+	conn_fd = fd;
+	pthread_mutex_unlock(&conn_lock);
+}
+
+/* The display or watch lists need other sections, the fetcher follows
+ * at its next stop
+ */
+static void conn_subscribe(uint32_t flags)
+{
+	FetcherWireSubscribe sub;
+
+	pthread_mutex_lock(&conn_lock);
+	if(conn_fd >= 0) {
+		sub.flags = htole32(__atomic_load_n(&subscription, __ATOMIC_RELAXED) | flags);
+		control_send(conn_fd, FETCHER_MSG_SUBSCRIBE, &sub, sizeof(sub));
+	}
+	pthread_mutex_unlock(&conn_lock);
+}
+
+/* Next packet of QEMU, from the fetcher or read at a stop by the proxy */
+static int conn_read(FetcherPacket *packet, uint64_t *timestamp)
+{
+	if(proxy_target) {
+		return proxy_read(packet, timestamp, command_subscription());
+	}
+
+	return packet_read(packet, timestamp);
+}
+
+static void conn_close(void)
+{
+	if(proxy_target) {
+		proxy_close();
+		return;
+	}
+
+	pthread_mutex_lock(&conn_lock);
+	conn_fd = -1;
+	pthread_mutex_unlock(&conn_lock);
+	if(fp) {
+		fclose(fp);
+		fp = NULL;
+	}
+	if(rx_fd >= 0) {
+		close(rx_fd);
+		rx_fd = -1;
+	}
+	fpsimd_update(NULL);
+}
+
+/* IPC socket connection, `report` prints errors. Return -1 on failure */
+static int conn(void (*report)(const char *))
+{
+	int ns;
+
+	if(proxy_target) {
+		if(proxy_open(proxy_port, proxy_target, report) < 0) {
+			return -1;
+		}
+		command_resync();
+		return 0;
+	}
+
+	if(listen_open(report) < 0) {
+		return -1;
+	}
+
+	while((ns = accept(listener, NULL, NULL)) < 0) {
+		if(errno != EINTR) {
+			report("Server: Accept");
+			return -1;
+		}
+	}
+
+	conn_resync(ns);
+	if(poll_mode) {
+		rx_fd = ns;
+		rx_pos = rx_len = 0;
+	}
+	else {
+		fp = fdopen(ns, "r");
+	}
+
+	return 0;
 }
 
-/* IPC socket connection */
-static void conn(void)
+/* Pin the calling receive thread to the --poll core */
+static void conn_pin(void)
 {
-        int ns, s, len;
-	socklen_t fromlen UNUSED;
+	cpu_set_t set;
+	char mode[64];
 
-	fromlen = 0;
+	/* The proxy reads gdb and QEMU in blocking mode */
+	if(!poll_mode || proxy_target) {
+		return;
+	}
+	if(poll_cpu < 0) {
+		stats_mode("poll");
+		return;
+	}
 
-        struct sockaddr_un saun, fsaun;
-        if((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
-                printf("Server: Socket\n");
-        }
+	CPU_ZERO(&set);
+	CPU_SET(poll_cpu, &set);
+	if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+		snprintf(mode, sizeof(mode), "poll, cpu %d not available", poll_cpu);
+	}
+	else {
+		snprintf(mode, sizeof(mode), "poll, cpu %d", poll_cpu);
+	}
+	stats_mode(mode);
+}
 
-        saun.sun_family = AF_UNIX;
-        strcpy(saun.sun_path, ADDRESS);
+static void conn_puts(const char *str)
+{
+	printf("%s\n", str);
+}
 
-        unlink(ADDRESS);
-        len = sizeof(saun.sun_family) + strlen(saun.sun_path);
+static void *tui_conn_thread(void *arg)
+{
+	FetcherPacket packet = {0};
+	uint64_t timestamp;
 
-	// XXX bind() need a const struct sockaddr pointer as argument...
-	const struct sockaddr *saun_const = (struct sockaddr *)&saun;
-        if(bind(s, saun_const, len) < 0) {
-                printf("Server: Bind\n");
-        }
+	conn_pin();
+	while(1) {
+		/* Connect to QEMU */
+		if(conn(console_puts) < 0) {
+			sleep(1);
+			continue;
+		}
+		display_status(1);
 
-        if(listen(s, 5) < 0) {
-                printf("Server: Listen\n");
-        }
+		/* Handle each packet received from QEMU */
+		while(conn_read(&packet, &timestamp)) {
+			stats_record(STATS_RECEIVE, timestamp);
+			record_packet(&packet, timestamp);
+			command_update(&packet, timestamp);
+			display_update(packet);
+			stats_record(STATS_DISPLAY, timestamp);
+		}
+		conn_close();
+		display_status(1);
+	}
 
-        if((ns = accept(s, (struct sockaddr *)&fsaun, &fromlen)) < 0) {
-                printf("Server: Accept\n");
-        }
+	return 0;
+}
 
-	fp = fdopen(ns, "r");
+static void *tui_prompt_thread(void *arg)
+{
+	console_prompt();
+
+	pthread_exit(0);
 }
 
 static void *conn_thread(void *arg)
 {
 	FetcherPacket packet = {0};
+	uint64_t timestamp;
 
+	conn_pin();
 	while(1) {
 		/* Connect to QEMU */
 		printf("Listen for QEMU... ");
 		fflush(stdout);
-		conn();
+		if(conn(conn_puts) < 0) {
+			sleep(1);
+			continue;
+		}
 		printf("connect success!\n");
 		printf("-> ");
 		fflush(stdout);
 
 		/* Handle each packet received from QEMU */
-		while(fread(&packet, sizeof(FetcherPacket), 1, fp)) {
+		while(conn_read(&packet, &timestamp)) {
+			stats_record(STATS_RECEIVE, timestamp);
+			record_packet(&packet, timestamp);
+			command_update(&packet, timestamp);
 			console_handle(packet);
+			stats_record(STATS_DISPLAY, timestamp);
 		}
+		conn_close();
 		printf("\nConnection closed!\n");
 	}
 
@@ -152,11 +521,172 @@ static void *prompt_thread(void *arg)
 	pthread_exit(0);
 }
 
+/* Batch mode, no prompt and nothing printed per packet */
+static volatile int batch_quit;
+
+static void batch_out(const char *str)
+{
+	/* Keep records on stdout parseable */
+	fputs(str, emit_stdout() ? stderr : stdout);
+}
+
+static void batch_stop(void)
+{
+	batch_quit = 1;
+}
+
+static const CMDFrontend batch_frontend = {
+	.out = batch_out,
+	/* Displays go out through emit, there is no screen to redraw */
+	.quit = batch_stop,
+};
+
+/* Run `script`, then feed every packet of QEMU or of the `replay` trace to
+ * the command engine. Return the command_results() bits.
+ */
+static int batch_main(const char *script, const char *out, const char *replay)
+{
+	FetcherPacket packet = {0};
+	TraceReader *tr = NULL;
+	uint64_t step, timestamp;
+	int status = 0;
+
+	if(replay && (tr = trace_reader_open(replay)) == NULL) {
+		fprintf(stderr, "Can not open trace \"%s\"\n", replay);
+		return COMMAND_ERROR;
+	}
+	if(out && record_start(out, TRACE_FORMAT_COLUMNAR) < 0) {
+		fprintf(stderr, "Can not record to \"%s\"\n", out);
+		if(tr) {
+			trace_reader_close(tr);
+		}
+		return COMMAND_ERROR;
+	}
+
+	command_init(&batch_frontend);
+	if(command_load(script) < 0) {
+		fprintf(stderr, "Can not open script \"%s\"\n", script);
+		status |= COMMAND_ERROR;
+		batch_quit = 1;
+	}
+
+	if(tr) {
+		/* Watches start from the first step, not the empty packet */
+		command_resync();
+		for(step = 0; !batch_quit && step < trace_steps(tr); step++) {
+			if(trace_read(tr, step, &packet, &timestamp) < 0) {
+				status |= COMMAND_ERROR;
+				break;
+			}
+			record_packet(&packet, timestamp);
+			command_update(&packet, timestamp);
+		}
+		trace_reader_close(tr);
+	}
+	else if(!batch_quit) {
+		/* One QEMU session */
+		conn_pin();
+		if(conn(conn_puts) < 0) {
+			status |= COMMAND_ERROR;
+			batch_quit = 1;
+		}
+		while(!batch_quit && conn_read(&packet, &timestamp)) {
+			stats_record(STATS_RECEIVE, timestamp);
+			record_packet(&packet, timestamp);
+			command_update(&packet, timestamp);
+		}
+		conn_close();
+	}
+
+	record_stop();
+	status |= command_results();
+	command_destroy();
+
+	return status;
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [-tui] [-sysregs] [-exceptions] [-proxy port host:port] [--poll [cpu]] [-symbols vmlinux] [-replay trace_file]\n"
+	       "       %s --batch script [--out trace_file] [-sysregs] [-exceptions] [-proxy port host:port] [--poll [cpu]] [-symbols vmlinux] [-replay trace_file]\n"
+	       "       %s query [-j threads] trace_file expr\n", prog, prog, prog);
+}
+
 int main(int argc, char *argv[])
 {
 	pthread_t c_thread, p_thread;
+	int tui = 0, i;
+	const char *replay = NULL, *batch = NULL, *out = NULL, *symbols = NULL;
+
+	/* Offline trace scan */
+	if(argc >= 2 && !strcmp("query", argv[1])) {
+		return query_main(argc - 2, argv + 2);
+	}
+
+	for(i = 1; i < argc; i++) {
+		if(!strcmp("-tui", argv[i])) {
+			tui = 1;
+		}
+		else if(!strcmp("-sysregs", argv[i])) {
+			subscription |= FETCHER_SUBSCRIBE_SYSREGS;
+		}
+		else if(!strcmp("-exceptions", argv[i])) {
+			subscription |= FETCHER_SUBSCRIBE_EXCEPTIONS;
+		}
+		else if(!strcmp("-proxy", argv[i]) && i + 2 < argc && atoi(argv[i + 1]) > 0) {
+			proxy_port = atoi(argv[++i]);
+			proxy_target = argv[++i];
+		}
+		else if(!strcmp("--poll", argv[i])) {
+			poll_mode = 1;
+			/* Optional core of the receive thread */
+			if(i + 1 < argc && argv[i + 1][0] && strspn(argv[i + 1], "0123456789") == strlen(argv[i + 1])) {
+				poll_cpu = atoi(argv[++i]);
+			}
+		}
+		else if(!strcmp("-replay", argv[i]) && i + 1 < argc) {
+			replay = argv[++i];
+		}
+		else if(!strcmp("--batch", argv[i]) && i + 1 < argc) {
+			batch = argv[++i];
+		}
+		else if(!strcmp("--out", argv[i]) && i + 1 < argc) {
+			out = argv[++i];
+		}
+		else if(!strcmp("-symbols", argv[i]) && i + 1 < argc) {
+			symbols = argv[++i];
+		}
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(out && !batch) {
+		usage(argv[0]);
+		return 1;
+	}
+	if(symbols && symbols_load(symbols) < 0) {
+		printf("Can not read symbols from \"%s\"\n", symbols);
+		return 1;
+	}
+	/* Source lines are optional, a stripped image has none */
+	if(symbols) {
+		lines_load(symbols);
+	}
+	/* Sections a display or watch needs are asked for while connected */
+	command_subscribe(conn_subscribe);
+	if(batch) {
+		return batch_main(batch, out, replay);
+	}
+
+	/* Replay a recorded trace instead of listening for QEMU */
+	if(replay && replay_open(replay) < 0) {
+		printf("Can not open trace \"%s\"\n", replay);
+		return 1;
+	}
 
-	if(argc == 2 && !strcmp("-tui", argv[1])) {
+	if(tui) {
 		/* UI initialize */
 		ui_init();
 
@@ -164,7 +694,12 @@ int main(int argc, char *argv[])
 		 * 1. connection with QMEU, and receive packet
 		 * 2. Interact with user.
 		 */
-		pthread_create(&c_thread, NULL, tui_conn_thread, NULL);
+		if(replay) {
+			display_replay();
+		}
+		else {
+			pthread_create(&c_thread, NULL, tui_conn_thread, NULL);
+		}
 		pthread_create(&p_thread, NULL, tui_prompt_thread, NULL);
 
 		/* Block until lost connection */
@@ -174,12 +709,21 @@ int main(int argc, char *argv[])
 		ui_destroy();
 	}
 	else {
-		pthread_create(&c_thread, NULL, conn_thread, NULL);
+		console_setup();
+		if(replay) {
+			console_replay();
+		}
+		else {
+			pthread_create(&c_thread, NULL, conn_thread, NULL);
+		}
 		pthread_create(&p_thread, NULL, prompt_thread, NULL);
 		/* Block until lost connection */
 		pthread_join(p_thread, NULL);
 	}
 
+	command_destroy();
+	replay_close();
+
 	return 0;
 }
 
@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <string.h>
+#include <endian.h>
+#include <pthread.h>
+
+#include "mmu.h"
+#include "guestmem.h"
+#include "fields.h"
+
+#define OA_MASK		0x0000ffffffffffffULL /* 48-bit output address */
+
+/* A TLB entry covers one granule page, block mappings are split into pages.
+ * Entries are tagged with the table base they were walked from and the
+ * ASID. The guest's TLB maintenance is never seen, a freed table page or
+ * ASID may be reused with other mappings, so a TTBR change flushes too.
+ */
+typedef struct MMUTLBEntry {
+	uint64_t vpage;
+	uint64_t ppage;
+	uint64_t baddr;
+	uint64_t desc;
+	uint32_t gen; /* valid while equal to tlb_gen */
+	uint16_t asid;
+	uint8_t region;
+	uint8_t global;
+	int8_t level;
+	uint8_t page_shift;
+} MMUTLBEntry;
+
+/* The prompt thread and the receive thread both translate */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* Regime the TLB entries were walked in */
+static MMUContext tlb_ctx;
+static MMUTLBEntry tlb[MMU_TLB_ENTRIES];
+static uint32_t tlb_gen = 1;
+static uint64_t nr_hits, nr_misses, nr_flushes;
+
+static void tlb_flush(void)
+{
+	/* Bump the generation instead of clearing every entry */
+	if(++tlb_gen == 0) {
+		memset(tlb, 0, sizeof(tlb));
+		tlb_gen = 1;
+	}
+	nr_flushes++;
+}
+
+void mmu_context(MMUContext *ctx, const FetcherPacket *packet)
+{
+	ctx->ttbr[0] = packet->TTBR0_EL1;
+	ctx->ttbr[1] = packet->TTBR1_EL1;
+	ctx->tcr = packet->TCR_EL1;
+	ctx->mair = packet->MAIR_EL1;
+	ctx->sctlr = packet->SCTLR_EL1;
+}
+
+/* Make the TLB hold the entries of `ctx`, caller holds the lock */
+static void tlb_switch(const MMUContext *ctx)
+{
+	if(ctx->tcr != tlb_ctx.tcr || ctx->sctlr != tlb_ctx.sctlr
+	   || ctx->ttbr[0] != tlb_ctx.ttbr[0] || ctx->ttbr[1] != tlb_ctx.ttbr[1]) {
+		tlb_flush();
+	}
+	tlb_ctx = *ctx;
+}
+
+void mmu_flush(void)
+{
+	pthread_mutex_lock(&lock);
+	tlb_flush();
+	pthread_mutex_unlock(&lock);
+}
+
+static int granule_shift(int region, int tg)
+{
+	if(region == 0) {
+		return tg == 1 ? 16 : tg == 2 ? 14 : 12;
+	}
+	return tg == 1 ? 14 : tg == 3 ? 16 : 12;
+}
+
+static uint16_t current_asid(const MMUContext *ctx)
+{
+	uint64_t ttbr = FIELD_GET(ctx->tcr, TCR_EL1, A1) ? ctx->ttbr[1] : ctx->ttbr[0];
+
+	/* TCR_EL1.AS selects 16-bit ASIDs */
+	return FIELD_GET(ttbr, TTBR0_EL1, ASID) & (FIELD_GET(ctx->tcr, TCR_EL1, AS) ? 0xffff : 0xff);
+}
+
+static uint8_t leaf_attr(const MMUContext *ctx, uint64_t desc)
+{
+	return ctx->mair >> (((desc >> 2) & 7) * 8);
+}
+
+/* Walk the tables of `ctx` */
+static int mmu_walk(const MMUContext *ctx, uint64_t va, MMUTranslation *t)
+{
+	int region, tbi, tsz, grain, stride, inputsize, level, start, shift, bits;
+	uint64_t baddr, desc, index, top;
+
+	/* Top byte ignore, VA[55] selects which TBIx applies */
+	tbi = (va >> 55) & 1 ? FIELD_GET(ctx->tcr, TCR_EL1, TBI1) : FIELD_GET(ctx->tcr, TCR_EL1, TBI0);
+	if(tbi) {
+		va = (uint64_t)((int64_t)(va << 8) >> 8);
+	}
+	region = va >> 63;
+
+	if(region == 0) {
+		tsz = FIELD_GET(ctx->tcr, TCR_EL1, T0SZ);
+		grain = granule_shift(0, FIELD_GET(ctx->tcr, TCR_EL1, TG0));
+		if(FIELD_GET(ctx->tcr, TCR_EL1, EPD0)) {
+			return MMU_FAULT_WALK_DISABLED;
+		}
+	}
+	else {
+		tsz = FIELD_GET(ctx->tcr, TCR_EL1, T1SZ);
+		grain = granule_shift(1, FIELD_GET(ctx->tcr, TCR_EL1, TG1));
+		if(FIELD_GET(ctx->tcr, TCR_EL1, EPD1)) {
+			return MMU_FAULT_WALK_DISABLED;
+		}
+	}
+	t->region = region;
+
+	/* ARMv8.0 limits, as QEMU does */
+	if(tsz < 16) {
+		tsz = 16;
+	}
+	else if(tsz > 39) {
+		tsz = 39;
+	}
+	inputsize = 64 - tsz;
+
+	/* VA[63:inputsize] must all match the region */
+	top = va >> inputsize;
+	if(top != (region ? (~0ULL >> inputsize) : 0)) {
+		t->level = 0;
+		return MMU_FAULT_TRANSLATION;
+	}
+
+	stride = grain - 3;
+	start = 4 - (inputsize - grain + stride - 1) / stride;
+	baddr = ctx->ttbr[region] & OA_MASK & ~1ULL;
+
+	for(level = start; ; level++) {
+		shift = grain + stride * (3 - level);
+		bits = level == start ? inputsize - shift : stride;
+		if(level == start) {
+			/* The start table is aligned to its own size */
+			baddr &= ~((8ULL << bits) - 1);
+		}
+		index = (va >> shift) & ((1ULL << bits) - 1);
+
+		t->level = level;
+		if(guest_mem_read(baddr + index * 8, &desc, sizeof(desc)) < 0) {
+			return MMU_FAULT_MEMORY;
+		}
+		desc = le64toh(desc);
+
+		if(!(desc & 1)) {
+			return MMU_FAULT_TRANSLATION;
+		}
+		if(level == 3) {
+			if(!(desc & 2)) {
+				return MMU_FAULT_TRANSLATION;
+			}
+			break;
+		}
+		if(!(desc & 2)) {
+			/* Block, level 1 only with the 4K granule */
+			if(level == 0 || (level == 1 && grain != 12)) {
+				return MMU_FAULT_TRANSLATION;
+			}
+			break;
+		}
+		baddr = desc & OA_MASK & ~((1ULL << grain) - 1);
+	}
+
+	t->desc = desc;
+	t->page_shift = shift;
+	t->pa = (desc & OA_MASK & ~((1ULL << shift) - 1)) | (va & ((1ULL << shift) - 1));
+	t->attr = leaf_attr(ctx, desc);
+
+	return MMU_OK;
+}
+
+int mmu_translate(const MMUContext *ctx, uint64_t va, MMUTranslation *t)
+{
+	MMUTLBEntry *e;
+	uint64_t vpage, baddr;
+	int region, grain, ret;
+
+	memset(t, 0, sizeof(*t));
+	t->va = va;
+
+	pthread_mutex_lock(&lock);
+	tlb_switch(ctx);
+	t->asid = current_asid(ctx);
+
+	/* SCTLR_EL1.M, flat mapping */
+	if(!FIELD_GET(ctx->sctlr, SCTLR_EL1, M)) {
+		t->pa = va;
+		t->level = -1;
+		t->page_shift = 12;
+		pthread_mutex_unlock(&lock);
+		return MMU_OK;
+	}
+
+	if((va >> 55) & 1 ? FIELD_GET(ctx->tcr, TCR_EL1, TBI1) : FIELD_GET(ctx->tcr, TCR_EL1, TBI0)) {
+		va = (uint64_t)((int64_t)(va << 8) >> 8);
+	}
+	region = va >> 63;
+	grain = region ? granule_shift(1, FIELD_GET(ctx->tcr, TCR_EL1, TG1))
+	               : granule_shift(0, FIELD_GET(ctx->tcr, TCR_EL1, TG0));
+	baddr = ctx->ttbr[region] & OA_MASK;
+	vpage = va >> grain;
+
+	e = &tlb[vpage & (MMU_TLB_ENTRIES - 1)];
+	if(e->gen == tlb_gen && e->vpage == vpage && e->region == region && e->baddr == baddr
+	   && (e->global || e->asid == t->asid)) {
+		nr_hits++;
+		t->pa = (e->ppage << grain) | (va & ((1ULL << grain) - 1));
+		t->desc = e->desc;
+		t->region = region;
+		t->level = e->level;
+		t->page_shift = e->page_shift;
+		t->attr = leaf_attr(ctx, e->desc);
+		t->tlb_hit = 1;
+		pthread_mutex_unlock(&lock);
+		return MMU_OK;
+	}
+
+	nr_misses++;
+	ret = mmu_walk(ctx, va, t);
+	if(ret == MMU_OK) {
+		e->vpage = vpage;
+		e->ppage = t->pa >> grain;
+		e->baddr = baddr;
+		e->desc = t->desc;
+		e->gen = tlb_gen;
+		e->asid = t->asid;
+		e->region = region;
+		e->global = !((t->desc >> 11) & 1); /* nG */
+		e->level = t->level;
+		e->page_shift = t->page_shift;
+	}
+	pthread_mutex_unlock(&lock);
+
+	return ret;
+}
+
+int mmu_read(const MMUContext *ctx, uint64_t va, void *buf, size_t len)
+{
+	MMUTranslation t;
+	size_t n;
+
+	while(len) {
+		if(mmu_translate(ctx, va, &t) != MMU_OK) {
+			return -1;
+		}
+		/* Stay within the smallest granule, the next page may map elsewhere */
+		n = 4096 - (va & 4095);
+		if(n > len) {
+			n = len;
+		}
+		if(guest_mem_read(t.pa, buf, n) < 0) {
+			return -1;
+		}
+		va += n;
+		buf = (uint8_t *)buf + n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+const char *mmu_fault_name(int fault)
+{
+	switch(fault) {
+	case MMU_OK:
+		return "no fault";
+	case MMU_FAULT_TRANSLATION:
+		return "translation fault";
+	case MMU_FAULT_WALK_DISABLED:
+		return "table walk disabled";
+	case MMU_FAULT_MEMORY:
+		return "page table not in shared memory";
+	}
+	return "unknown fault";
+}
+
+/* Decode a MAIR_EL1 attribute byte */
+void mmu_attr_name(uint8_t attr, char *buf, size_t len)
+{
+	static const char *device[] = {"nGnRnE", "nGnRE", "nGRE", "GRE"};
+	static const char *cache[] = {"WT", "WB"};
+
+	if((attr & 0xf0) == 0) {
+		snprintf(buf, len, "Device-%s", device[(attr >> 2) & 3]);
+	}
+	else if(attr == 0x44) {
+		snprintf(buf, len, "Normal NC");
+	}
+	else if((attr >> 4) == (attr & 0xf)) {
+		snprintf(buf, len, "Normal %s", cache[(attr >> 6) & 1]);
+	}
+	else {
+		snprintf(buf, len, "Normal outer 0x%x inner 0x%x", attr >> 4, attr & 0xf);
+	}
+}
+
+void mmu_describe(const MMUTranslation *t, char *buf, size_t len)
+{
+	static const char *ap[] = {"EL1 RW", "EL1/EL0 RW", "EL1 RO", "EL1/EL0 RO"};
+	char attr[32];
+	uint64_t size = 1ULL << t->page_shift;
+
+	if(t->level < 0) {
+		snprintf(buf, len, "0x%lx -> 0x%lx (MMU off)", t->va, t->pa);
+		return;
+	}
+
+	mmu_attr_name(t->attr, attr, sizeof(attr));
+	snprintf(buf, len, "0x%lx -> 0x%lx TTBR%d ASID %u, level %d %s %lu%s, %s, %s%s%s%s%s",
+	         t->va, t->pa, t->region, t->asid, t->level, t->level == 3 ? "page" : "block",
+	         size >= (1 << 30) ? size >> 30 : size >= (1 << 20) ? size >> 20 : size >> 10,
+	         size >= (1 << 30) ? "G" : size >= (1 << 20) ? "M" : "K",
+	         attr, ap[(t->desc >> 6) & 3],
+	         (t->desc >> 54) & 1 ? ", UXN" : "", (t->desc >> 53) & 1 ? ", PXN" : "",
+	         (t->desc >> 11) & 1 ? "" : ", global", t->tlb_hit ? " (TLB hit)" : "");
+}
+
+void mmu_stats(uint64_t *hits, uint64_t *misses, uint64_t *flushes)
+{
+	pthread_mutex_lock(&lock);
+	*hits = nr_hits;
+	*misses = nr_misses;
+	*flushes = nr_flushes;
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,698 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <endian.h>
+
+#include "proxy.h"
+#include "regs.h"
+#include "fpsimd.h"
+
+#define PROXY_BUF_SIZE		4096
+#define PROXY_MAX_REGS		2048
+#define PROXY_MAX_DEPTH		4
+/* qXfer chunk, below the packet size of every QEMU gdbstub */
+#define PROXY_XML_CHUNK		0xf00
+
+/* Register of the target description */
+typedef struct ProxyReg {
+	char name[32];
+	int regnum;
+	int bitsize;
+	int in_g; /* sent in the 'g' reply */
+	/* Where the value goes, size 0 if nowhere */
+	int fp; /* offset is in FetcherWireFPSIMD, else in FetcherPacket */
+	ptrdiff_t offset;
+	int size;
+} ProxyReg;
+
+/* AArch32 names QEMU gives registers shared by both states */
+static const char *aliases[][2] = {
+	{ "SCTLR", "SCTLR_EL1" },
+	{ "CPACR", "CPACR_EL1" },
+	{ "VBAR", "VBAR_EL1" },
+	{ "CSSELR", "CSSELR_EL1" },
+	{ "CCSIDR", "CCSIDR_EL1" },
+	{ "MPIDR", "MPIDR_EL1" },
+};
+
+static int listener = -1;
+static int gdb_fd = -1, qemu_fd = -1;
+
+static ProxyReg regs[PROXY_MAX_REGS];
+static int nr_regs, next_regnum;
+
+/* Bytes read from QEMU, consumed one at a time */
+static uint8_t in[PROXY_BUF_SIZE];
+static size_t in_pos, in_len;
+
+/* Packet from QEMU, '$' to the checksum */
+static char *pkt;
+static size_t pkt_len, pkt_size;
+static int pkt_state;
+
+static uint64_t proxy_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	ssize_t n;
+
+	while(len > 0) {
+		if((n = write(fd, p, len)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int hex_value(char c)
+{
+	if(c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if(c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	if(c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+
+	return -1;
+}
+
+/* Append "$data#checksum" to `buf`, return its length */
+static size_t packet_put(char *buf, const char *data)
+{
+	const char *p;
+	uint8_t sum = 0;
+
+	for(p = data; *p; p++) {
+		sum += *p;
+	}
+
+	return sprintf(buf, "$%s#%02x", data, sum);
+}
+
+/* Feed one byte from QEMU. Return 1 when it completes a packet, 0 if it is
+ * outside any packet (an ack), -1 inside one and -2 if out of memory.
+ */
+static int packet_feed(uint8_t ch)
+{
+	char *p;
+
+	switch(pkt_state) {
+	case 0:
+		if(ch != '$') {
+			return 0;
+		}
+		pkt_len = 0;
+		pkt_state = 1;
+		break;
+	case 1:
+		if(ch == '#') {
+			pkt_state = 2;
+		}
+		break;
+	case 2:
+		pkt_state = 3;
+		break;
+	default:
+		pkt_state = 0;
+	}
+
+	if(pkt_len == pkt_size) {
+		if((p = realloc(pkt, pkt_size * 2 + PROXY_BUF_SIZE)) == NULL) {
+			pkt_state = 0;
+			return -2;
+		}
+		pkt = p;
+		pkt_size = pkt_size * 2 + PROXY_BUF_SIZE;
+	}
+	pkt[pkt_len++] = ch;
+
+	return pkt_state == 0 ? 1 : -1;
+}
+
+/* Payload of the packet, NULL if its checksum is wrong */
+static const char *packet_data(size_t *len)
+{
+	uint8_t sum = 0;
+	size_t i;
+
+	for(i = 1; i + 3 < pkt_len; i++) {
+		sum += pkt[i];
+	}
+	if(hex_value(pkt[pkt_len - 2]) * 16 + hex_value(pkt[pkt_len - 1]) != sum) {
+		return NULL;
+	}
+	*len = pkt_len - 4;
+
+	return pkt + 1;
+}
+
+/* Next byte from QEMU, waits for it. -1 when closed */
+static int qemu_getc(void)
+{
+	ssize_t n;
+
+	if(in_pos == in_len) {
+		while((n = read(qemu_fd, in, sizeof(in))) < 0 && errno == EINTR);
+		if(n <= 0) {
+			return -1;
+		}
+		in_pos = 0;
+		in_len = n;
+	}
+
+	return in[in_pos++];
+}
+
+/* Wait for the next packet from QEMU and return its payload, acks are
+ * dropped. NULL on error or a bad checksum.
+ */
+static const char *qemu_packet(size_t *len)
+{
+	int ch, ret;
+
+	while((ch = qemu_getc()) >= 0) {
+		if((ret = packet_feed(ch)) == 1) {
+			return packet_data(len);
+		}
+		if(ret == -2) {
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/* Send one request and wait for its reply */
+static const char *qemu_request(const char *data, size_t *len)
+{
+	char buf[512];
+	size_t n = packet_put(buf, data);
+	const char *reply;
+
+	if(write_all(qemu_fd, buf, n) < 0 || (reply = qemu_packet(len)) == NULL) {
+		return NULL;
+	}
+	write_all(qemu_fd, "+", 1);
+
+	return reply;
+}
+
+/* Read annex `annex` of the target description, return a malloc()ed string */
+static char *xml_read(const char *annex)
+{
+	char req[256], *xml = NULL, *p;
+	const char *data;
+	size_t len = 0, size, i;
+
+	while(1) {
+		snprintf(req, sizeof(req), "qXfer:features:read:%s:%zx,%x", annex, len, PROXY_XML_CHUNK);
+		if((data = qemu_request(req, &size)) == NULL || size == 0 || (data[0] != 'm' && data[0] != 'l')) {
+			free(xml);
+			return NULL;
+		}
+		if((p = realloc(xml, len + size + 1)) == NULL) {
+			free(xml);
+			return NULL;
+		}
+		xml = p;
+		/* Binary data, '}' escapes the next byte */
+		for(i = 1; i < size; i++) {
+			xml[len++] = data[i] == '}' && i + 1 < size ? data[++i] ^ 0x20 : data[i];
+		}
+		if(data[0] == 'l') {
+			break;
+		}
+	}
+	xml[len] = '\0';
+
+	return xml;
+}
+
+/* Value of attribute `attr` in the tag from `tag` to `end` */
+static int xml_attr(const char *tag, const char *end, const char *attr, char *buf, size_t size)
+{
+	size_t len = strlen(attr), n;
+	const char *p, *q;
+
+	for(p = tag; p + len + 2 < end; p++) {
+		if(isspace((unsigned char)p[0]) && !strncmp(p + 1, attr, len) && p[len + 1] == '='
+		   && (p[len + 2] == '"' || p[len + 2] == '\'')) {
+			p += len + 3;
+			if((q = memchr(p, p[-1], end - p)) == NULL) {
+				return -1;
+			}
+			n = q - p < size - 1 ? q - p : size - 1;
+			memcpy(buf, p, n);
+			buf[n] = '\0';
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* Add the <reg> elements of `annex` and of the annexes it includes */
+static int xml_parse(const char *annex, int depth)
+{
+	char *xml, *p, *end;
+	char value[64];
+	ProxyReg *r;
+
+	if(depth > PROXY_MAX_DEPTH || (xml = xml_read(annex)) == NULL) {
+		return -1;
+	}
+
+	for(p = xml; (p = strchr(p, '<')) != NULL; p = end) {
+		if((end = strchr(p, '>')) == NULL) {
+			break;
+		}
+		if(!strncmp(p, "<xi:include", 11) && xml_attr(p, end, "href", value, sizeof(value)) == 0) {
+			if(xml_parse(value, depth + 1) < 0) {
+				free(xml);
+				return -1;
+			}
+		}
+		else if(!strncmp(p, "<reg", 4) && isspace((unsigned char)p[4]) && nr_regs < PROXY_MAX_REGS) {
+			r = &regs[nr_regs];
+			memset(r, 0, sizeof(ProxyReg));
+			if(xml_attr(p, end, "name", r->name, sizeof(r->name)) < 0
+			   || xml_attr(p, end, "bitsize", value, sizeof(value)) < 0) {
+				continue;
+			}
+			r->bitsize = atoi(value);
+			if(xml_attr(p, end, "regnum", value, sizeof(value)) == 0) {
+				next_regnum = atoi(value);
+			}
+			r->regnum = next_regnum++;
+			nr_regs++;
+		}
+	}
+	free(xml);
+
+	return 0;
+}
+
+static int reg_cmp(const void *a, const void *b)
+{
+	const ProxyReg *x = a, *y = b;
+
+	return x->regnum - y->regnum;
+}
+
+/* Where a register of the description goes in a packet */
+static void reg_target(ProxyReg *r)
+{
+	const char *name = r->name;
+	ARMCPRegInfo *ri;
+	int i, n, len;
+
+	for(i = 0; i < sizeof(aliases) / sizeof(aliases[0]); i++) {
+		if(!strcmp(name, aliases[i][0])) {
+			name = aliases[i][1];
+		}
+	}
+
+	if(!strcasecmp(name, "sp")) {
+		r->offset = offsetof(FetcherPacket, xregs[31]);
+		r->size = 8;
+	}
+	else if(!strcasecmp(name, "cpsr")) {
+		r->offset = offsetof(FetcherPacket, spsr);
+		r->size = 4;
+	}
+	else if(!strcasecmp(name, "fpsr") || !strcasecmp(name, "fpcr")) {
+		r->fp = 1;
+		r->offset = tolower((unsigned char)name[2]) == 's' ? offsetof(FetcherWireFPSIMD, fpsr)
+		                                                   : offsetof(FetcherWireFPSIMD, fpcr);
+		r->size = 4;
+	}
+	else if(name[0] == 'v' && sscanf(name + 1, "%d%n", &n, &len) == 1 && name[len + 1] == '\0'
+	        && n >= 0 && n < 32 && r->bitsize == 128) {
+		r->fp = 1;
+		r->offset = offsetof(FetcherWireFPSIMD, v) + n * sizeof(uint64_t[2]);
+		r->size = 16;
+	}
+	else if((ri = arm_cp_find(name)) != NULL && (ri->type == ARM_CP_NORMAL_L || ri->type == ARM_CP_NORMAL_H)) {
+		r->offset = ri->fieldoffset;
+		r->size = ri->type == ARM_CP_NORMAL_H ? 8 : 4;
+	}
+
+	/* A register shared by both states is described twice */
+	for(i = 0; r->size && &regs[i] != r; i++) {
+		if(regs[i].size && regs[i].fp == r->fp && regs[i].offset == r->offset) {
+			r->size = 0;
+		}
+	}
+}
+
+/* Copy the hex value of `r` to its place */
+static void reg_store(const ProxyReg *r, const char *hex, size_t len, FetcherPacket *packet, FetcherWireFPSIMD *fp)
+{
+	uint8_t bytes[16] = {0};
+	uint64_t v64;
+	uint32_t v32;
+	int i, hi, lo;
+
+	/* "E01" or "xx..." when QEMU can not read it */
+	if(r->size == 0 || len != r->bitsize / 4) {
+		return;
+	}
+	/* Target byte order, little-endian */
+	for(i = 0; i < r->size && i < len / 2; i++) {
+		if((hi = hex_value(hex[2 * i])) < 0 || (lo = hex_value(hex[2 * i + 1])) < 0) {
+			return;
+		}
+		bytes[i] = hi * 16 + lo;
+	}
+
+	if(r->fp) {
+		memcpy((uint8_t *)fp + r->offset, bytes, r->size);
+	}
+	else if(r->size == 8) {
+		memcpy(&v64, bytes, 8);
+		*(uint64_t *)((uint8_t *)packet + r->offset) = le64toh(v64);
+	}
+	else {
+		memcpy(&v32, bytes, 4);
+		*(uint32_t *)((uint8_t *)packet + r->offset) = le32toh(v32);
+	}
+}
+
+/* Spread a 'g' reply over the registers it covers, mark them if `mark` */
+static void g_store(const char *hex, size_t len, FetcherPacket *packet, FetcherWireFPSIMD *fp, int mark)
+{
+	size_t pos = 0, n;
+	int i;
+
+	for(i = 0; i < nr_regs && regs[i].regnum == i; i++) {
+		n = regs[i].bitsize / 4;
+		if(pos + n > len) {
+			break;
+		}
+		reg_store(&regs[i], hex + pos, n, packet, fp);
+		if(mark) {
+			regs[i].in_g = 1;
+		}
+		pos += n;
+	}
+}
+
+/* Read the registers of a stop in one batch: every request is written at
+ * once and the replies come back in order, so the whole read costs one
+ * round trip through the gdbstub.
+ */
+static int proxy_capture(FetcherPacket *packet, uint32_t subscription)
+{
+	static char *req, *acks;
+	static int *wanted;
+	FetcherWireFPSIMD fp;
+	const char *reply;
+	char cmd[16];
+	size_t len, size;
+	int i, n = 0, fp_regs = subscription & FETCHER_SUBSCRIBE_FPSIMD;
+
+	if(req == NULL) {
+		req = malloc(PROXY_MAX_REGS * 16 + 16);
+		acks = malloc(PROXY_MAX_REGS + 1);
+		wanted = malloc(PROXY_MAX_REGS * sizeof(int));
+		if(req == NULL || acks == NULL || wanted == NULL) {
+			free(req);
+			free(acks);
+			free(wanted);
+			req = acks = NULL;
+			wanted = NULL;
+			return -1;
+		}
+	}
+
+	len = packet_put(req, "g");
+	for(i = 0; i < nr_regs; i++) {
+		if(regs[i].size == 0 || regs[i].in_g || (regs[i].fp && !fp_regs)) {
+			continue;
+		}
+		snprintf(cmd, sizeof(cmd), "p%x", regs[i].regnum);
+		len += packet_put(req + len, cmd);
+		wanted[n++] = i;
+	}
+	if(write_all(qemu_fd, req, len) < 0) {
+		return -1;
+	}
+
+	memset(packet, 0, sizeof(FetcherPacket));
+	memset(&fp, 0, sizeof(fp));
+	for(i = -1; i < n; i++) {
+		if((reply = qemu_packet(&size)) == NULL) {
+			return -1;
+		}
+		if(i < 0) {
+			g_store(reply, size, packet, &fp, 0);
+		}
+		else {
+			reg_store(&regs[wanted[i]], reply, size, packet, &fp);
+		}
+	}
+	/* Acks for every reply, QEMU does not wait for them */
+	memset(acks, '+', n + 1);
+	write_all(qemu_fd, acks, n + 1);
+
+	fpsimd_update(fp_regs ? &fp : NULL);
+
+	return 0;
+}
+
+static int proxy_listen(int port, void (*report)(const char *))
+{
+	struct sockaddr_in addr;
+	int s, on = 1;
+
+	if(listener >= 0) {
+		return 0;
+	}
+
+	if((s = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		report("Proxy: Socket");
+		return -1;
+	}
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if(bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		report("Proxy: Bind");
+		close(s);
+		return -1;
+	}
+
+	if(listen(s, 1) < 0) {
+		report("Proxy: Listen");
+		close(s);
+		return -1;
+	}
+	listener = s;
+
+	return 0;
+}
+
+static int proxy_connect(const char *target)
+{
+	struct addrinfo hints, *res, *ai;
+	char host[256];
+	const char *port;
+	int s = -1;
+
+	if((port = strrchr(target, ':')) == NULL || port - target >= sizeof(host)) {
+		return -1;
+	}
+	/* ":1234" is the local host */
+	snprintf(host, sizeof(host), "%.*s", (int)(port - target), target);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if(getaddrinfo(host[0] ? host : NULL, port + 1, &hints, &res) != 0) {
+		return -1;
+	}
+	for(ai = res; ai != NULL; ai = ai->ai_next) {
+		if((s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) {
+			continue;
+		}
+		if(connect(s, ai->ai_addr, ai->ai_addrlen) == 0) {
+			break;
+		}
+		close(s);
+		s = -1;
+	}
+	freeaddrinfo(res);
+
+	return s;
+}
+
+int proxy_open(int port, const char *target, void (*report)(const char *))
+{
+	FetcherPacket packet;
+	FetcherWireFPSIMD fp;
+	const char *reply;
+	size_t size;
+	int i, on = 1;
+
+	if(proxy_listen(port, report) < 0) {
+		return -1;
+	}
+	while((gdb_fd = accept(listener, NULL, NULL)) < 0) {
+		if(errno != EINTR) {
+			report("Proxy: Accept");
+			return -1;
+		}
+	}
+	if((qemu_fd = proxy_connect(target)) < 0) {
+		report("Proxy: can not connect to the gdbstub");
+		proxy_close();
+		return -1;
+	}
+	/* Requests and stop replies are small, send them right away */
+	setsockopt(gdb_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	setsockopt(qemu_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	in_pos = in_len = 0;
+	pkt_state = 0;
+
+	/* The description of this QEMU, gdb is held until it is read */
+	nr_regs = next_regnum = 0;
+	if(xml_parse("target.xml", 0) < 0 || nr_regs == 0) {
+		report("Proxy: can not read the target description");
+		proxy_close();
+		return -1;
+	}
+	qsort(regs, nr_regs, sizeof(ProxyReg), reg_cmp);
+	for(i = 0; i < nr_regs; i++) {
+		reg_target(&regs[i]);
+	}
+	/* QEMU stopped the guest for the new connection, see what 'g' holds */
+	if((reply = qemu_request("g", &size)) == NULL) {
+		report("Proxy: can not read the registers");
+		proxy_close();
+		return -1;
+	}
+	g_store(reply, size, &packet, &fp, 1);
+
+	return 0;
+}
+
+int proxy_read(FetcherPacket *packet, uint64_t *timestamp, uint32_t subscription)
+{
+	struct pollfd pfd[2] = {
+		{ .fd = gdb_fd, .events = POLLIN },
+		{ .fd = qemu_fd, .events = POLLIN },
+	};
+	uint8_t buf[PROXY_BUF_SIZE];
+	char *stop;
+	size_t len;
+	ssize_t n;
+	int ret;
+
+	while(1) {
+		/* Bytes left over from the last stop go first */
+		if(in_pos == in_len) {
+			if(poll(pfd, 2, -1) < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+				return 0;
+			}
+			if(pfd[0].revents) {
+				if((n = read(gdb_fd, buf, sizeof(buf))) <= 0 || write_all(qemu_fd, buf, n) < 0) {
+					return 0;
+				}
+			}
+			if(!pfd[1].revents) {
+				continue;
+			}
+			if((n = read(qemu_fd, in, sizeof(in))) <= 0) {
+				return 0;
+			}
+			in_pos = 0;
+			in_len = n;
+		}
+
+		while(in_pos < in_len) {
+			if((ret = packet_feed(in[in_pos++])) == 0) {
+				if(write_all(gdb_fd, &in[in_pos - 1], 1) < 0) {
+					return 0;
+				}
+				continue;
+			}
+			if(ret == -2) {
+				return 0;
+			}
+			if(ret < 0) {
+				continue;
+			}
+
+			/* Stop replies are "S AA" and "T AA ...", nothing else QEMU
+			 * sends starts that way
+			 */
+			if(pkt_len < 7 || (pkt[1] != 'S' && pkt[1] != 'T') || hex_value(pkt[2]) < 0
+			   || hex_value(pkt[3]) < 0) {
+				if(write_all(gdb_fd, pkt, pkt_len) < 0) {
+					return 0;
+				}
+				continue;
+			}
+
+			/* gdb waits for the stop while the registers are read */
+			*timestamp = proxy_clock();
+			len = pkt_len;
+			if((stop = malloc(len)) == NULL) {
+				return 0;
+			}
+			memcpy(stop, pkt, len);
+			ret = proxy_capture(packet, subscription) == 0 && write_all(gdb_fd, stop, len) == 0;
+			free(stop);
+
+			return ret;
+		}
+	}
+}
+
+void proxy_close(void)
+{
+	if(gdb_fd >= 0) {
+		close(gdb_fd);
+		gdb_fd = -1;
+	}
+	if(qemu_fd >= 0) {
+		close(qemu_fd);
+		qemu_fd = -1;
+	}
+	in_pos = in_len = 0;
+	pkt_state = 0;
+	fpsimd_update(NULL);
+}
@@ -0,0 +1,521 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "query.h"
+#include "regs.h"
+
+#define QUERY_OP_EQ	0
+#define QUERY_OP_NE	1
+#define QUERY_OP_LT	2
+#define QUERY_OP_LE	3
+#define QUERY_OP_GT	4
+#define QUERY_OP_GE	5
+
+#define QUERY_MAX_THREADS	64
+
+typedef struct QueryTerm {
+	int col; /* trace column, -1 for a constant register */
+	int slot; /* index of the decoded column buffer */
+	uint64_t mask;
+	int shift;
+	int whole; /* the whole register, the chunk min/max bound it */
+	int op;
+	uint64_t value;
+	int result; /* precomputed result of a constant register */
+} QueryTerm;
+
+struct Query {
+	QueryTerm *terms;
+	int nr_terms;
+	/* Number of terms in each AND group, groups are OR-ed */
+	int *groups;
+	int nr_groups;
+	/* Distinct columns referenced by terms */
+	int cols[TRACE_NR_COLUMNS];
+	int nr_cols;
+};
+
+static int query_compare(int op, uint64_t a, uint64_t b)
+{
+	switch(op) {
+	case QUERY_OP_EQ:
+		return a == b;
+	case QUERY_OP_NE:
+		return a != b;
+	case QUERY_OP_LT:
+		return a < b;
+	case QUERY_OP_LE:
+		return a <= b;
+	case QUERY_OP_GT:
+		return a > b;
+	case QUERY_OP_GE:
+		return a >= b;
+	}
+	return 0;
+}
+
+static const char *skip_space(const char *p)
+{
+	while(isspace((unsigned char)*p)) {
+		p++;
+	}
+	return p;
+}
+
+/* Parse "$reg[end_bit:start_bit] op number" or "$reg.FIELD op number" */
+static const char *query_parse_term(Query *q, const char *p, char *err, size_t errlen)
+{
+	QueryTerm *t;
+	ARMCPOperand op;
+	char *end;
+	int len, i;
+
+	p = skip_space(p);
+	if(*p != '$') {
+		snprintf(err, errlen, "Expect register at \"%s\"", p);
+		return NULL;
+	}
+	if((len = arm_cp_parse(p, &op)) < 0 || op.all || op.reg->type == ARM_CP_UNIMPL
+	   || op.reg->type == ARM_CP_RAW_L || op.reg->type == ARM_CP_RAW_H
+	   || op.reg->type == ARM_CP_EXC_L || op.reg->type == ARM_CP_EXC_H
+	   || op.reg->type == ARM_CP_FP_L || op.reg->type == ARM_CP_FP_H) {
+		snprintf(err, errlen, "Invalid register or field at \"%s\"", p);
+		return NULL;
+	}
+	p += len;
+
+	q->terms = realloc(q->terms, sizeof(QueryTerm) * (q->nr_terms + 1));
+	t = &q->terms[q->nr_terms++];
+	t->mask = op.mask;
+	t->shift = op.shift;
+	t->whole = op.shift == 0 && op.mask == (op.reg->type == ARM_CP_NORMAL_L ? 0xFFFFFFFFULL : 0xFFFFFFFFFFFFFFFFULL);
+	t->col = op.reg->type == ARM_CP_CONST ? -1 : trace_column(op.reg->fieldoffset);
+	t->slot = -1;
+
+	p = skip_space(p);
+	if(!strncmp(p, "==", 2)) {
+		t->op = QUERY_OP_EQ;
+		p += 2;
+	}
+	else if(!strncmp(p, "!=", 2)) {
+		t->op = QUERY_OP_NE;
+		p += 2;
+	}
+	else if(!strncmp(p, "<=", 2)) {
+		t->op = QUERY_OP_LE;
+		p += 2;
+	}
+	else if(!strncmp(p, ">=", 2)) {
+		t->op = QUERY_OP_GE;
+		p += 2;
+	}
+	else if(*p == '<') {
+		t->op = QUERY_OP_LT;
+		p++;
+	}
+	else if(*p == '>') {
+		t->op = QUERY_OP_GT;
+		p++;
+	}
+	else {
+		snprintf(err, errlen, "Expect comparison at \"%s\"", p);
+		return NULL;
+	}
+
+	p = skip_space(p);
+	t->value = strtoull(p, &end, 0);
+	if(end == p) {
+		snprintf(err, errlen, "Expect number at \"%s\"", p);
+		return NULL;
+	}
+
+	if(t->col < 0) {
+		t->result = query_compare(t->op, (op.reg->const_value & t->mask) >> t->shift, t->value);
+		return end;
+	}
+
+	/* Assign a decode slot per distinct column */
+	for(i = 0; i < q->nr_cols; i++) {
+		if(q->cols[i] == t->col) {
+			break;
+		}
+	}
+	if(i == q->nr_cols) {
+		q->cols[q->nr_cols++] = t->col;
+	}
+	t->slot = i;
+
+	return end;
+}
+
+Query *query_compile(const char *expr, char *err, size_t errlen)
+{
+	Query *q = calloc(1, sizeof(Query));
+	const char *p = expr;
+
+	q->groups = calloc(1, sizeof(int));
+	q->nr_groups = 1;
+
+	while(1) {
+		if((p = query_parse_term(q, p, err, errlen)) == NULL) {
+			query_free(q);
+			return NULL;
+		}
+		q->groups[q->nr_groups - 1]++;
+
+		p = skip_space(p);
+		if(*p == '\0') {
+			break;
+		}
+		if(!strncmp(p, "&&", 2)) {
+			p += 2;
+		}
+		else if(!strncmp(p, "||", 2)) {
+			q->groups = realloc(q->groups, sizeof(int) * (q->nr_groups + 1));
+			q->groups[q->nr_groups++] = 0;
+			p += 2;
+		}
+		else {
+			snprintf(err, errlen, "Expect && or || at \"%s\"", p);
+			query_free(q);
+			return NULL;
+		}
+	}
+
+	return q;
+}
+
+/* Evaluate one packet, for assertions on a live stream */
+int query_match(const Query *q, const FetcherPacket *packet)
+{
+	const QueryTerm *t = q->terms;
+	int g, i, match;
+
+	for(g = 0; g < q->nr_groups; g++) {
+		match = 1;
+		for(i = 0; i < q->groups[g]; i++, t++) {
+			if(match) {
+				match = t->col < 0 ? t->result
+				        : query_compare(t->op, (trace_packet_get(packet, t->col) & t->mask) >> t->shift, t->value);
+			}
+		}
+		if(match) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void query_free(Query *q)
+{
+	free(q->terms);
+	free(q->groups);
+	free(q);
+}
+
+/* Evaluation kernels
+ * acc[i] &= (((col[i] & mask) >> shift) op value) ? ~0 : 0, four lanes at a time.
+ */
+typedef uint64_t u64x4 __attribute__((vector_size(32)));
+
+#define QUERY_KERNEL(name, cmp) \
+static void name(const uint64_t *col, uint64_t mask, int shift, uint64_t value, \
+                 uint64_t *acc, uint32_t n) \
+{ \
+	const u64x4 vmask = {mask, mask, mask, mask}; \
+	const u64x4 vvalue = {value, value, value, value}; \
+	uint32_t i; \
+\
+	for(i = 0; i + 4 <= n; i += 4) { \
+		u64x4 v, a; \
+\
+		memcpy(&v, col + i, sizeof(v)); \
+		memcpy(&a, acc + i, sizeof(a)); \
+		v = (v & vmask) >> shift; \
+		a &= (u64x4)(v cmp vvalue); \
+		memcpy(acc + i, &a, sizeof(a)); \
+	} \
+	for(; i < n; i++) { \
+		acc[i] &= -(uint64_t)(((col[i] & mask) >> shift) cmp value); \
+	} \
+}
+
+QUERY_KERNEL(query_eq, ==)
+QUERY_KERNEL(query_ne, !=)
+QUERY_KERNEL(query_lt, <)
+QUERY_KERNEL(query_le, <=)
+QUERY_KERNEL(query_gt, >)
+QUERY_KERNEL(query_ge, >=)
+
+static void (*const query_kernel[])(const uint64_t *, uint64_t, int, uint64_t, uint64_t *, uint32_t) = {
+	[QUERY_OP_EQ] = query_eq,
+	[QUERY_OP_NE] = query_ne,
+	[QUERY_OP_LT] = query_lt,
+	[QUERY_OP_LE] = query_le,
+	[QUERY_OP_GT] = query_gt,
+	[QUERY_OP_GE] = query_ge,
+};
+
+/* Return 1 if the chunk min/max proves the term is false for every step */
+static int query_term_excluded(const QueryTerm *t, uint64_t min, uint64_t max)
+{
+	/* Ranges only bound whole register values */
+	if(!t->whole) {
+		return 0;
+	}
+
+	switch(t->op) {
+	case QUERY_OP_EQ:
+		return t->value < min || t->value > max;
+	case QUERY_OP_NE:
+		return min == max && min == t->value;
+	case QUERY_OP_LT:
+		return min >= t->value;
+	case QUERY_OP_LE:
+		return min > t->value;
+	case QUERY_OP_GT:
+		return max <= t->value;
+	case QUERY_OP_GE:
+		return max < t->value;
+	}
+	return 0;
+}
+
+typedef struct QueryJob {
+	const Query *q;
+	const TraceReader *tr;
+	uint32_t next; /* next chunk to scan, shared by workers */
+	uint64_t **steps; /* matching steps per chunk */
+	uint32_t *counts;
+	int error; /* a column did not decode or memory ran out */
+} QueryJob;
+
+static void *query_worker(void *arg)
+{
+	QueryJob *job = arg;
+	const Query *q = job->q;
+	uint64_t *cols = malloc(sizeof(uint64_t) * TRACE_CHUNK_STEPS * (q->nr_cols ? q->nr_cols : 1));
+	uint64_t *acc = malloc(sizeof(uint64_t) * TRACE_CHUNK_STEPS);
+	uint64_t *res = malloc(sizeof(uint64_t) * TRACE_CHUNK_STEPS);
+	int decoded[TRACE_NR_COLUMNS];
+	uint32_t chunk;
+
+	if(cols == NULL || acc == NULL || res == NULL) {
+		__atomic_store_n(&job->error, 1, __ATOMIC_RELAXED);
+	}
+
+	while(!__atomic_load_n(&job->error, __ATOMIC_RELAXED)
+	      && (chunk = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < trace_nr_chunks(job->tr)) {
+		uint64_t first_step;
+		uint32_t steps, i, count = 0;
+		int g, t, base, any = 0;
+
+		trace_chunk_info(job->tr, chunk, &first_step, &steps);
+		memset(decoded, 0, sizeof(int) * q->nr_cols);
+		memset(res, 0, sizeof(uint64_t) * steps);
+
+		for(g = 0, base = 0; g < q->nr_groups; base += q->groups[g++]) {
+			int excluded = 0;
+
+			/* Skip the group if any term can not hold in this chunk */
+			for(t = base; t < base + q->groups[g] && !excluded; t++) {
+				const QueryTerm *term = &q->terms[t];
+				uint64_t min, max;
+
+				if(term->col < 0) {
+					excluded = !term->result;
+				}
+				else if(!trace_chunk_range(job->tr, chunk, term->col, &min, &max)) {
+					excluded = query_term_excluded(term, min, max);
+				}
+			}
+			if(excluded) {
+				continue;
+			}
+
+			memset(acc, 0xff, sizeof(uint64_t) * steps);
+			for(t = base; t < base + q->groups[g]; t++) {
+				const QueryTerm *term = &q->terms[t];
+				uint64_t *col;
+
+				if(term->col < 0) {
+					continue;
+				}
+				col = cols + (size_t)term->slot * TRACE_CHUNK_STEPS;
+				/* A corrupt column fails the query, no match is made up */
+				if(!decoded[term->slot]) {
+					if(trace_chunk_column(job->tr, chunk, term->col, col) < 0) {
+						__atomic_store_n(&job->error, 1, __ATOMIC_RELAXED);
+						break;
+					}
+					decoded[term->slot] = 1;
+				}
+				query_kernel[term->op](col, term->mask, term->shift, term->value, acc, steps);
+			}
+			for(i = 0; i < steps; i++) {
+				res[i] |= acc[i];
+			}
+			any = 1;
+		}
+
+		if(!any || __atomic_load_n(&job->error, __ATOMIC_RELAXED)) {
+			continue;
+		}
+
+		for(i = 0; i < steps; i++) {
+			count += res[i] & 1;
+		}
+		job->counts[chunk] = count;
+		if(count) {
+			uint64_t *out = malloc(sizeof(uint64_t) * count);
+
+			if(out == NULL) {
+				__atomic_store_n(&job->error, 1, __ATOMIC_RELAXED);
+				continue;
+			}
+			for(i = 0, count = 0; i < steps; i++) {
+				if(res[i]) {
+					out[count++] = first_step + i;
+				}
+			}
+			job->steps[chunk] = out;
+		}
+	}
+
+	free(cols);
+	free(acc);
+	free(res);
+
+	return NULL;
+}
+
+uint64_t *query_run(const Query *q, const TraceReader *tr, int threads, uint64_t *count)
+{
+	pthread_t tid[QUERY_MAX_THREADS];
+	QueryJob job = {.q = q, .tr = tr};
+	uint32_t nr_chunks = trace_nr_chunks(tr), c;
+	uint64_t *steps = NULL, total = 0;
+	int i, started;
+
+	if(threads <= 0) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if(threads > QUERY_MAX_THREADS) {
+		threads = QUERY_MAX_THREADS;
+	}
+	if(threads > nr_chunks) {
+		threads = nr_chunks ? nr_chunks : 1;
+	}
+
+	job.steps = calloc(nr_chunks + 1, sizeof(uint64_t *));
+	job.counts = calloc(nr_chunks + 1, sizeof(uint32_t));
+	if(job.steps == NULL || job.counts == NULL) {
+		free(job.steps);
+		free(job.counts);
+		return NULL;
+	}
+
+	/* Workers take chunks as they go, fewer threads only scan slower */
+	for(started = 1; started < threads; started++) {
+		if(pthread_create(&tid[started], NULL, query_worker, &job)) {
+			break;
+		}
+	}
+	query_worker(&job);
+	for(i = 1; i < started; i++) {
+		pthread_join(tid[i], NULL);
+	}
+
+	/* Merge in chunk order, steps come out sorted */
+	for(c = 0; c < nr_chunks; c++) {
+		total += job.counts[c];
+	}
+	if(!job.error) {
+		steps = malloc(sizeof(uint64_t) * (total ? total : 1));
+	}
+	for(c = 0, total = 0; c < nr_chunks; c++) {
+		if(steps && job.steps[c]) {
+			memcpy(steps + total, job.steps[c], sizeof(uint64_t) * job.counts[c]);
+			total += job.counts[c];
+		}
+		free(job.steps[c]);
+	}
+	free(job.steps);
+	free(job.counts);
+
+	*count = total;
+	return steps;
+}
+
+int query_main(int argc, char *argv[])
+{
+	TraceReader *tr;
+	Query *q;
+	char err[128];
+	char *expr;
+	uint64_t *steps, count, i;
+	size_t len = 1;
+	int threads = 0, arg = 0;
+	struct timespec t0, t1;
+
+	if(argc >= 2 && !strcmp(argv[0], "-j")) {
+		threads = atoi(argv[1]);
+		arg = 2;
+	}
+	if(argc - arg < 2) {
+		fprintf(stderr, "Usage: qemu-monitor query [-j threads] trace_file expr\n");
+		return 1;
+	}
+
+	if((tr = trace_reader_open(argv[arg])) == NULL) {
+		fprintf(stderr, "Can not open trace \"%s\"\n", argv[arg]);
+		return 1;
+	}
+
+	/* The expression may be split over several arguments */
+	for(i = arg + 1; i < argc; i++) {
+		len += strlen(argv[i]) + 1;
+	}
+	expr = calloc(1, len);
+	for(i = arg + 1; i < argc; i++) {
+		strcat(expr, argv[i]);
+		strcat(expr, " ");
+	}
+
+	if((q = query_compile(expr, err, sizeof(err))) == NULL) {
+		fprintf(stderr, "%s\n", err);
+		free(expr);
+		trace_reader_close(tr);
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	steps = query_run(q, tr, threads, &count);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if(steps == NULL) {
+		fprintf(stderr, "Can not scan trace \"%s\"\n", argv[arg]);
+		query_free(q);
+		free(expr);
+		trace_reader_close(tr);
+		return 1;
+	}
+
+	for(i = 0; i < count; i++) {
+		printf("%lu\n", steps[i]);
+	}
+	fprintf(stderr, "%lu matches in %lu steps, %.3f ms\n", count, trace_steps(tr),
+	        (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+
+	free(steps);
+	query_free(q);
+	free(expr);
+	trace_reader_close(tr);
+
+	return 0;
+}
@@ -1,4 +1,17 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
 #include "types.h"
+#include "regs.h"
+#include "sysregs.h"
+#include "exception.h"
+#include "fpsimd.h"
+#include "symbols.h"
+#include "lines.h"
+#include "format.h"
 
 /* AArch64 identification registers */
 ARMCPRegInfo v8_id[] = {
@@ -63,7 +76,14 @@ ARMCPRegInfo v8_eh[] = {
 	{ .name = "VBAR_EL1", .type = ARM_CP_NORMAL_H, .fieldoffset = offsetof(FetcherPacket, VBAR_EL1)},
 	{ .name = "ISR_EL1", .type = ARM_CP_NORMAL_L, .fieldoffset = offsetof(FetcherPacket, ISR_EL1)},
 	{ .name = "VBAR_EL2", .type = ARM_CP_NORMAL_H, .fieldoffset = offsetof(FetcherPacket, VBAR_EL2)},
-	{ .name = "VBAR_EL3", .type = ARM_CP_NORMAL_H, .fieldoffset = offsetof(FetcherPacket, VBAR_EL3)}
+	{ .name = "VBAR_EL3", .type = ARM_CP_NORMAL_H, .fieldoffset = offsetof(FetcherPacket, VBAR_EL3)},
+	{ .name = "ELR_EL1"},
+	{ .name = "ELR_EL2"},
+	{ .name = "ELR_EL3"},
+	{ .name = "SPSR_EL1"},
+	{ .name = "SP_EL0"},
+	{ .name = "SP_EL1"},
+	{ .name = "SP_EL2"}
 };
 
 /* AArch64 virtual memory control registers  */
@@ -299,7 +319,92 @@ ARMCPRegInfo gpr[] = {
 	{ .name = "spsr", .type = ARM_CP_NORMAL_L, .fieldoffset = offsetof(FetcherPacket, spsr)}
 };
 
-ARMCPRegArray reg_array[14] = {
+/* Exception record of the capture, not architectural registers */
+ARMCPRegInfo exc_capture[] = {
+	{ .name = "EXC_KIND", .type = ARM_CP_EXC_L, .fieldoffset = offsetof(ExceptionRecord, kind)},
+	{ .name = "EXC_EL", .type = ARM_CP_EXC_L, .fieldoffset = offsetof(ExceptionRecord, el)},
+	{ .name = "EXC_VECTOR", .type = ARM_CP_EXC_L, .fieldoffset = offsetof(ExceptionRecord, vector)},
+	{ .name = "EXC_ESR", .type = ARM_CP_EXC_H, .fieldoffset = offsetof(ExceptionRecord, esr)},
+	{ .name = "EXC_FAR", .type = ARM_CP_EXC_H, .fieldoffset = offsetof(ExceptionRecord, far)},
+	{ .name = "EXC_ELR", .type = ARM_CP_EXC_H, .fieldoffset = offsetof(ExceptionRecord, elr)},
+	{ .name = "EXC_DROPPED", .type = ARM_CP_EXC_L, .fieldoffset = offsetof(ExceptionRecord, dropped)}
+};
+
+/* AArch64 SIMD and floating-point registers, Dn is bits [63:0] of Vn */
+ARMCPRegInfo v8_fp[] = {
+	{ .name = "d0", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[0][0])},
+	{ .name = "d1", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[1][0])},
+	{ .name = "d2", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[2][0])},
+	{ .name = "d3", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[3][0])},
+	{ .name = "d4", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[4][0])},
+	{ .name = "d5", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[5][0])},
+	{ .name = "d6", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[6][0])},
+	{ .name = "d7", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[7][0])},
+	{ .name = "d8", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[8][0])},
+	{ .name = "d9", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[9][0])},
+	{ .name = "d10", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[10][0])},
+	{ .name = "d11", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[11][0])},
+	{ .name = "d12", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[12][0])},
+	{ .name = "d13", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[13][0])},
+	{ .name = "d14", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[14][0])},
+	{ .name = "d15", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[15][0])},
+	{ .name = "d16", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[16][0])},
+	{ .name = "d17", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[17][0])},
+	{ .name = "d18", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[18][0])},
+	{ .name = "d19", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[19][0])},
+	{ .name = "d20", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[20][0])},
+	{ .name = "d21", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[21][0])},
+	{ .name = "d22", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[22][0])},
+	{ .name = "d23", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[23][0])},
+	{ .name = "d24", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[24][0])},
+	{ .name = "d25", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[25][0])},
+	{ .name = "d26", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[26][0])},
+	{ .name = "d27", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[27][0])},
+	{ .name = "d28", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[28][0])},
+	{ .name = "d29", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[29][0])},
+	{ .name = "d30", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[30][0])},
+	{ .name = "d31", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[31][0])},
+	{ .name = "FPSR", .type = ARM_CP_FP_L, .fieldoffset = offsetof(FPSIMDState, fpsr)},
+	{ .name = "FPCR", .type = ARM_CP_FP_L, .fieldoffset = offsetof(FPSIMDState, fpcr)}
+};
+
+/* Bits [127:64] of Vn, only reached through a lane */
+static ARMCPRegInfo v8_fp_high[] = {
+	{ .name = "v0.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[0][1])},
+	{ .name = "v1.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[1][1])},
+	{ .name = "v2.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[2][1])},
+	{ .name = "v3.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[3][1])},
+	{ .name = "v4.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[4][1])},
+	{ .name = "v5.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[5][1])},
+	{ .name = "v6.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[6][1])},
+	{ .name = "v7.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[7][1])},
+	{ .name = "v8.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[8][1])},
+	{ .name = "v9.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[9][1])},
+	{ .name = "v10.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[10][1])},
+	{ .name = "v11.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[11][1])},
+	{ .name = "v12.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[12][1])},
+	{ .name = "v13.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[13][1])},
+	{ .name = "v14.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[14][1])},
+	{ .name = "v15.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[15][1])},
+	{ .name = "v16.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[16][1])},
+	{ .name = "v17.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[17][1])},
+	{ .name = "v18.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[18][1])},
+	{ .name = "v19.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[19][1])},
+	{ .name = "v20.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[20][1])},
+	{ .name = "v21.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[21][1])},
+	{ .name = "v22.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[22][1])},
+	{ .name = "v23.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[23][1])},
+	{ .name = "v24.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[24][1])},
+	{ .name = "v25.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[25][1])},
+	{ .name = "v26.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[26][1])},
+	{ .name = "v27.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[27][1])},
+	{ .name = "v28.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[28][1])},
+	{ .name = "v29.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[29][1])},
+	{ .name = "v30.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[30][1])},
+	{ .name = "v31.d[1]", .type = ARM_CP_FP_H, .fieldoffset = offsetof(FPSIMDState, v[31][1])}
+};
+
+ARMCPRegArray reg_array[16] = {
 	{ .name = "General Purpose Registers", .array = gpr, .size = sizeof(gpr) / sizeof(ARMCPRegInfo)},
 	{ .name = "AArch64 identification registers", .array = v8_id, .size = sizeof(v8_id) / sizeof(ARMCPRegInfo)},
 	{ .name = "AArch64 exception handling registers", .array = v8_eh, .size = sizeof(v8_eh) / sizeof(ARMCPRegInfo)},
@@ -313,6 +418,223 @@ ARMCPRegArray reg_array[14] = {
 	{ .name = "AArch64 Generic Timer registers", .array = v8_gt, .size = sizeof(v8_gt) / sizeof(ARMCPRegInfo)},
 	{ .name = "AArch64 thread registers", .array = v8_th, .size = sizeof(v8_th) / sizeof(ARMCPRegInfo)},
 	{ .name = "AArch64 implementation definedregisters", .array = v8_imd, .size = sizeof(v8_imd) / sizeof(ARMCPRegInfo)},
-	{ .name = "AArch64 address registers", .array = v8_ad, .size = sizeof(v8_ad) / sizeof(ARMCPRegInfo)}
+	{ .name = "AArch64 address registers", .array = v8_ad, .size = sizeof(v8_ad) / sizeof(ARMCPRegInfo)},
+	{ .name = "AArch64 SIMD and floating-point registers", .array = v8_fp, .size = sizeof(v8_fp) / sizeof(ARMCPRegInfo)},
+	{ .name = "Exception capture", .array = exc_capture, .size = sizeof(exc_capture) / sizeof(ARMCPRegInfo)}
 };
 
+
+/* Find a register by name, case insensitive */
+ARMCPRegInfo *arm_cp_find(const char *name)
+{
+	int i, j;
+
+	for(i = 0; i < sizeof(reg_array) / sizeof(struct ARMCPRegArray); i++) {
+		for(j = 0; j < reg_array[i].size; j++) {
+			if(!strcasecmp(reg_array[i].array[j].name, name)) {
+				return &reg_array[i].array[j];
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* Lane `.T[i]` after $vN or $qN, T is b, h, s or d. Return the number of
+ * characters used or -1
+ */
+static int arm_cp_parse_lane(const char *name, const char *p, ARMCPOperand *op)
+{
+	static const char sizes[] = "bhsd";
+	const char *t;
+	char *end;
+	long n, lane;
+	int bits;
+
+	if((tolower((unsigned char)name[0]) != 'v' && tolower((unsigned char)name[0]) != 'q')
+	   || !isdigit((unsigned char)name[1])) {
+		return -1;
+	}
+	n = strtol(name + 1, &end, 10);
+	if(*end != '\0' || n > 31 || p[0] != '.' || p[1] == '\0'
+	   || (t = strchr(sizes, tolower((unsigned char)p[1]))) == NULL || p[2] != '[') {
+		return -1;
+	}
+	bits = 8 << (t - sizes);
+	lane = strtol(p + 3, &end, 10);
+	if(*end != ']' || lane < 0 || lane >= 128 / bits) {
+		return -1;
+	}
+
+	op->reg = lane * bits < 64 ? &v8_fp[n] : &v8_fp_high[n];
+	op->field = NULL;
+	op->shift = lane * bits % 64;
+	op->mask = (0xFFFFFFFFFFFFFFFFULL >> (64 - bits)) << op->shift;
+	op->all = 0;
+
+	return end + 1 - p;
+}
+
+/* Parse a register operand, return the number of characters used or -1 */
+int arm_cp_parse(const char *str, ARMCPOperand *op)
+{
+	const char *p = str;
+	char name[64], field[32];
+	char *end;
+	int len = 0, start_bit, end_bit;
+
+	if(*p++ != '$') {
+		return -1;
+	}
+	for(; isalnum((unsigned char)*p) || *p == '_'; p++) {
+		if(len < sizeof(name) - 1) {
+			name[len++] = *p;
+		}
+	}
+	name[len] = '\0';
+
+	/* $v3.d[1] */
+	if((len = arm_cp_parse_lane(name, p, op)) > 0) {
+		return p + len - str;
+	}
+	if((op->reg = arm_cp_find(name)) == NULL) {
+		return -1;
+	}
+	op->field = NULL;
+	op->mask = 0xFFFFFFFFFFFFFFFFULL;
+	op->shift = 0;
+	op->all = 0;
+
+	if(*p == '[') {
+		end_bit = strtol(p + 1, &end, 10);
+		if(*end != ':') {
+			return -1;
+		}
+		start_bit = strtol(end + 1, &end, 10);
+		if(*end != ']' || start_bit < 0 || end_bit > 63 || start_bit > end_bit) {
+			return -1;
+		}
+		op->mask = (0xFFFFFFFFFFFFFFFFULL >> (63 - (end_bit - start_bit))) << start_bit;
+		op->shift = start_bit;
+		p = end + 1;
+	}
+	else if(*p == '.') {
+		if(p[1] == '*') {
+			if(arm_cp_field_list(op->reg->name, &len) == NULL) {
+				return -1;
+			}
+			op->all = 1;
+			return p + 2 - str;
+		}
+		for(p++, len = 0; isalnum((unsigned char)*p) || *p == '_'; p++) {
+			if(len < sizeof(field) - 1) {
+				field[len++] = *p;
+			}
+		}
+		field[len] = '\0';
+		if((op->field = arm_cp_field_find(op->reg->name, field)) == NULL) {
+			return -1;
+		}
+		op->mask = op->field->mask;
+		op->shift = op->field->shift;
+	}
+
+	return p - str;
+}
+
+/* Value of a register in `packet`, -1 if QEMU does not implement it */
+int arm_cp_read(const ARMCPRegInfo *ri, const FetcherPacket *packet, uint64_t *value)
+{
+	switch(ri->type) {
+	case ARM_CP_CONST:
+		*value = ri->const_value;
+		return 0;
+	case ARM_CP_NORMAL_L:
+		*value = *(uint32_t *)((uint8_t *)packet + ri->fieldoffset);
+		return 0;
+	case ARM_CP_NORMAL_H:
+		*value = *(uint64_t *)((uint8_t *)packet + ri->fieldoffset);
+		return 0;
+	case ARM_CP_UNIMPL:
+		/* Unless the fetcher's layout binds it */
+		return sysregs_read(ri, value);
+	case ARM_CP_EXC_L:
+		return exception_read(ri->fieldoffset, 4, value);
+	case ARM_CP_EXC_H:
+		return exception_read(ri->fieldoffset, 8, value);
+	case ARM_CP_FP_L:
+		return fpsimd_read(ri->fieldoffset, 4, value);
+	case ARM_CP_FP_H:
+		return fpsimd_read(ri->fieldoffset, 8, value);
+	}
+
+	return -1;
+}
+
+/* Known to QEMU or bound by the fetcher's layout, whether or not a value
+ * has arrived
+ */
+int arm_cp_implemented(const ARMCPRegInfo *ri)
+{
+	uint32_t offset;
+	int size;
+
+	return ri->type != ARM_CP_UNIMPL || sysregs_bound(ri, &offset, &size) == 0;
+}
+
+/* Evaluate a command argument, either $register or a number */
+int arm_cp_eval(const char *arg, const FetcherPacket *packet, uint64_t *value)
+{
+	ARMCPRegInfo *ri;
+	char *end;
+
+	if(*arg == '$') {
+		if((ri = arm_cp_find(arg + 1)) == NULL) {
+			return -1;
+		}
+		return arm_cp_read(ri, packet, value);
+	}
+
+	*value = strtoull(arg, &end, 0);
+	return *arg != '\0' && *end == '\0' ? 0 : -1;
+}
+
+/* Format "name = value" in x, o, d or u, followed by the name of the field
+ * value if it has one. Return -1 for an invalid format.
+ */
+int arm_cp_format(char *buf, size_t len, const char *name, uint64_t value, char format,
+                  const ARMCPField *field)
+{
+	char tmp[FORMAT_MAX_DIGITS];
+	const char *value_name;
+	int n, digits;
+
+	switch(format) {
+	case 'o':
+		digits = format_oct(tmp, value);
+		break;
+	case 'x':
+	case 'a':
+		digits = format_hex(tmp, value);
+		break;
+	case 'd':
+		digits = format_dec(tmp, value);
+		break;
+	case 'u':
+		digits = format_udec(tmp, value);
+		break;
+	default:
+		return -1;
+	}
+
+	n = snprintf(buf, len, "%s = %.*s", name, digits, tmp);
+	if(format == 'a') {
+		symbols_format(value, buf, len);
+		lines_format(value, buf, len);
+	}
+	if(field && (value_name = arm_cp_field_enum(field, value)) != NULL && n < len) {
+		snprintf(buf + n, len - n, " (%s)", value_name);
+	}
+
+	return 0;
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "replay.h"
+
+/* Replay a recorded trace in place of the QEMU connection.
+ * Only the prompt thread moves the cursor.
+ */
+static TraceReader *reader;
+static uint64_t cursor;
+/* Steps matched by the last query */
+static uint64_t *matches;
+static uint64_t nr_matches;
+
+int replay_open(const char *path)
+{
+	if((reader = trace_reader_open(path)) == NULL) {
+		return -1;
+	}
+	cursor = 0;
+
+	return 0;
+}
+
+void replay_close(void)
+{
+	if(reader) {
+		trace_reader_close(reader);
+		reader = NULL;
+	}
+	replay_set_matches(NULL, 0);
+}
+
+int replay_active(void)
+{
+	return reader != NULL;
+}
+
+/* Move to `step`, clamped to the trace, and load its packet */
+int replay_seek(int64_t step, FetcherPacket *packet)
+{
+	if(reader == NULL || trace_steps(reader) == 0) {
+		return -1;
+	}
+
+	if(step < 0) {
+		step = 0;
+	}
+	if(step >= trace_steps(reader)) {
+		step = trace_steps(reader) - 1;
+	}
+
+	if(trace_read(reader, step, packet, NULL) < 0) {
+		return -1;
+	}
+	cursor = step;
+
+	return 0;
+}
+
+uint64_t replay_step(void)
+{
+	return cursor;
+}
+
+uint64_t replay_steps(void)
+{
+	return reader ? trace_steps(reader) : 0;
+}
+
+const TraceReader *replay_reader(void)
+{
+	return reader;
+}
+
+/* Take ownership of a sorted query result */
+void replay_set_matches(uint64_t *steps, uint64_t count)
+{
+	free(matches);
+	matches = steps;
+	nr_matches = count;
+}
+
+/* First match after the cursor, wrapping around to the first match */
+int replay_next_match(uint64_t *step)
+{
+	uint64_t lo = 0, hi = nr_matches;
+
+	if(nr_matches == 0) {
+		return -1;
+	}
+
+	while(lo < hi) {
+		uint64_t mid = (lo + hi) / 2;
+
+		if(matches[mid] <= cursor) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	*step = matches[lo == nr_matches ? 0 : lo];
+
+	return 0;
+}
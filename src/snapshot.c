@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <endian.h>
+
+#include "snapshot.h"
+#include "arena.h"
+#include "sysregs.h"
+#include "regs.h"
+
+/* Snapshots are never freed one by one */
+static Arena arena = ARENA_INIT(256 * 1024);
+static Snapshot *snapshots; /* newest first */
+static int nr_snapshots;
+
+static uint32_t blob_padded(uint32_t length)
+{
+	return (length + 31) & ~31U;
+}
+
+/* Fill `s` with the live state, the blob goes to `blob` of `size` bytes */
+static void snapshot_capture(Snapshot *s, const FetcherPacket *packet, uint8_t *blob, uint32_t size)
+{
+	memset(s->words, 0, sizeof(s->words));
+	s->packet = *packet;
+	s->blob_length = sysregs_copy(blob, size, &s->big_endian);
+	if(s->blob_length > size) {
+		s->blob_length = size;
+	}
+	memset(blob + s->blob_length, 0, blob_padded(s->blob_length) - s->blob_length);
+	s->blob = s->blob_length ? blob : NULL;
+}
+
+int snapshot_save(const char *name, const FetcherPacket *packet)
+{
+	Snapshot *s;
+	uint8_t *blob;
+	uint32_t length;
+	int big_endian;
+
+	if(strlen(name) >= SNAPSHOT_NAME_LEN || !strcasecmp(name, SNAPSHOT_CURRENT)) {
+		return -1;
+	}
+
+	/* A blob that grew in between is cut to the size allocated here */
+	length = sysregs_copy(NULL, 0, &big_endian);
+	if((s = arena_alloc(&arena, sizeof(Snapshot) + blob_padded(length))) == NULL) {
+		return -1;
+	}
+	blob = (uint8_t *)s + ((sizeof(Snapshot) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1));
+	snapshot_capture(s, packet, blob, length);
+
+	snprintf(s->name, sizeof(s->name), "%s", name);
+	s->next = snapshots;
+	snapshots = s;
+	nr_snapshots++;
+
+	return 0;
+}
+
+void snapshot_list(void (*out)(const char *))
+{
+	Snapshot *s;
+	char str[128];
+
+	for(s = snapshots; s; s = s->next) {
+		snprintf(str, sizeof(str), "%-*s pc = 0x%lx, %u bytes of raw system registers\n",
+		         SNAPSHOT_NAME_LEN, s->name, s->packet.pc, s->blob_length);
+		out(str);
+	}
+	if(nr_snapshots == 0) {
+		out("No snapshot\n");
+	}
+}
+
+static Snapshot *snapshot_find(const char *name)
+{
+	Snapshot *s;
+
+	for(s = snapshots; s; s = s->next) {
+		if(!strcasecmp(s->name, name)) {
+			return s;
+		}
+	}
+
+	return NULL;
+}
+
+/* x = a ^ b over `words` 64-bit words, a multiple of four, four lanes at a
+ * time. Return non-zero if anything differs.
+ */
+typedef uint64_t u64x4 __attribute__((vector_size(32)));
+
+static int snapshot_xor(const uint64_t *a, const uint64_t *b, uint64_t *x, size_t words)
+{
+	u64x4 va, vb, any = {0, 0, 0, 0};
+	size_t i;
+
+	for(i = 0; i < words; i += 4) {
+		memcpy(&va, a + i, sizeof(va));
+		memcpy(&vb, b + i, sizeof(vb));
+		va ^= vb;
+		memcpy(x + i, &va, sizeof(va));
+		any |= va;
+	}
+
+	return (any[0] | any[1] | any[2] | any[3]) != 0;
+}
+
+static uint64_t load(const uint8_t *p, int size, int big_endian)
+{
+	uint32_t v32;
+	uint64_t v64;
+
+	if(size == 8) {
+		memcpy(&v64, p, 8);
+		return big_endian ? be64toh(v64) : le64toh(v64);
+	}
+	memcpy(&v32, p, 4);
+	return big_endian ? be32toh(v32) : le32toh(v32);
+}
+
+/* Print one changed register and its changed fields */
+static void diff_register(const char *name, uint64_t old, uint64_t new, void (*out)(const char *))
+{
+	const ARMCPField *fields;
+	const char *old_name, *new_name;
+	char str[256];
+	int i, count;
+
+	snprintf(str, sizeof(str), "%-16s 0x%lx -> 0x%lx\n", name, old, new);
+	out(str);
+
+	fields = arm_cp_field_list(name, &count);
+	for(i = 0; i < count; i++) {
+		if(!((old ^ new) & fields[i].mask)) {
+			continue;
+		}
+		old_name = arm_cp_field_enum(&fields[i], (old & fields[i].mask) >> fields[i].shift);
+		new_name = arm_cp_field_enum(&fields[i], (new & fields[i].mask) >> fields[i].shift);
+		snprintf(str, sizeof(str), "  .%-13s 0x%lx%s%s%s -> 0x%lx%s%s%s\n", fields[i].name,
+		         (old & fields[i].mask) >> fields[i].shift,
+		         old_name ? " (" : "", old_name ? old_name : "", old_name ? ")" : "",
+		         (new & fields[i].mask) >> fields[i].shift,
+		         new_name ? " (" : "", new_name ? new_name : "", new_name ? ")" : "");
+		out(str);
+	}
+}
+
+/* Walk reg_array over the XOR of both sides, `covered` marks the blob
+ * words that belong to a named register
+ */
+static int diff_registers(const Snapshot *a, const Snapshot *b, const uint64_t *xp,
+                          const uint64_t *xb, uint32_t blob_length, uint8_t *covered,
+                          void (*out)(const char *))
+{
+	ARMCPRegInfo *ri;
+	int i, j, size, changed = 0;
+	uint32_t offset;
+	uint64_t x, old, new;
+
+	for(i = 0; i < sizeof(reg_array) / sizeof(struct ARMCPRegArray); i++) {
+		for(j = 0; j < reg_array[i].size; j++) {
+			ri = &reg_array[i].array[j];
+			/* A register listed in several groups is reported once */
+			if(arm_cp_find(ri->name) != ri) {
+				continue;
+			}
+
+			switch(ri->type) {
+			case ARM_CP_NORMAL_L:
+			case ARM_CP_NORMAL_H:
+				size = ri->type == ARM_CP_NORMAL_H ? 8 : 4;
+				x = 0;
+				memcpy(&x, (const uint8_t *)xp + ri->fieldoffset, size);
+				if(x) {
+					arm_cp_read(ri, &a->packet, &old);
+					arm_cp_read(ri, &b->packet, &new);
+					diff_register(ri->name, old, new, out);
+					changed++;
+				}
+				break;
+			case ARM_CP_UNIMPL:
+				/* Bound by the current layout */
+				if(sysregs_bound(ri, &offset, &size) < 0 || (uint64_t)offset + size > blob_length) {
+					break;
+				}
+				memset(covered + offset / 8, 1, (offset % 8 + size + 7) / 8);
+				x = 0;
+				memcpy(&x, (const uint8_t *)xb + offset, size);
+				if(x) {
+					diff_register(ri->name, load(a->blob + offset, size, a->big_endian),
+					              load(b->blob + offset, size, b->big_endian), out);
+					changed++;
+				}
+				break;
+			}
+		}
+	}
+
+	return changed;
+}
+
+int snapshot_diff(const char *name_a, const char *name_b, const FetcherPacket *current,
+                  void (*out)(const char *))
+{
+	static Snapshot live;
+	static uint8_t *live_blob;
+	static uint32_t live_size;
+	const Snapshot *a, *b;
+	uint8_t *p;
+	uint64_t xp[SNAPSHOT_PACKET_WORDS] __attribute__((aligned(32)));
+	uint64_t *xb = NULL;
+	uint8_t *covered = NULL;
+	uint32_t length, blob_length = 0, words, i;
+	int big_endian, changed;
+	char str[128];
+
+	if(!strcasecmp(name_a, SNAPSHOT_CURRENT) || !strcasecmp(name_b, SNAPSHOT_CURRENT)) {
+		length = blob_padded(sysregs_copy(NULL, 0, &big_endian));
+		if(length > live_size) {
+			if((p = realloc(live_blob, length)) == NULL) {
+				return -2;
+			}
+			live_blob = p;
+			live_size = length;
+		}
+		snapshot_capture(&live, current, live_blob, length);
+	}
+	a = strcasecmp(name_a, SNAPSHOT_CURRENT) ? snapshot_find(name_a) : &live;
+	b = strcasecmp(name_b, SNAPSHOT_CURRENT) ? snapshot_find(name_b) : &live;
+	if(a == NULL || b == NULL) {
+		return -1;
+	}
+
+	snapshot_xor(a->words, b->words, xp, SNAPSHOT_PACKET_WORDS);
+
+	/* Raw blobs are compared over the part both sides captured */
+	if(a->blob && b->blob) {
+		blob_length = a->blob_length < b->blob_length ? a->blob_length : b->blob_length;
+		if(a->blob_length != b->blob_length || a->big_endian != b->big_endian) {
+			out("Raw system register layouts differ, comparing the common part\n");
+		}
+		words = blob_padded(blob_length) / 8;
+		xb = malloc(words * 8);
+		covered = calloc(words, 1);
+		if(xb == NULL || covered == NULL) {
+			free(xb);
+			free(covered);
+			return -2;
+		}
+		snapshot_xor((const uint64_t *)a->blob, (const uint64_t *)b->blob, xb, words);
+	}
+	else if(a->blob || b->blob) {
+		out("Raw system registers were not captured on both sides\n");
+	}
+
+	changed = diff_registers(a, b, xp, xb, blob_length, covered, out);
+
+	/* Blob words outside every named register */
+	for(i = 0; xb && i < blob_padded(blob_length) / 8; i++) {
+		if(xb[i] == 0 || covered[i] || i * 8 >= blob_length) {
+			continue;
+		}
+		snprintf(str, sizeof(str), "blob+0x%-10x 0x%lx -> 0x%lx\n", i * 8,
+		         load(a->blob + i * 8, 8, a->big_endian), load(b->blob + i * 8, 8, b->big_endian));
+		out(str);
+	}
+
+	snprintf(str, sizeof(str), "%d register%s changed\n", changed, changed == 1 ? "" : "s");
+	out(str);
+
+	free(xb);
+	free(covered);
+
+	return changed;
+}
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+typedef struct StatsCounter {
+	uint64_t count;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+	uint64_t last;
+} StatsCounter;
+
+static const char *names[NR_STATS] = { "receive", "display" };
+
+/* The receive thread counts while the prompt thread prints */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static StatsCounter counters[NR_STATS];
+static char mode[64] = "blocking";
+
+void stats_mode(const char *m)
+{
+	pthread_mutex_lock(&lock);
+	snprintf(mode, sizeof(mode), "%s", m);
+	pthread_mutex_unlock(&lock);
+}
+
+void stats_record(int counter, uint64_t timestamp)
+{
+	struct timespec ts;
+	uint64_t now, ns;
+	StatsCounter *c = &counters[counter];
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	/* A clock of another host, or a keyframe from before a restart */
+	if(timestamp == 0 || timestamp > now) {
+		return;
+	}
+	ns = now - timestamp;
+
+	pthread_mutex_lock(&lock);
+	if(c->count == 0 || ns < c->min) {
+		c->min = ns;
+	}
+	if(ns > c->max) {
+		c->max = ns;
+	}
+	c->total += ns;
+	c->last = ns;
+	c->count++;
+	pthread_mutex_unlock(&lock);
+}
+
+void stats_reset(void)
+{
+	pthread_mutex_lock(&lock);
+	memset(counters, 0, sizeof(counters));
+	pthread_mutex_unlock(&lock);
+}
+
+void stats_print(void (*out)(const char *))
+{
+	StatsCounter c[NR_STATS];
+	char line[160];
+	int i;
+
+	pthread_mutex_lock(&lock);
+	memcpy(c, counters, sizeof(counters));
+	snprintf(line, sizeof(line), "Receive mode: %s\n", mode);
+	pthread_mutex_unlock(&lock);
+
+	out(line);
+	for(i = 0; i < NR_STATS; i++) {
+		if(c[i].count == 0) {
+			snprintf(line, sizeof(line), "%-8s latency: no packets\n", names[i]);
+		}
+		else {
+			snprintf(line, sizeof(line), "%-8s latency: %lu packets, last %.1f us, mean %.1f us, min %.1f us, max %.1f us\n",
+			         names[i], c[i].count, c[i].last / 1e3, (double)c[i].total / c[i].count / 1e3,
+			         c[i].min / 1e3, c[i].max / 1e3);
+		}
+		out(line);
+	}
+}
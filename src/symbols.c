@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "symbols.h"
+#include "epoch.h"
+
+/* Symbol while the table is built */
+typedef struct SymbolEntry {
+	uint64_t addr;
+	uint64_t limit; /* end, or the next symbol if the size is unknown */
+	uint32_t name; /* offset in the string table */
+	int rank; /* prefer global, then typed symbols at the same address */
+} SymbolEntry;
+
+/* What a lookup reads after the search, 8 bytes */
+typedef struct Symbol {
+	uint32_t size; /* up to the limit */
+	uint32_t name;
+} Symbol;
+
+/* Addresses are kept as 32-bit offsets from `base`, which covers any
+ * kernel image. keys[] and symbols[] are in Eytzinger order and 1-based,
+ * keys[k] is the start of symbols[k]. The search only touches keys[].
+ */
+typedef struct SymbolTable {
+	void *map;
+	size_t map_size;
+	const char *strs;
+	uint64_t base;
+	uint32_t count;
+	uint32_t *keys;
+	Symbol *symbols;
+} SymbolTable;
+
+static SymbolTable empty_table;
+/* Published table, a reload swaps it and retires the old one */
+static SymbolTable *table = &empty_table;
+/* Consecutive pcs mostly fall in the same function */
+static __thread uint32_t last_hit;
+
+static int symbol_cmp(const void *a, const void *b)
+{
+	const SymbolEntry *x = a, *y = b;
+
+	if(x->addr != y->addr) {
+		return x->addr < y->addr ? -1 : 1;
+	}
+
+	return y->rank - x->rank;
+}
+
+/* In-order walk of the implicit tree fills it from the sorted array */
+static uint32_t eytzinger_fill(SymbolTable *t, const SymbolEntry *sorted, uint32_t i, uint32_t k)
+{
+	if(k <= t->count) {
+		i = eytzinger_fill(t, sorted, i, 2 * k);
+		t->keys[k] = sorted[i].addr - t->base;
+		t->symbols[k].size = sorted[i].limit - sorted[i].addr;
+		t->symbols[k].name = sorted[i].name;
+		i = eytzinger_fill(t, sorted, i + 1, 2 * k + 1);
+	}
+
+	return i;
+}
+
+static void symbols_free(SymbolTable *t)
+{
+	if(t->map) {
+		munmap(t->map, t->map_size);
+	}
+	free(t->keys);
+	free(t->symbols);
+	memset(t, 0, sizeof(*t));
+}
+
+static void symbols_destroy(void *p)
+{
+	if(p != &empty_table) {
+		symbols_free(p);
+		free(p);
+	}
+}
+
+/* Sorted defined symbols of the first SHT_SYMTAB, or SHT_DYNSYM */
+static SymbolEntry *symbols_read(SymbolTable *t)
+{
+	const uint8_t *base = t->map;
+	const Elf64_Ehdr *eh = t->map;
+	const Elf64_Shdr *sh, *symtab = NULL, *strtab;
+	const Elf64_Sym *sym;
+	SymbolEntry *sorted;
+	uint64_t first_func = UINT64_MAX;
+	uint32_t i, n, count = 0;
+	int type;
+
+	if(t->map_size < sizeof(Elf64_Ehdr) || memcmp(eh->e_ident, ELFMAG, SELFMAG)
+	   || eh->e_ident[EI_CLASS] != ELFCLASS64
+	   || eh->e_ident[EI_DATA] != (__BYTE_ORDER == __LITTLE_ENDIAN ? ELFDATA2LSB : ELFDATA2MSB)
+	   || eh->e_shentsize != sizeof(Elf64_Shdr)
+	   || eh->e_shoff > t->map_size || eh->e_shnum > (t->map_size - eh->e_shoff) / sizeof(Elf64_Shdr)) {
+		return NULL;
+	}
+	sh = (const Elf64_Shdr *)(base + eh->e_shoff);
+
+	for(i = 0; i < eh->e_shnum; i++) {
+		if(sh[i].sh_type == SHT_SYMTAB || (sh[i].sh_type == SHT_DYNSYM && symtab == NULL)) {
+			symtab = &sh[i];
+		}
+	}
+	if(symtab == NULL || symtab->sh_link >= eh->e_shnum
+	   || symtab->sh_offset > t->map_size || symtab->sh_size > t->map_size - symtab->sh_offset) {
+		return NULL;
+	}
+	strtab = &sh[symtab->sh_link];
+	if(strtab->sh_offset > t->map_size || strtab->sh_size > t->map_size - strtab->sh_offset
+	   || strtab->sh_size == 0 || base[strtab->sh_offset + strtab->sh_size - 1] != '\0') {
+		return NULL;
+	}
+	sym = (const Elf64_Sym *)(base + symtab->sh_offset);
+	t->strs = (const char *)base + strtab->sh_offset;
+	n = symtab->sh_size / sizeof(Elf64_Sym);
+
+	if((sorted = malloc(n * sizeof(SymbolEntry))) == NULL) {
+		return NULL;
+	}
+	for(i = 0; i < n; i++) {
+		type = ELF64_ST_TYPE(sym[i].st_info);
+		if(sym[i].st_shndx == SHN_UNDEF || sym[i].st_shndx == SHN_ABS || sym[i].st_name >= strtab->sh_size
+		   || (type != STT_FUNC && type != STT_OBJECT && type != STT_NOTYPE)) {
+			continue;
+		}
+		/* Skip empty names and ARM mapping symbols ($x, $d) */
+		if(t->strs[sym[i].st_name] == '\0' || t->strs[sym[i].st_name] == '$') {
+			continue;
+		}
+		if(type == STT_FUNC && sym[i].st_value < first_func) {
+			first_func = sym[i].st_value;
+		}
+		sorted[count].addr = sym[i].st_value;
+		sorted[count].limit = sym[i].st_size ? sym[i].st_value + sym[i].st_size : 0;
+		sorted[count].name = sym[i].st_name;
+		sorted[count].rank = (ELF64_ST_BIND(sym[i].st_info) == STB_GLOBAL) * 2 + (type != STT_NOTYPE);
+		count++;
+	}
+
+	/* One symbol per address, the best ranked sorts first. The window
+	 * starts at the first function, stray low symbols fall out of it.
+	 */
+	qsort(sorted, count, sizeof(SymbolEntry), symbol_cmp);
+	t->base = first_func != UINT64_MAX ? first_func : (count ? sorted[0].addr : 0);
+	for(i = 0, n = 0; i < count; i++) {
+		if(sorted[i].addr < t->base || sorted[i].addr - t->base > UINT32_MAX) {
+			continue;
+		}
+		if(n == 0 || sorted[i].addr != sorted[n - 1].addr) {
+			sorted[n++] = sorted[i];
+		}
+	}
+	/* A symbol never runs into the next one */
+	for(i = 0; i < n; i++) {
+		if(i + 1 < n && (sorted[i].limit == 0 || sorted[i].limit > sorted[i + 1].addr)) {
+			sorted[i].limit = sorted[i + 1].addr;
+		}
+		else if(sorted[i].limit == 0 || sorted[i].limit - sorted[i].addr > UINT32_MAX) {
+			sorted[i].limit = sorted[i].addr + UINT32_MAX;
+		}
+	}
+	t->count = n;
+
+	if(n == 0) {
+		free(sorted);
+		return NULL;
+	}
+
+	return sorted;
+}
+
+int symbols_load(const char *path)
+{
+	SymbolTable t = {0}, *p;
+	SymbolEntry *sorted;
+	struct stat st;
+	int fd;
+
+	if((fd = open(path, O_RDONLY)) < 0) {
+		return -1;
+	}
+	if(fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return -1;
+	}
+	t.map_size = st.st_size;
+	t.map = mmap(NULL, t.map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(t.map == MAP_FAILED) {
+		return -1;
+	}
+
+	if((sorted = symbols_read(&t)) == NULL) {
+		symbols_free(&t);
+		return -1;
+	}
+	if(posix_memalign((void **)&t.keys, 64, (t.count + 1) * sizeof(uint32_t))
+	   || (t.symbols = malloc((t.count + 1) * sizeof(Symbol))) == NULL) {
+		free(sorted);
+		symbols_free(&t);
+		return -1;
+	}
+	eytzinger_fill(&t, sorted, 0, 1);
+	free(sorted);
+	if((p = malloc(sizeof(SymbolTable))) == NULL) {
+		symbols_free(&t);
+		return -1;
+	}
+	*p = t;
+
+	/* A display being formatted may still read the old table */
+	epoch_retire(__atomic_exchange_n(&table, p, __ATOMIC_ACQ_REL), symbols_destroy);
+	epoch_reclaim();
+
+	return 0;
+}
+
+uint32_t symbols_count(void)
+{
+	uint32_t count;
+
+	epoch_enter();
+	count = __atomic_load_n(&table, __ATOMIC_ACQUIRE)->count;
+	epoch_exit();
+
+	return count;
+}
+
+const char *symbols_lookup(uint64_t addr, uint64_t *offset)
+{
+	const SymbolTable *t = __atomic_load_n(&table, __ATOMIC_ACQUIRE);
+	uint64_t off = addr - t->base;
+	uint32_t k = last_hit, key;
+
+	if(t->count == 0 || addr < t->base || off > UINT32_MAX) {
+		return NULL;
+	}
+	key = off;
+
+	if(k == 0 || k > t->count || key < t->keys[k] || key - t->keys[k] >= t->symbols[k].size) {
+		/* Descend, sixteen keys of the next four levels share a cache line */
+		k = 1;
+		while(k <= t->count) {
+			__builtin_prefetch(t->keys + k * 16);
+			k = 2 * k + (t->keys[k] <= key);
+		}
+		/* The last right turn is the last start at or below addr */
+		k >>= __builtin_ffs(k);
+		if(k == 0 || key - t->keys[k] >= t->symbols[k].size) {
+			return NULL;
+		}
+		last_hit = k;
+	}
+
+	*offset = key - t->keys[k];
+
+	return t->strs + t->symbols[k].name;
+}
+
+void symbols_format(uint64_t addr, char *buf, size_t len)
+{
+	const char *name;
+	uint64_t offset;
+	size_t n = strlen(buf);
+
+	if(n >= len) {
+		return;
+	}
+
+	/* The name points into the table, which lives until the exit */
+	epoch_enter();
+	name = symbols_lookup(addr, &offset);
+	if(name && offset) {
+		snprintf(buf + n, len - n, " <%s+%#lx>", name, offset);
+	}
+	else if(name) {
+		snprintf(buf + n, len - n, " <%s>", name);
+	}
+	epoch_exit();
+}
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <endian.h>
+#include <pthread.h>
+
+#include "sysregs.h"
+#include "regs.h"
+
+/* Registers a layout resolved from the blob, sorted by entry */
+typedef struct SysregBinding {
+	const ARMCPRegInfo *ri;
+	uint32_t offset;
+	uint32_t size;
+} SysregBinding;
+
+/* The receive thread updates the blob and the bindings while the prompt
+ * thread and the packet path read them, reg_array itself is never written
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t *blob;
+static uint32_t blob_length, blob_size;
+static int blob_big_endian;
+static SysregBinding *bindings;
+static int nr_bindings;
+
+static int binding_cmp(const void *a, const void *b)
+{
+	const ARMCPRegInfo *x = ((const SysregBinding *)a)->ri, *y = ((const SysregBinding *)b)->ri;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Caller holds the lock */
+static const SysregBinding *binding_find(const ARMCPRegInfo *ri)
+{
+	SysregBinding key = {.ri = ri};
+
+	return nr_bindings ? bsearch(&key, bindings, nr_bindings, sizeof(SysregBinding), binding_cmp) : NULL;
+}
+
+/* Bind every unimplemented reg_array entry called `name`, a register may
+ * be listed in more than one group. Registers carried by FetcherPacket
+ * stay there, they are recorded.
+ */
+static int sysregs_bind(SysregBinding *table, int *count, const char *name, uint32_t offset, uint32_t size)
+{
+	const ARMCPRegInfo *ri;
+	int i, j, k, bound = 0;
+
+	for(i = 0; i < sizeof(reg_array) / sizeof(struct ARMCPRegArray); i++) {
+		for(j = 0; j < reg_array[i].size; j++) {
+			ri = &reg_array[i].array[j];
+			if(ri->type != ARM_CP_UNIMPL || strcasecmp(ri->name, name)) {
+				continue;
+			}
+			/* Named twice in the layout, the first one wins */
+			for(k = 0; k < *count && table[k].ri != ri; k++);
+			if(k < *count) {
+				continue;
+			}
+			table[*count].ri = ri;
+			table[*count].offset = offset;
+			table[*count].size = size;
+			(*count)++;
+			bound = 1;
+		}
+	}
+
+	return bound;
+}
+
+/* A new layout replaces the old one in one step, registers it lacks are
+ * unknown again. Return the number of registers resolved from the blob,
+ * -1 if the table can not be allocated.
+ */
+int sysregs_layout(const FetcherWireSysreg *regs, int count, int big_endian)
+{
+	char name[FETCHER_SYSREG_NAME_LEN + 1];
+	SysregBinding *table, *old;
+	uint32_t size;
+	int i, j, nr_unimpl = 0, nr = 0, resolved = 0;
+
+	for(i = 0; i < sizeof(reg_array) / sizeof(struct ARMCPRegArray); i++) {
+		for(j = 0; j < reg_array[i].size; j++) {
+			nr_unimpl += reg_array[i].array[j].type == ARM_CP_UNIMPL;
+		}
+	}
+	/* Each unimplemented entry is bound at most once */
+	if((table = malloc((nr_unimpl ? nr_unimpl : 1) * sizeof(SysregBinding))) == NULL) {
+		return -1;
+	}
+	for(i = 0; i < count; i++) {
+		memcpy(name, regs[i].name, FETCHER_SYSREG_NAME_LEN);
+		name[FETCHER_SYSREG_NAME_LEN] = '\0';
+		size = le32toh(regs[i].size);
+		if(size != 4 && size != 8) {
+			continue;
+		}
+		resolved += sysregs_bind(table, &nr, name, le32toh(regs[i].offset), size);
+	}
+	qsort(table, nr, sizeof(SysregBinding), binding_cmp);
+
+	pthread_mutex_lock(&lock);
+	old = bindings;
+	bindings = table;
+	nr_bindings = nr;
+	blob_big_endian = big_endian;
+	blob_length = 0;
+	pthread_mutex_unlock(&lock);
+	free(old);
+
+	return resolved;
+}
+
+void sysregs_update(const void *data, uint32_t length)
+{
+	uint8_t *p;
+
+	pthread_mutex_lock(&lock);
+	if(length > blob_size) {
+		if((p = realloc(blob, length)) == NULL) {
+			/* Keep the old buffer, the registers read as not arrived */
+			blob_length = 0;
+			pthread_mutex_unlock(&lock);
+			return;
+		}
+		blob = p;
+		blob_size = length;
+	}
+	memcpy(blob, data, length);
+	blob_length = length;
+	pthread_mutex_unlock(&lock);
+}
+
+int sysregs_bound(const ARMCPRegInfo *ri, uint32_t *offset, int *size)
+{
+	const SysregBinding *b;
+
+	pthread_mutex_lock(&lock);
+	if((b = binding_find(ri)) != NULL) {
+		*offset = b->offset;
+		*size = b->size;
+	}
+	pthread_mutex_unlock(&lock);
+
+	return b ? 0 : -1;
+}
+
+/* Read a register out of the latest blob, -1 if it is not bound or no
+ * blob has arrived
+ */
+int sysregs_read(const ARMCPRegInfo *ri, uint64_t *value)
+{
+	const SysregBinding *b;
+	uint32_t v32;
+	uint64_t v64;
+	int ret = -1;
+
+	pthread_mutex_lock(&lock);
+	if((b = binding_find(ri)) != NULL && (uint64_t)b->offset + b->size <= blob_length) {
+		if(b->size == 8) {
+			memcpy(&v64, blob + b->offset, 8);
+			*value = blob_big_endian ? be64toh(v64) : le64toh(v64);
+		}
+		else {
+			memcpy(&v32, blob + b->offset, 4);
+			*value = blob_big_endian ? be32toh(v32) : le32toh(v32);
+		}
+		ret = 0;
+	}
+	pthread_mutex_unlock(&lock);
+
+	return ret;
+}
+
+uint32_t sysregs_copy(void *buf, uint32_t size, int *big_endian)
+{
+	uint32_t length;
+
+	pthread_mutex_lock(&lock);
+	length = blob_length;
+	if(length > 0 && size > 0) {
+		memcpy(buf, blob, size < length ? size : length);
+	}
+	*big_endian = blob_big_endian;
+	pthread_mutex_unlock(&lock);
+
+	return length;
+}
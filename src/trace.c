@@ -0,0 +1,805 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define RAW_RECORD_SIZE	(sizeof(FetcherHeader) + sizeof(FetcherWireRegs))
+
+/* Bit stream helpers
+ * Bits are written MSB first into 64-bit words which are stored little-endian.
+ */
+typedef struct BitWriter {
+	uint8_t *buf;
+	size_t len;
+	size_t cap;
+	uint64_t acc;
+	int used;
+} BitWriter;
+
+typedef struct BitReader {
+	const uint8_t *p;
+	const uint8_t *end;
+	uint64_t cur;
+	int avail;
+} BitReader;
+
+static void bw_word(BitWriter *bw, uint64_t word)
+{
+	if(bw->len + sizeof(uint64_t) > bw->cap) {
+		bw->cap = bw->cap ? bw->cap * 2 : 4096;
+		bw->buf = realloc(bw->buf, bw->cap);
+	}
+	word = htole64(word);
+	memcpy(bw->buf + bw->len, &word, sizeof(uint64_t));
+	bw->len += sizeof(uint64_t);
+}
+
+/* Write the low n bits of v, 0 <= n <= 64 */
+static void bw_put(BitWriter *bw, uint64_t v, int n)
+{
+	int room = 64 - bw->used;
+
+	if(n == 0) {
+		return;
+	}
+	if(n < 64) {
+		v &= (1ULL << n) - 1;
+	}
+
+	if(n < room) {
+		bw->acc |= v << (room - n);
+		bw->used += n;
+		return;
+	}
+
+	bw_word(bw, bw->acc | (v >> (n - room)));
+	bw->used = n - room;
+	bw->acc = bw->used ? v << (64 - bw->used) : 0;
+}
+
+static void bw_finish(BitWriter *bw)
+{
+	if(bw->used) {
+		bw_word(bw, bw->acc);
+	}
+	bw->acc = 0;
+	bw->used = 0;
+}
+
+static uint64_t br_load(BitReader *br)
+{
+	uint64_t word = 0;
+
+	if(br->p + sizeof(uint64_t) <= br->end) {
+		memcpy(&word, br->p, sizeof(uint64_t));
+		br->p += sizeof(uint64_t);
+	}
+	return le64toh(word);
+}
+
+/* Read n bits, 0 <= n <= 64 */
+static uint64_t br_get(BitReader *br, int n)
+{
+	uint64_t v, word;
+	int rest;
+
+	if(n == 0) {
+		return 0;
+	}
+
+	if(n <= br->avail) {
+		v = br->cur >> (64 - n);
+		br->cur = n == 64 ? 0 : br->cur << n;
+		br->avail -= n;
+		return v;
+	}
+
+	rest = n - br->avail;
+	v = br->avail ? br->cur >> (64 - br->avail) : 0;
+	word = br_load(br);
+	if(rest == 64) {
+		br->cur = 0;
+		br->avail = 0;
+		return word;
+	}
+	v = (v << rest) | (word >> (64 - rest));
+	br->cur = word << rest;
+	br->avail = 64 - rest;
+	return v;
+}
+
+/* Gorilla XOR encoding
+ *    '0'                          same value as previous
+ *    '10' + bits                  XOR fits in the previous leading/trailing window
+ *    '11' + 6-bit leading zeros + 6-bit (length - 1) + bits
+ */
+static void xor_encode(BitWriter *bw, const uint64_t *val, uint32_t n)
+{
+	int prev_lz = -1, prev_tz = 0;
+	uint32_t i;
+
+	for(i = 1; i < n; i++) {
+		uint64_t x = val[i] ^ val[i - 1];
+		int lz, tz;
+
+		if(x == 0) {
+			bw_put(bw, 0, 1);
+			continue;
+		}
+
+		lz = __builtin_clzll(x);
+		tz = __builtin_ctzll(x);
+		if(prev_lz >= 0 && lz >= prev_lz && tz >= prev_tz) {
+			bw_put(bw, 2, 2);
+			bw_put(bw, x >> prev_tz, 64 - prev_lz - prev_tz);
+		}
+		else {
+			bw_put(bw, 3, 2);
+			bw_put(bw, lz, 6);
+			bw_put(bw, 64 - lz - tz - 1, 6);
+			bw_put(bw, x >> tz, 64 - lz - tz);
+			prev_lz = lz;
+			prev_tz = tz;
+		}
+	}
+}
+
+static void xor_decode(BitReader *br, uint64_t first, uint64_t *out, uint32_t n)
+{
+	int lz = 0, tz = 0;
+	uint64_t prev = first;
+	uint32_t i;
+
+	out[0] = first;
+	for(i = 1; i < n; i++) {
+		if(br_get(br, 1)) {
+			if(br_get(br, 1)) {
+				lz = br_get(br, 6);
+				tz = 64 - lz - ((int)br_get(br, 6) + 1);
+			}
+			prev ^= br_get(br, 64 - lz - tz) << tz;
+		}
+		out[i] = prev;
+	}
+}
+
+/* Delta-of-delta encoding, zigzag folded
+ *    '0'             same delta as previous
+ *    '10'   + 8 bits
+ *    '110'  + 16 bits
+ *    '1110' + 32 bits
+ *    '1111' + 64 bits
+ */
+static void dod_encode(BitWriter *bw, const uint64_t *val, uint32_t n)
+{
+	uint64_t prev_delta = 0;
+	uint32_t i;
+
+	for(i = 1; i < n; i++) {
+		uint64_t delta = val[i] - val[i - 1];
+		int64_t dod = (int64_t)(delta - prev_delta);
+		uint64_t zz = ((uint64_t)dod << 1) ^ (uint64_t)(dod >> 63);
+
+		if(zz == 0) {
+			bw_put(bw, 0, 1);
+		}
+		else if(zz < (1ULL << 8)) {
+			bw_put(bw, 2, 2);
+			bw_put(bw, zz, 8);
+		}
+		else if(zz < (1ULL << 16)) {
+			bw_put(bw, 6, 3);
+			bw_put(bw, zz, 16);
+		}
+		else if(zz < (1ULL << 32)) {
+			bw_put(bw, 14, 4);
+			bw_put(bw, zz, 32);
+		}
+		else {
+			bw_put(bw, 15, 4);
+			bw_put(bw, zz, 64);
+		}
+		prev_delta = delta;
+	}
+}
+
+static void dod_decode(BitReader *br, uint64_t first, uint64_t *out, uint32_t n)
+{
+	static const int width[] = {8, 16, 32, 64};
+	uint64_t delta = 0;
+	uint32_t i;
+
+	out[0] = first;
+	for(i = 1; i < n; i++) {
+		int k = 0;
+
+		while(k < 4 && br_get(br, 1)) {
+			k++;
+		}
+		if(k > 0) {
+			uint64_t zz = br_get(br, width[k == 4 ? 3 : k - 1]);
+
+			delta += (zz >> 1) ^ -(zz & 1);
+		}
+		out[i] = out[i - 1] + delta;
+	}
+}
+
+/* Trace writer */
+struct TraceWriter {
+	FILE *fp;
+	int format;
+	uint64_t steps;
+	/* Columnar chunk staging */
+	uint64_t *cols;
+	uint32_t fill;
+	TraceIndexEntry *index;
+	uint64_t nr_chunks;
+	BitWriter bw[2];
+};
+
+#define COL(buf, col)	((buf) + (size_t)(col) * TRACE_CHUNK_STEPS)
+
+TraceWriter *trace_writer_open(const char *path, int format)
+{
+	TraceWriter *tw;
+	TraceFileHeader hdr = {TRACE_MAGIC};
+
+	tw = calloc(1, sizeof(TraceWriter));
+	if((tw->fp = fopen(path, "wb")) == NULL) {
+		free(tw);
+		return NULL;
+	}
+	tw->format = format;
+	if(format == TRACE_FORMAT_COLUMNAR) {
+		tw->cols = malloc(sizeof(uint64_t) * TRACE_NR_COLUMNS * TRACE_CHUNK_STEPS);
+	}
+
+	hdr.version = htole32(FETCHER_VERSION);
+	hdr.chunk_steps = htole32(TRACE_CHUNK_STEPS);
+	hdr.format = htole16(format);
+	hdr.columns = htole16(TRACE_NR_COLUMNS);
+	fwrite(&hdr, sizeof(TraceFileHeader), 1, tw->fp);
+
+	return tw;
+}
+
+static int trace_writer_flush_chunk(TraceWriter *tw)
+{
+	TraceChunkHeader chdr;
+	TraceColumnDesc desc[TRACE_NR_COLUMNS];
+	BitWriter data = {0};
+	TraceIndexEntry *entry;
+	uint32_t n = tw->fill;
+	int col;
+
+	if(n == 0) {
+		return 0;
+	}
+
+	memset(desc, 0, sizeof(desc));
+	for(col = 0; col < TRACE_NR_COLUMNS; col++) {
+		const uint64_t *val = COL(tw->cols, col);
+		uint64_t min = val[0], max = val[0];
+		BitWriter *best;
+		uint32_t i;
+
+		for(i = 1; i < n; i++) {
+			min = val[i] < min ? val[i] : min;
+			max = val[i] > max ? val[i] : max;
+		}
+
+		desc[col].first = htole64(val[0]);
+		desc[col].min = htole64(min);
+		desc[col].max = htole64(max);
+		desc[col].offset = htole32(data.len);
+
+		if(min == max) {
+			desc[col].encoding = TRACE_ENC_CONST;
+			continue;
+		}
+
+		/* Encode both ways and keep the smaller stream */
+		tw->bw[0].len = 0;
+		tw->bw[1].len = 0;
+		xor_encode(&tw->bw[0], val, n);
+		bw_finish(&tw->bw[0]);
+		dod_encode(&tw->bw[1], val, n);
+		bw_finish(&tw->bw[1]);
+
+		if(tw->bw[0].len <= tw->bw[1].len) {
+			best = &tw->bw[0];
+			desc[col].encoding = TRACE_ENC_XOR;
+		}
+		else {
+			best = &tw->bw[1];
+			desc[col].encoding = TRACE_ENC_DOD;
+		}
+		desc[col].length = htole32(best->len);
+
+		if(data.len + best->len > data.cap) {
+			data.cap = (data.len + best->len) * 2;
+			data.buf = realloc(data.buf, data.cap);
+		}
+		memcpy(data.buf + data.len, best->buf, best->len);
+		data.len += best->len;
+	}
+
+	tw->index = realloc(tw->index, sizeof(TraceIndexEntry) * (tw->nr_chunks + 1));
+	entry = &tw->index[tw->nr_chunks++];
+	entry->offset = htole64(ftell(tw->fp));
+	entry->first_step = htole64(tw->steps - n);
+	entry->steps = htole32(n);
+	entry->reserved = 0;
+
+	chdr.first_step = entry->first_step;
+	chdr.steps = htole32(n);
+	chdr.length = htole32(data.len);
+	fwrite(&chdr, sizeof(TraceChunkHeader), 1, tw->fp);
+	fwrite(desc, sizeof(desc), 1, tw->fp);
+	if(data.len) {
+		fwrite(data.buf, data.len, 1, tw->fp);
+	}
+	free(data.buf);
+
+	tw->fill = 0;
+
+	return ferror(tw->fp) ? -1 : 0;
+}
+
+int trace_writer_append(TraceWriter *tw, const FetcherPacket *packet, uint64_t timestamp)
+{
+	int col;
+
+	tw->steps++;
+
+	if(tw->format == TRACE_FORMAT_RAW) {
+		struct {
+			FetcherHeader hdr;
+			FetcherWireRegs regs;
+		} __attribute__((packed)) msg;
+
+		msg.hdr.timestamp = htole64(timestamp);
+		msg.hdr.length = htole32(sizeof(FetcherWireRegs));
+		msg.hdr.type = htole16(FETCHER_MSG_REGS);
+		msg.hdr.version = FETCHER_VERSION;
+		msg.hdr.flags = 0;
+		fetcher_regs_pack(&msg.regs, packet);
+
+		return fwrite(&msg, sizeof(msg), 1, tw->fp) == 1 ? 0 : -1;
+	}
+
+	for(col = 0; col < TRACE_COL_TIMESTAMP; col++) {
+		COL(tw->cols, col)[tw->fill] = trace_packet_get(packet, col);
+	}
+	COL(tw->cols, TRACE_COL_TIMESTAMP)[tw->fill] = timestamp;
+
+	if(++tw->fill == TRACE_CHUNK_STEPS) {
+		return trace_writer_flush_chunk(tw);
+	}
+
+	return 0;
+}
+
+int trace_writer_close(TraceWriter *tw)
+{
+	int ret = 0;
+
+	if(tw->format == TRACE_FORMAT_COLUMNAR) {
+		TraceFileTrailer trailer = {0};
+
+		ret = trace_writer_flush_chunk(tw);
+
+		trailer.index_offset = htole64(ftell(tw->fp));
+		trailer.nr_chunks = htole64(tw->nr_chunks);
+		memcpy(trailer.magic, TRACE_INDEX_MAGIC, sizeof(trailer.magic));
+		if(tw->nr_chunks) {
+			fwrite(tw->index, sizeof(TraceIndexEntry), tw->nr_chunks, tw->fp);
+		}
+		fwrite(&trailer, sizeof(TraceFileTrailer), 1, tw->fp);
+	}
+
+	if(fclose(tw->fp)) {
+		ret = -1;
+	}
+	free(tw->cols);
+	free(tw->index);
+	free(tw->bw[0].buf);
+	free(tw->bw[1].buf);
+	free(tw);
+
+	return ret;
+}
+
+/* Trace reader */
+typedef struct TraceChunk {
+	uint64_t first_step;
+	uint32_t steps;
+	const TraceChunkHeader *hdr;
+} TraceChunk;
+
+struct TraceReader {
+	uint8_t *map;
+	size_t size;
+	int format;
+	uint64_t steps;
+	TraceChunk *chunks;
+	uint32_t nr_chunks;
+	/* Decoded chunk for trace_read() */
+	uint64_t *cache;
+	int64_t cached;
+};
+
+/* Bytes of the chunk at `offset`, 0 unless its header, column descriptors
+ * and column data lie inside the file and it holds 1 to TRACE_CHUNK_STEPS
+ * steps
+ */
+static uint64_t trace_chunk_size(const TraceReader *tr, uint64_t offset)
+{
+	const TraceChunkHeader *hdr;
+	uint64_t size = sizeof(TraceChunkHeader) + sizeof(TraceColumnDesc) * TRACE_NR_COLUMNS;
+	uint32_t steps;
+
+	if(offset < sizeof(TraceFileHeader) || offset > tr->size || tr->size - offset < size) {
+		return 0;
+	}
+	hdr = (const TraceChunkHeader *)(tr->map + offset);
+	steps = le32toh(hdr->steps);
+	if(steps == 0 || steps > TRACE_CHUNK_STEPS || le32toh(hdr->length) > tr->size - offset - size) {
+		return 0;
+	}
+
+	return size + le32toh(hdr->length);
+}
+
+static int trace_reader_index(TraceReader *tr)
+{
+	const TraceFileTrailer *trailer;
+	const TraceChunkHeader *hdr;
+	uint64_t offset = sizeof(TraceFileHeader), size;
+	uint32_t i;
+
+	/* Fast path, use the chunk index written by trace_writer_close() */
+	trailer = (const TraceFileTrailer *)(tr->map + tr->size - sizeof(TraceFileTrailer));
+	if(tr->size >= sizeof(TraceFileHeader) + sizeof(TraceFileTrailer)
+	   && !memcmp(trailer->magic, TRACE_INDEX_MAGIC, sizeof(trailer->magic))) {
+		const TraceIndexEntry *index;
+		uint64_t nr = le64toh(trailer->nr_chunks);
+		uint64_t limit = tr->size - sizeof(TraceFileTrailer);
+
+		/* Nothing in the index is trusted, a bad entry rejects the file */
+		offset = le64toh(trailer->index_offset);
+		if(offset > limit || nr > (limit - offset) / sizeof(TraceIndexEntry)) {
+			return -1;
+		}
+		index = (const TraceIndexEntry *)(tr->map + offset);
+		if((tr->chunks = calloc(nr ? nr : 1, sizeof(TraceChunk))) == NULL) {
+			return -1;
+		}
+		for(i = 0; i < nr; i++) {
+			if(trace_chunk_size(tr, le64toh(index[i].offset)) == 0) {
+				return -1;
+			}
+			hdr = (const TraceChunkHeader *)(tr->map + le64toh(index[i].offset));
+			/* Steps follow on from chunk to chunk, trace_read() relies on it */
+			if(le32toh(index[i].steps) != le32toh(hdr->steps)
+			   || le64toh(index[i].first_step) != tr->steps) {
+				return -1;
+			}
+			tr->chunks[i].hdr = hdr;
+			tr->chunks[i].first_step = tr->steps;
+			tr->chunks[i].steps = le32toh(hdr->steps);
+			tr->steps += tr->chunks[i].steps;
+		}
+		tr->nr_chunks = nr;
+		return 0;
+	}
+
+	/* Recording was interrupted, walk the chunks */
+	while((size = trace_chunk_size(tr, offset)) != 0) {
+		hdr = (const TraceChunkHeader *)(tr->map + offset);
+		if(le64toh(hdr->first_step) != tr->steps) {
+			break;
+		}
+		tr->chunks = realloc(tr->chunks, sizeof(TraceChunk) * (tr->nr_chunks + 1));
+		tr->chunks[tr->nr_chunks].hdr = hdr;
+		tr->chunks[tr->nr_chunks].first_step = tr->steps;
+		tr->chunks[tr->nr_chunks].steps = le32toh(hdr->steps);
+		tr->steps += le32toh(hdr->steps);
+		tr->nr_chunks++;
+		offset += size;
+	}
+
+	return 0;
+}
+
+TraceReader *trace_reader_open(const char *path)
+{
+	TraceReader *tr;
+	const TraceFileHeader *hdr;
+	struct stat st;
+	int fd;
+
+	if((fd = open(path, O_RDONLY)) < 0) {
+		return NULL;
+	}
+	if(fstat(fd, &st) < 0 || st.st_size < sizeof(TraceFileHeader)) {
+		close(fd);
+		return NULL;
+	}
+
+	tr = calloc(1, sizeof(TraceReader));
+	tr->size = st.st_size;
+	tr->map = mmap(NULL, tr->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(tr->map == MAP_FAILED) {
+		free(tr);
+		return NULL;
+	}
+
+	hdr = (const TraceFileHeader *)tr->map;
+	if(memcmp(hdr->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC))
+	   || le32toh(hdr->version) != FETCHER_VERSION
+	   || le32toh(hdr->chunk_steps) != TRACE_CHUNK_STEPS
+	   || le16toh(hdr->columns) != TRACE_NR_COLUMNS) {
+		trace_reader_close(tr);
+		return NULL;
+	}
+
+	tr->format = le16toh(hdr->format);
+	tr->cached = -1;
+	if(tr->format == TRACE_FORMAT_RAW) {
+		tr->steps = (tr->size - sizeof(TraceFileHeader)) / RAW_RECORD_SIZE;
+		tr->nr_chunks = (tr->steps + TRACE_CHUNK_STEPS - 1) / TRACE_CHUNK_STEPS;
+	}
+	else if(tr->format != TRACE_FORMAT_COLUMNAR || trace_reader_index(tr) < 0) {
+		trace_reader_close(tr);
+		return NULL;
+	}
+
+	return tr;
+}
+
+void trace_reader_close(TraceReader *tr)
+{
+	munmap(tr->map, tr->size);
+	free(tr->chunks);
+	free(tr->cache);
+	free(tr);
+}
+
+int trace_format(const TraceReader *tr)
+{
+	return tr->format;
+}
+
+uint64_t trace_steps(const TraceReader *tr)
+{
+	return tr->steps;
+}
+
+uint32_t trace_nr_chunks(const TraceReader *tr)
+{
+	return tr->nr_chunks;
+}
+
+void trace_chunk_info(const TraceReader *tr, uint32_t chunk, uint64_t *first_step, uint32_t *steps)
+{
+	if(tr->format == TRACE_FORMAT_RAW) {
+		*first_step = (uint64_t)chunk * TRACE_CHUNK_STEPS;
+		*steps = tr->steps - *first_step < TRACE_CHUNK_STEPS ? tr->steps - *first_step : TRACE_CHUNK_STEPS;
+		return;
+	}
+	*first_step = tr->chunks[chunk].first_step;
+	*steps = tr->chunks[chunk].steps;
+}
+
+static const TraceColumnDesc *trace_chunk_desc(const TraceReader *tr, uint32_t chunk, int col)
+{
+	return (const TraceColumnDesc *)(tr->chunks[chunk].hdr + 1) + col;
+}
+
+/* Chunk min/max of a column, only the columnar format keeps it.
+ * Return 0 if the range is known.
+ */
+int trace_chunk_range(const TraceReader *tr, uint32_t chunk, int col, uint64_t *min, uint64_t *max)
+{
+	const TraceColumnDesc *desc;
+
+	if(tr->format != TRACE_FORMAT_COLUMNAR) {
+		return -1;
+	}
+	desc = trace_chunk_desc(tr, chunk, col);
+	*min = le64toh(desc->min);
+	*max = le64toh(desc->max);
+	return 0;
+}
+
+static const uint8_t *raw_record(const TraceReader *tr, uint64_t step)
+{
+	return tr->map + sizeof(TraceFileHeader) + step * RAW_RECORD_SIZE;
+}
+
+static uint64_t raw_column(const uint8_t *rec, int col)
+{
+	const FetcherWireRegs *regs = (const FetcherWireRegs *)(rec + sizeof(FetcherHeader));
+
+	if(col == TRACE_COL_TIMESTAMP) {
+		return le64toh(((const FetcherHeader *)rec)->timestamp);
+	}
+	if(col < FETCHER_NR_REG64) {
+		return le64toh(regs->r64[col]);
+	}
+	return le32toh(regs->r32[col - FETCHER_NR_REG64]);
+}
+
+/* Decode one column of a chunk into out[steps] */
+int trace_chunk_column(const TraceReader *tr, uint32_t chunk, int col, uint64_t *out)
+{
+	const TraceChunkHeader *hdr;
+	const TraceColumnDesc *desc;
+	const uint8_t *data;
+	BitReader br = {0};
+	uint64_t first_step;
+	uint32_t steps, i;
+
+	if(chunk >= tr->nr_chunks || col < 0 || col >= TRACE_NR_COLUMNS) {
+		return -1;
+	}
+
+	trace_chunk_info(tr, chunk, &first_step, &steps);
+
+	if(tr->format == TRACE_FORMAT_RAW) {
+		for(i = 0; i < steps; i++) {
+			out[i] = raw_column(raw_record(tr, first_step + i), col);
+		}
+		return 0;
+	}
+
+	hdr = tr->chunks[chunk].hdr;
+	desc = trace_chunk_desc(tr, chunk, col);
+	data = (const uint8_t *)((const TraceColumnDesc *)(hdr + 1) + TRACE_NR_COLUMNS);
+	if((uint64_t)le32toh(desc->offset) + le32toh(desc->length) > le32toh(hdr->length)) {
+		return -1;
+	}
+	br.p = data + le32toh(desc->offset);
+	br.end = br.p + le32toh(desc->length);
+
+	switch(desc->encoding) {
+	case TRACE_ENC_CONST:
+		for(i = 0; i < steps; i++) {
+			out[i] = le64toh(desc->first);
+		}
+		break;
+	case TRACE_ENC_XOR:
+		xor_decode(&br, le64toh(desc->first), out, steps);
+		break;
+	case TRACE_ENC_DOD:
+		dod_decode(&br, le64toh(desc->first), out, steps);
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Random access to one step */
+int trace_read(TraceReader *tr, uint64_t step, FetcherPacket *packet, uint64_t *timestamp)
+{
+	uint32_t chunk, row;
+	int col;
+
+	if(step >= tr->steps) {
+		return -1;
+	}
+
+	if(tr->format == TRACE_FORMAT_RAW) {
+		const uint8_t *rec = raw_record(tr, step);
+
+		fetcher_regs_unpack(packet, (const FetcherWireRegs *)(rec + sizeof(FetcherHeader)));
+		if(timestamp) {
+			*timestamp = raw_column(rec, TRACE_COL_TIMESTAMP);
+		}
+		return 0;
+	}
+
+	/* Chunks are in step order, binary search the one holding `step` */
+	{
+		uint32_t lo = 0, hi = tr->nr_chunks;
+
+		while(hi - lo > 1) {
+			uint32_t mid = (lo + hi) / 2;
+
+			if(tr->chunks[mid].first_step <= step) {
+				lo = mid;
+			}
+			else {
+				hi = mid;
+			}
+		}
+		chunk = lo;
+	}
+
+	if(tr->cached != chunk) {
+		if(tr->cache == NULL) {
+			tr->cache = malloc(sizeof(uint64_t) * TRACE_NR_COLUMNS * TRACE_CHUNK_STEPS);
+		}
+		for(col = 0; col < TRACE_NR_COLUMNS; col++) {
+			if(trace_chunk_column(tr, chunk, col, COL(tr->cache, col)) < 0) {
+				tr->cached = -1;
+				return -1;
+			}
+		}
+		tr->cached = chunk;
+	}
+
+	row = step - tr->chunks[chunk].first_step;
+	for(col = 0; col < TRACE_COL_TIMESTAMP; col++) {
+		trace_packet_set(packet, col, COL(tr->cache, col)[row]);
+	}
+	if(timestamp) {
+		*timestamp = COL(tr->cache, TRACE_COL_TIMESTAMP)[row];
+	}
+
+	return 0;
+}
+
+/* Session recorder
+ * Started and stopped from the prompt thread, fed from the receive thread.
+ */
+static pthread_mutex_t record_mutex = PTHREAD_MUTEX_INITIALIZER;
+static TraceWriter *recorder;
+
+int record_start(const char *path, int format)
+{
+	TraceWriter *tw;
+
+	if((tw = trace_writer_open(path, format)) == NULL) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&record_mutex);
+	if(recorder) {
+		trace_writer_close(recorder);
+	}
+	recorder = tw;
+	pthread_mutex_unlock(&record_mutex);
+
+	return 0;
+}
+
+void record_packet(const FetcherPacket *packet, uint64_t timestamp)
+{
+	pthread_mutex_lock(&record_mutex);
+	if(recorder) {
+		trace_writer_append(recorder, packet, timestamp);
+	}
+	pthread_mutex_unlock(&record_mutex);
+}
+
+int record_stop(void)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&record_mutex);
+	if(recorder) {
+		ret = trace_writer_close(recorder);
+		recorder = NULL;
+	}
+	pthread_mutex_unlock(&record_mutex);
+
+	return ret;
+}
+
+int record_active(void)
+{
+	return recorder != NULL;
+}
@@ -0,0 +1,452 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "track.h"
+#include "arena.h"
+#include "guestmem.h"
+#include "mmu.h"
+
+#define PAGE_NONE		UINT32_MAX /* not readable in that packet */
+#define STORE_MIN_BUCKETS	1024
+
+/* Content of a region from `step` on, its pages are ids[first..] */
+typedef struct TrackVersion {
+	uint64_t step;
+	uint64_t addr;
+	uint32_t first;
+	uint32_t nr_pages;
+} TrackVersion;
+
+typedef struct TrackRegion {
+	int id;
+	char name[64];
+	const ARMCPRegInfo *reg; /* NULL for a physical address */
+	uint64_t addr;
+	uint64_t length;
+	TrackVersion *versions;
+	uint32_t nr_versions, versions_size;
+	uint32_t *ids; /* page ids of every version */
+	uint32_t nr_ids, ids_size;
+	struct TrackRegion *next;
+} TrackRegion;
+
+/* The receive thread updates while the prompt thread adds and shows */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static TrackRegion *regions;
+static int nr_regions, next_id = 1;
+
+/* Page store, pages are never freed before track_reset() */
+static Arena arena = ARENA_INIT(1024 * 1024);
+static uint8_t **pages;
+static uint64_t *hashes;
+static uint32_t nr_pages, pages_size;
+/* Open addressing on the hash, page id + 1, 0 is empty */
+static uint32_t *buckets;
+static uint32_t nr_buckets;
+
+/* xxHash64 of one page, the four lanes of the main loop are one vector */
+typedef uint64_t u64x4 __attribute__((vector_size(32)));
+
+#define XXH_PRIME1	0x9E3779B185EBCA87ULL
+#define XXH_PRIME2	0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME3	0x165667B19E3779F9ULL
+#define XXH_PRIME4	0x85EBCA77C2B2AE63ULL
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t xxh_merge(uint64_t h, uint64_t lane)
+{
+	lane *= XXH_PRIME2;
+	lane = rotl64(lane, 31) * XXH_PRIME1;
+
+	return (h ^ lane) * XXH_PRIME1 + XXH_PRIME4;
+}
+
+static uint64_t page_hash(const uint8_t *page)
+{
+	u64x4 acc = { XXH_PRIME1 + XXH_PRIME2, XXH_PRIME2, 0, -XXH_PRIME1 }, in;
+	uint64_t h;
+	int i;
+
+	for(i = 0; i < TRACK_PAGE_SIZE; i += sizeof(u64x4)) {
+		memcpy(&in, page + i, sizeof(u64x4));
+		acc += in * XXH_PRIME2;
+		acc = (acc << 31) | (acc >> 33);
+		acc *= XXH_PRIME1;
+	}
+
+	h = rotl64(acc[0], 1) + rotl64(acc[1], 7) + rotl64(acc[2], 12) + rotl64(acc[3], 18);
+	for(i = 0; i < 4; i++) {
+		h = xxh_merge(h, acc[i]);
+	}
+	h += TRACK_PAGE_SIZE;
+
+	h ^= h >> 33;
+	h *= XXH_PRIME2;
+	h ^= h >> 29;
+	h *= XXH_PRIME3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+static int store_grow(void)
+{
+	uint32_t size = nr_buckets ? nr_buckets * 2 : STORE_MIN_BUCKETS, i, b;
+	uint32_t *p;
+
+	if((p = calloc(size, sizeof(uint32_t))) == NULL) {
+		return -1;
+	}
+	for(i = 0; i < nr_pages; i++) {
+		for(b = hashes[i] & (size - 1); p[b]; b = (b + 1) & (size - 1));
+		p[b] = i + 1;
+	}
+	free(buckets);
+	buckets = p;
+	nr_buckets = size;
+
+	return 0;
+}
+
+/* Id of a page with this content, stored on first sight. The hash finds
+ * the candidates, the content decides, a collision is stored apart.
+ */
+static uint32_t store_intern(const uint8_t *page, uint64_t hash)
+{
+	uint32_t b, size;
+	uint8_t *copy;
+	void *p;
+
+	if(nr_buckets) {
+		for(b = hash & (nr_buckets - 1); buckets[b]; b = (b + 1) & (nr_buckets - 1)) {
+			if(hashes[buckets[b] - 1] == hash && !memcmp(pages[buckets[b] - 1], page, TRACK_PAGE_SIZE)) {
+				return buckets[b] - 1;
+			}
+		}
+	}
+
+	if(nr_pages >= nr_buckets / 2 && store_grow() < 0) {
+		return PAGE_NONE;
+	}
+	if(nr_pages == pages_size) {
+		size = pages_size ? pages_size * 2 : STORE_MIN_BUCKETS;
+		if((p = realloc(pages, size * sizeof(uint8_t *))) == NULL) {
+			return PAGE_NONE;
+		}
+		pages = p;
+		if((p = realloc(hashes, size * sizeof(uint64_t))) == NULL) {
+			return PAGE_NONE;
+		}
+		hashes = p;
+		pages_size = size;
+	}
+	if((copy = arena_alloc(&arena, TRACK_PAGE_SIZE)) == NULL) {
+		return PAGE_NONE;
+	}
+	memcpy(copy, page, TRACK_PAGE_SIZE);
+	pages[nr_pages] = copy;
+	hashes[nr_pages] = hash;
+
+	for(b = hash & (nr_buckets - 1); buckets[b]; b = (b + 1) & (nr_buckets - 1));
+	buckets[b] = nr_pages + 1;
+
+	return nr_pages++;
+}
+
+static void region_free(TrackRegion *r)
+{
+	free(r->versions);
+	free(r->ids);
+	free(r);
+}
+
+int track_add(const char *name, const ARMCPRegInfo *reg, uint64_t addr, uint64_t length)
+{
+	TrackRegion *r, **pp;
+	int id;
+
+	if(length == 0 || length > TRACK_MAX_LENGTH || (r = calloc(1, sizeof(TrackRegion))) == NULL) {
+		return -1;
+	}
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	r->reg = reg;
+	r->addr = addr;
+	r->length = length;
+
+	pthread_mutex_lock(&lock);
+	id = r->id = next_id++;
+	for(pp = &regions; *pp; pp = &(*pp)->next);
+	*pp = r;
+	__atomic_store_n(&nr_regions, nr_regions + 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&lock);
+
+	return id;
+}
+
+int track_remove(int id)
+{
+	TrackRegion *r, **pp;
+
+	pthread_mutex_lock(&lock);
+	for(pp = &regions; (r = *pp) != NULL; pp = &r->next) {
+		if(r->id == id) {
+			*pp = r->next;
+			__atomic_store_n(&nr_regions, nr_regions - 1, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&lock);
+			region_free(r);
+			return 0;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	return -1;
+}
+
+void track_reset(void)
+{
+	TrackRegion *r;
+
+	pthread_mutex_lock(&lock);
+	while((r = regions) != NULL) {
+		regions = r->next;
+		region_free(r);
+	}
+	nr_regions = 0;
+	next_id = 1;
+	arena_free(&arena);
+	free(pages);
+	free(hashes);
+	free(buckets);
+	pages = NULL;
+	hashes = NULL;
+	buckets = NULL;
+	nr_pages = pages_size = nr_buckets = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+static int region_reserve(TrackRegion *r, uint32_t nr_ids)
+{
+	TrackVersion *v;
+	uint32_t *ids, size;
+
+	if(r->nr_versions == r->versions_size) {
+		size = r->versions_size ? r->versions_size * 2 : 16;
+		if((v = realloc(r->versions, size * sizeof(TrackVersion))) == NULL) {
+			return -1;
+		}
+		r->versions = v;
+		r->versions_size = size;
+	}
+	if(r->nr_ids + nr_ids > r->ids_size) {
+		for(size = r->ids_size ? r->ids_size : 64; size < r->nr_ids + nr_ids; size *= 2);
+		if((ids = realloc(r->ids, size * sizeof(uint32_t))) == NULL) {
+			return -1;
+		}
+		r->ids = ids;
+		r->ids_size = size;
+	}
+
+	return 0;
+}
+
+/* Read the pages of `r` and add a version if any of them changed */
+static void region_update(TrackRegion *r, uint64_t step, const FetcherPacket *packet, const MMUContext *ctx)
+{
+	static uint8_t page[TRACK_PAGE_SIZE];
+	const TrackVersion *last;
+	TrackVersion *v;
+	uint64_t addr = r->addr, base;
+	uint32_t n, i, id;
+	int changed;
+
+	if(r->reg && arm_cp_read(r->reg, packet, &addr) < 0) {
+		return;
+	}
+	base = addr & ~(uint64_t)(TRACK_PAGE_SIZE - 1);
+	n = (addr + r->length - base + TRACK_PAGE_SIZE - 1) / TRACK_PAGE_SIZE;
+	if(region_reserve(r, n) < 0) {
+		return;
+	}
+	last = r->nr_versions ? &r->versions[r->nr_versions - 1] : NULL;
+
+	/* New ids go after the last version, they are only kept if it differs */
+	changed = last == NULL || last->addr != addr || last->nr_pages != n;
+	for(i = 0; i < n; i++) {
+		if((r->reg ? mmu_read(ctx, base + i * TRACK_PAGE_SIZE, page, TRACK_PAGE_SIZE)
+		           : guest_mem_read(base + i * TRACK_PAGE_SIZE, page, TRACK_PAGE_SIZE)) < 0) {
+			id = PAGE_NONE;
+		}
+		else {
+			id = store_intern(page, page_hash(page));
+		}
+		r->ids[r->nr_ids + i] = id;
+		if(!changed && r->ids[last->first + i] != id) {
+			changed = 1;
+		}
+	}
+	if(!changed) {
+		return;
+	}
+
+	v = &r->versions[r->nr_versions++];
+	v->step = step;
+	v->addr = addr;
+	v->first = r->nr_ids;
+	v->nr_pages = n;
+	r->nr_ids += n;
+}
+
+void track_update(uint64_t step, const FetcherPacket *packet)
+{
+	TrackRegion *r;
+	MMUContext ctx;
+
+	if(__atomic_load_n(&nr_regions, __ATOMIC_RELAXED) == 0) {
+		return;
+	}
+
+	mmu_context(&ctx, packet);
+	pthread_mutex_lock(&lock);
+	for(r = regions; r != NULL; r = r->next) {
+		region_update(r, step, packet, &ctx);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+static TrackRegion *region_find(int id)
+{
+	TrackRegion *r;
+
+	for(r = regions; r != NULL && r->id != id; r = r->next);
+
+	return r;
+}
+
+void track_list(void (*out)(const char *))
+{
+	TrackRegion *r;
+	char str[256];
+	uint64_t bytes = 0;
+
+	pthread_mutex_lock(&lock);
+	for(r = regions; r != NULL; r = r->next) {
+		snprintf(str, sizeof(str), "%d: %s, %lu bytes, %u version%s\n", r->id, r->name, r->length,
+		         r->nr_versions, r->nr_versions == 1 ? "" : "s");
+		out(str);
+		bytes += (uint64_t)r->nr_ids * sizeof(uint32_t) + r->nr_versions * sizeof(TrackVersion);
+	}
+	if(regions == NULL) {
+		out("No tracked memory\n");
+	}
+	else {
+		snprintf(str, sizeof(str), "%u distinct page%s stored, %lu KiB\n", nr_pages, nr_pages == 1 ? "" : "s",
+		         ((uint64_t)nr_pages * TRACK_PAGE_SIZE + bytes) >> 10);
+		out(str);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+int track_history(int id, void (*out)(const char *))
+{
+	TrackRegion *r;
+	const TrackVersion *v, *prev;
+	char str[128];
+	uint32_t i, j, changed;
+
+	pthread_mutex_lock(&lock);
+	if((r = region_find(id)) == NULL) {
+		pthread_mutex_unlock(&lock);
+		return -1;
+	}
+	for(i = 0; i < r->nr_versions; i++) {
+		v = &r->versions[i];
+		prev = i ? &r->versions[i - 1] : NULL;
+		if(prev == NULL || prev->addr != v->addr || prev->nr_pages != v->nr_pages) {
+			snprintf(str, sizeof(str), "packet %lu: 0x%lx, %u page%s\n", v->step, v->addr, v->nr_pages,
+			         v->nr_pages == 1 ? "" : "s");
+		}
+		else {
+			for(j = 0, changed = 0; j < v->nr_pages; j++) {
+				changed += r->ids[v->first + j] != r->ids[prev->first + j];
+			}
+			snprintf(str, sizeof(str), "packet %lu: %u page%s changed\n", v->step, changed, changed == 1 ? "" : "s");
+		}
+		out(str);
+	}
+	if(r->nr_versions == 0) {
+		out("Not read yet\n");
+	}
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
+
+/* What guest_mem_examine() reads through show_read(), the lock is held */
+typedef struct {
+	const TrackRegion *region;
+	const TrackVersion *version;
+} TrackShow;
+
+static int show_read(const void *arg, uint64_t addr, void *buf, size_t len)
+{
+	const TrackRegion *show_region = ((const TrackShow *)arg)->region;
+	const TrackVersion *v = ((const TrackShow *)arg)->version;
+	uint8_t *dst = buf;
+	uint64_t base = v->addr & ~(uint64_t)(TRACK_PAGE_SIZE - 1), offset;
+	uint32_t id;
+
+	if(addr < v->addr || addr + len > v->addr + show_region->length) {
+		return -1;
+	}
+	for(; len > 0; len--, addr++) {
+		offset = addr - base;
+		if((id = show_region->ids[v->first + offset / TRACK_PAGE_SIZE]) == PAGE_NONE) {
+			return -1;
+		}
+		*dst++ = pages[id][offset % TRACK_PAGE_SIZE];
+	}
+
+	return 0;
+}
+
+int track_show(int id, uint64_t step, int count, char format, int unit, void (*out)(const char *))
+{
+	TrackRegion *r;
+	TrackShow show;
+	char str[128];
+	uint32_t lo = 0, hi, mid;
+
+	pthread_mutex_lock(&lock);
+	if((r = region_find(id)) == NULL || r->nr_versions == 0 || r->versions[0].step > step) {
+		pthread_mutex_unlock(&lock);
+		return -1;
+	}
+
+	/* Last version at or before `step` */
+	for(hi = r->nr_versions; lo + 1 < hi;) {
+		mid = (lo + hi) / 2;
+		if(r->versions[mid].step <= step) {
+			lo = mid;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	show.region = r;
+	show.version = &r->versions[lo];
+	snprintf(str, sizeof(str), "%s as of packet %lu\n", r->name, show.version->step);
+	out(str);
+	if(count <= 0 && (count = r->length / unit) == 0) {
+		count = 1;
+	}
+	guest_mem_examine(show.version->addr, count, format, unit, show_read, &show, out);
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
@@ -5,6 +5,8 @@
 
 #include "types.h"
 #include "ui.h"
+#include "command.h"
+#include "format.h"
 
 #define CONSOLE_LINES	15
 #define CONSOLE_COLS	COLS
@@ -14,35 +16,18 @@
 #define DISPLAY_X	0
 #define CONSOLE_Y	(DISPLAY_Y + DISPLAY_LINES)
 #define CONSOLE_X	0
+/* Rows and columns of displays inside the border */
+#define DISPLAY_CELL_COLS	72
+#define DISPLAY_NAME_COLS	23
+#define DISPLAY_VALUE_X		(DISPLAY_NAME_COLS + 9)
+#define DISPLAY_ROWS		(DISPLAY_LINES - 2)
+#define DISPLAY_COLUMNS		((DISPLAY_COLS - 2) / DISPLAY_CELL_COLS > 1 ? (DISPLAY_COLS - 2) / DISPLAY_CELL_COLS : 1)
+#define DISPLAY_CELL_WIDTH	((DISPLAY_COLS - 2) / DISPLAY_COLUMNS)
 
-#define MAX_LINE_WORDS	128
-
-extern ARMCPRegArray reg_array[14];
 /* Global Variables */
-HookRegisters *hook_head;
-FetcherPacket prev_packet;
-
-/* Command prototype */
-static void cmd_display(int argc, char *argv[]);
-static void cmd_undisplay(int argc, char *argv[]);
-static void cmd_print(int argc, char *argv[]);
-static void cmd_store(int argc, char *argv[]);
-static void cmd_load(int argc, char *argv[]);
-static void cmd_refresh(int argc, char *argv[]);
-static void cmd_quit(int argc, char *argv[]);
-static void cmd_help(int argc, char *argv[]);
-
-/* Command array */
-static CMDDefinition cmd[] = {
-	{.name = "display", .handler = cmd_display, .desc = "Display a register. -> display $register_name[end_bit:start_bit]"},
-	{.name = "undisplay", .handler = cmd_undisplay, .desc = "Undisplay a register. -> undisplay display_number"},
-	{.name = "print", .handler = cmd_print, .desc = "Print a register value. -> print /x $register_name[end_bit:start_bit]"},
-	{.name = "store", .handler = cmd_store, .desc = "Store display register list. -> store file_name"},
-	{.name = "load", .handler = cmd_load, .desc = "Load command script. -> load file_name"},
-	{.name = "refresh", .handler = cmd_refresh, .desc = "Refresh display register window."},
-	{.name = "quit", .handler = cmd_quit, .desc = "Terminate qemu-monitor."},
-	{.name = "help", .handler = cmd_help, .desc = "Show this help guide."},
-};
+static FetcherPacket prev_packet;
+/* First display row in the window, and the displays of the last update */
+static int display_top, display_total;
 
 static void console_putc(char c);
 
@@ -55,6 +40,10 @@ static void console_putc(char c);
 
 /* Display Design
  * Show display registers.
+ * The window is a view of the filtered display list, laid out in as many
+ * DISPLAY_CELL_COLS wide columns as the terminal holds, row by row. Only
+ * the displays inside the view are read and formatted, the rest are just
+ * counted, so a long list costs no more than a screenful.
  */
 WINDOW *display_win;
 static void display_init()
@@ -86,51 +75,66 @@ void display_status(int toggle)
 		mvwprintw(display_win, DISPLAY_LINES - 1, DISPLAY_X + 1, "Disconnected");
 	}
 	wattroff(display_win, A_BOLD);
+	/* Position in the list when it does not fit */
+	if(display_total > DISPLAY_ROWS * DISPLAY_COLUMNS) {
+		mvwprintw(display_win, DISPLAY_LINES - 1, DISPLAY_COLS - 24, " %d-%d of %d ",
+		          display_top * DISPLAY_COLUMNS + 1,
+		          display_top * DISPLAY_COLUMNS + DISPLAY_ROWS * DISPLAY_COLUMNS < display_total ?
+		          display_top * DISPLAY_COLUMNS + DISPLAY_ROWS * DISPLAY_COLUMNS : display_total,
+		          display_total);
+	}
 
 	wrefresh(display_win);
 
 	console_putc('\0');
 }
 
+/* One register a cell, changed values are highlighted */
+static void display_hook(const HookRegisters *it, int index, void *arg)
+{
+	const FetcherPacket *packet = arg;
+	int y = DISPLAY_Y + 1 + index / DISPLAY_COLUMNS;
+	int x = DISPLAY_X + 1 + index % DISPLAY_COLUMNS * DISPLAY_CELL_WIDTH;
+	uint64_t value, prev;
+	char str[128], head[FORMAT_MAX_DIGITS + DISPLAY_NAME_COLS + 8];
+	int n, len;
+
+	/* "%4d: %-23.23s = " */
+	n = format_udec_width(head, it->id, 4);
+	head[n++] = ':';
+	head[n++] = ' ';
+	len = strnlen(it->name, DISPLAY_NAME_COLS);
+	memcpy(head + n, it->name, len);
+	n += format_pad(head + n, len, DISPLAY_NAME_COLS);
+	memcpy(head + n, " = ", 3);
+	mvwaddnstr(display_win, y, x, head, n + 3);
+	command_hook_format(it, packet, str, sizeof(str));
+	if(command_hook_read(it, packet, &value) == 0 && command_hook_read(it, &prev_packet, &prev) == 0
+	   && value != prev) {
+		wattron(display_win, A_BOLD | A_UNDERLINE);
+	}
+	/* Keep a blank column before the next cell */
+	if(DISPLAY_CELL_WIDTH - DISPLAY_VALUE_X - 1 > 0) {
+		mvwaddnstr(display_win, y, x + DISPLAY_VALUE_X, str, DISPLAY_CELL_WIDTH - DISPLAY_VALUE_X - 1);
+	}
+	wattroff(display_win, A_BOLD | A_UNDERLINE);
+}
+
 void display_update(FetcherPacket packet)
 {
-	HookRegisters *it;
-	int y = DISPLAY_Y + 1, x = DISPLAY_X + 1;
+	int rows;
 
-	wclear(display_win);
+	werase(display_win);
 	box(display_win, 0, 0);
 
-	for(it = hook_head; it != NULL; it = it->next) {
-		mvwprintw(display_win, y, x, "%d: %-23s = ", it->id, it->name);
-		x += 30;
-		switch(it->type) {
-		case ARM_CP_UNIMPL:
-			mvwprintw(display_win, y, x, "UNIMPLEMENTED");
-			break;
-		case ARM_CP_CONST:
-			mvwprintw(display_win, y, x, "0x%lx", it->const_value);
-			break;
-		case ARM_CP_NORMAL_L:
-			if((*(uint32_t *)((uint8_t *)(&packet) + it->fieldoffset) & it->mask)
-			   != (*(uint32_t *)((uint8_t *)(&prev_packet) + it->fieldoffset) & it->mask)) {
-				wattron(display_win, A_BOLD | A_UNDERLINE);
-			}
-			mvwprintw(display_win, y, x, "0x%x",
-			          (*(uint32_t *)((uint8_t *)(&packet) + it->fieldoffset) & it->mask) >> it->start_bit);
-			wattroff(display_win, A_BOLD | A_UNDERLINE);
-			break;
-		case ARM_CP_NORMAL_H:
-			if((*(uint64_t *)((uint8_t *)(&packet) + it->fieldoffset) & it->mask)
-			   != (*(uint64_t *)((uint8_t *)(&prev_packet) + it->fieldoffset) & it->mask)) {
-				wattron(display_win, A_BOLD | A_UNDERLINE);
-			}
-			mvwprintw(display_win, y, x, "0x%lx",
-			          (*(uint64_t *)((uint8_t *)(&packet) + it->fieldoffset) & it->mask) >> it->start_bit);
-			wattroff(display_win, A_BOLD | A_UNDERLINE);
-			break;
-		}
-		y++;
-		x = DISPLAY_X + 1;
+	display_total = command_for_each_visible_hook(display_top * DISPLAY_COLUMNS, DISPLAY_ROWS * DISPLAY_COLUMNS,
+	                                              display_hook, &packet);
+	/* The list shrank under the view, show its end */
+	rows = (display_total + DISPLAY_COLUMNS - 1) / DISPLAY_COLUMNS;
+	if(display_top > 0 && display_top + DISPLAY_ROWS > rows) {
+		display_top = rows > DISPLAY_ROWS ? rows - DISPLAY_ROWS : 0;
+		display_total = command_for_each_visible_hook(display_top * DISPLAY_COLUMNS,
+		                                              DISPLAY_ROWS * DISPLAY_COLUMNS, display_hook, &packet);
 	}
 
 	memcpy(&prev_packet, &packet, sizeof(FetcherPacket));
@@ -142,34 +146,52 @@ void display_update(FetcherPacket packet)
 	console_putc('\0');
 }
 
-/* Free dynamic allocate memory */
-static void display_destructor(void)
+static void display_show(const FetcherPacket *packet)
 {
-	HookRegisters *it, *pre;
+	display_update(*packet);
+}
 
-	/* Do not have hook register */
-	if(hook_head == NULL) {
-		return;
-	}
+static void display_changed(void)
+{
+	display_update(prev_packet);
+}
 
-	pre = hook_head;
-	it = hook_head->next;
-	while(pre) {
-		free(pre);
-		pre = it;
-		if(it) {
-			it = it->next;
-		}
+/* Scroll by display rows, clamped in display_update() */
+static void display_scroll(int lines)
+{
+	display_top += lines;
+	if(display_top < 0) {
+		display_top = 0;
 	}
+	display_update(prev_packet);
 }
 
 /* Console Design
  * We need to handle console ourself. Try to make it like normal stdout act.
  * Provide some API for programmer use:
  *    * putc - put a character on console
+ * Output goes into a ring of the last CONSOLE_HISTORY lines and the window
+ * shows its end, or an older page while scrolled back with PageUp. Nothing
+ * waits for the user, so a burst of output never holds the receive thread.
  */
+#define CONSOLE_HISTORY		1024
+#define CONSOLE_LINE_MAX	256
+#define CONSOLE_WIDTH		(CONSOLE_COLS < CONSOLE_LINE_MAX ? CONSOLE_COLS : CONSOLE_LINE_MAX)
+
+typedef struct ConsoleLine {
+	char text[CONSOLE_LINE_MAX];
+	int len;
+} ConsoleLine;
+
 WINDOW *console_win;
 pthread_mutex_t mutex;
+static ConsoleLine history[CONSOLE_HISTORY];
+/* Lines ever started, the last one is being written at column x */
+static uint64_t nr_lines = 1;
+static int console_x;
+/* Lines scrolled back from the end, 0 follows the output */
+static uint64_t console_back;
+
 static void console_init()
 {
 	pthread_mutex_init(&mutex, NULL);
@@ -178,116 +200,142 @@ static void console_init()
 	wrefresh(console_win);
 }
 
-static void console_putc(char c)
+/* Furthest the view can go back */
+static uint64_t console_back_max(void)
+{
+	uint64_t kept = nr_lines < CONSOLE_HISTORY ? nr_lines : CONSOLE_HISTORY;
+
+	return kept > CONSOLE_LINES ? kept - CONSOLE_LINES : 0;
+}
+
+static void console_newline(void)
 {
-	static int y = 0, x = 0; // Record current cursor pos
+	ConsoleLine *line = &history[nr_lines % CONSOLE_HISTORY];
+
+	line->len = 0;
+	nr_lines++;
+	console_x = 0;
+	/* A scrolled back view stays on the same lines */
+	if(console_back && console_back < console_back_max()) {
+		console_back++;
+	}
+}
+
+/* Caller holds the mutex */
+static void console_emit(char c)
+{
+	ConsoleLine *line = &history[(nr_lines - 1) % CONSOLE_HISTORY];
 
 	/* Manipulate output character */
 	switch(c) {
 	case '\n':
-		y++;
-		x = 0;
+		console_newline();
 		break;
 	case '\b':
-		x--;
-		wmove(console_win, y, x);
-		break;
-	// XXX: This is a speical case, use \0 to move cursor to current prompt postion
-	case '\0':
-		wmove(console_win, y, x);
+		if(console_x > 0) {
+			console_x--;
+		}
 		break;
 	default:
-		mvwaddch(console_win, y, x, c);
-		x++;
+		if(console_x >= CONSOLE_WIDTH) { // reach column limit, new line
+			console_newline();
+			line = &history[(nr_lines - 1) % CONSOLE_HISTORY];
+		}
+		line->text[console_x++] = c;
+		if(console_x > line->len) {
+			line->len = console_x;
+		}
 	}
+}
 
-	/* Manipulate cursor postion */
-	if(x >= CONSOLE_COLS) { // reach column limit, new line
-		x = 0;
-		y++;
+/* Draw the lines in view, caller holds the mutex */
+static void console_draw(void)
+{
+	uint64_t bottom = nr_lines - 1 - console_back, first, i;
+	int rows = console_back ? CONSOLE_LINES - 1 : CONSOLE_LINES;
+	const ConsoleLine *line;
+
+	first = bottom + 1 > rows ? bottom + 1 - rows : 0;
+	werase(console_win);
+	for(i = first; i <= bottom; i++) {
+		line = &history[i % CONSOLE_HISTORY];
+		mvwaddnstr(console_win, i - first, 0, line->text, line->len);
 	}
-	if(y >= CONSOLE_LINES - 1) { // reach line limit, clear console
-		/* Clear page notice */
-		mvwaddstr(console_win, y, 0, "---- Type any key to continue ----");
-		wrefresh(console_win);
-		getchar();
-		wclear(console_win);
 
-		x = 0;
-		y = 0;
+	if(console_back) {
+		wattron(console_win, A_REVERSE);
+		mvwprintw(console_win, CONSOLE_LINES - 1, 0, "---- %lu more lines, PageDown ----", console_back);
+		wattroff(console_win, A_REVERSE);
+	}
+	else {
+		wmove(console_win, bottom - first, console_x);
 	}
 
 	wrefresh(console_win);
 }
 
+static void console_putc(char c)
+{
+	pthread_mutex_lock(&mutex);
+	if(c != '\0') {
+		console_emit(c);
+		console_draw();
+	}
+	// XXX: This is a speical case, use \0 to move cursor to current prompt postion
+	else if(console_back == 0) {
+		wmove(console_win, nr_lines > CONSOLE_LINES ? CONSOLE_LINES - 1 : nr_lines - 1, console_x);
+		wrefresh(console_win);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
 void console_puts(const char *str)
 {
 	pthread_mutex_lock(&mutex);
 	const char *cptr;
 
 	for(cptr = str; *cptr != '\0'; cptr++) {
-		console_putc(*cptr);
+		console_emit(*cptr);
 	}
+	console_draw();
 	pthread_mutex_unlock(&mutex);
 }
 
-static void parse_line(char *str)
+/* Move the view back (negative) or forward by `lines` */
+static void console_scroll(int lines)
 {
-	int count = 0;
-	int i;
-	char *pch;
-	char *words[MAX_LINE_WORDS];
-
-	for(pch = strtok(str, " \n"); pch != NULL; pch = strtok(NULL, " \n")) {
-		strcpy(words[count] = malloc((strlen(pch) + 1) * sizeof(char)), pch);
-		count++;
-	}
-
-	if(count == 0) { // empty string
-		return;
+	pthread_mutex_lock(&mutex);
+	if(lines < 0 && console_back - lines <= console_back_max()) {
+		console_back -= lines;
 	}
-
-	/* Find command */
-	for(i = 0; i < sizeof(cmd) / sizeof(CMDDefinition); i++) {
-		if(!strcmp(cmd[i].name, words[0])) {
-			break;
-		}
-	}
-
-	if(i == sizeof(cmd) / sizeof(CMDDefinition)) { // cmd not found
-		console_puts("Undefined command: \"");
-		console_puts(words[0]);
-		console_puts("\"\n");
+	else if(lines < 0) {
+		console_back = console_back_max();
 	}
 	else {
-		cmd[i].handler(count - 1, (words + 1));
-	}
-
-	/* Free dynamic allocate memory for words */
-	for(i = 0; i < count; i++) {
-		free(words[i]);
+		console_back = console_back > lines ? console_back - lines : 0;
 	}
+	console_draw();
+	pthread_mutex_unlock(&mutex);
 }
 
 void console_prompt(void)
 {
-	char line_buf[MAX_LINE_WORDS];
+	char *line_buf;
+	size_t size = 128;
 	int c;
 	int count = 0;
 
+	line_buf = malloc(size);
 	console_puts("-> ");
 	while(1) {
 		c = getch();
 		switch(c) {
 		case '\n':
+			/* Back to the end of the output */
+			console_scroll(CONSOLE_HISTORY);
 			console_putc('\n');
-			if(count == MAX_LINE_WORDS) {
-				line_buf[MAX_LINE_WORDS - 1] = '\0';
-			}
-			else {
-				line_buf[count] = '\0';
-			}
-			parse_line(line_buf);
+			line_buf[count] = '\0';
+			command_execute(line_buf);
 			count = 0;
 			console_puts("-> ");
 			break;
@@ -301,6 +349,18 @@ void console_prompt(void)
 			break;
 		case KEY_RIGHT:
 			break;
+		case KEY_NPAGE:
+			console_scroll(CONSOLE_LINES - 1);
+			break;
+		case KEY_PPAGE:
+			console_scroll(-(CONSOLE_LINES - 1));
+			break;
+		case KEY_SNEXT:
+			display_scroll(DISPLAY_ROWS);
+			break;
+		case KEY_SPREVIOUS:
+			display_scroll(-DISPLAY_ROWS);
+			break;
 		case KEY_BACKSPACE:
 			if(count > 0) {
 				console_putc('\b');
@@ -311,13 +371,23 @@ void console_prompt(void)
 			break;
 		default:
 			console_putc(c);
-			if(count < MAX_LINE_WORDS) {
-				line_buf[count++] = c;
+			/* Keep room for the terminating zero */
+			if(count + 1 == size) {
+				size *= 2;
+				line_buf = realloc(line_buf, size);
 			}
+			line_buf[count++] = c;
 		}
 	}
 }
 
+static const CMDFrontend ui_frontend = {
+	.out = console_puts,
+	.show = display_show,
+	.changed = display_changed,
+	.scroll = display_scroll,
+};
+
 /* UI initiallize and destructor */
 void ui_init(void)
 {
@@ -330,328 +400,17 @@ void ui_init(void)
 
 	display_init();
 	console_init();
+
+	command_init(&ui_frontend);
 }
 
 void ui_destroy(void)
 {
-	display_destructor();
 	endwin();
 }
 
-/* Command handler implementation */
-void cmd_display(int argc, char *argv[])
+/* Show the first step of a replayed trace */
+void display_replay(void)
 {
-	HookRegisters *it = hook_head;
-	int i, j;
-	int valid = 0;
-	int start_bit = 0, end_bit;
-	uint64_t mask = 0xFFFFFFFFFFFFFFFF;
-	char *pch;
-	char reg_name[64];
-
-	if(argc > 1) {
-		console_puts("Too many arguments\n");
-		return;
-	}
-
-	/* Parse register name.
-	 * Register name format: leading dollar sign and optional bit field
-	 * $reg_name, $reg_name[end_bit:start_bit]
-	 */
-	if(argv[0][0] != '$') {
-		console_puts("Invalid register name\n");
-		return;
-	}
-	if((pch = strchr(argv[0], '[')) != NULL) {
-		sscanf(pch, "[%d:%d]", &end_bit, &start_bit);
-		int len = end_bit - start_bit;
-
-		mask >>= (63 - len);
-		mask <<= start_bit;
-		strncpy(reg_name, argv[0] + 1, pch - argv[0] - 1 < 64 ? pch - argv[0] - 1 : 64);
-	}
-	else {
-		strncpy(reg_name, argv[0] + 1, 64);
-	}
-
-	/* Search register in registers array */
-	for(i = 0; i < sizeof(reg_array) / sizeof(struct ARMCPRegArray); i++) {
-		for(j = 0; j < reg_array[i].size; j++) {
-			if(!strcmp(reg_array[i].array[j].name, reg_name)) {
-				valid = 1;
-				break;
-			}
-		}
-
-		if(valid) {
-			break;
-		}
-	}
-
-	if(!valid) {
-		console_puts("Invalid register name\n");
-		return;
-	}
-
-	HookRegisters *tmp = (HookRegisters *)malloc(sizeof(HookRegisters));
-	strncpy(tmp->name, argv[0] + 1, 64);
-	tmp->next = NULL;
-	tmp->mask = mask;
-	tmp->const_value = reg_array[i].array[j].const_value;
-	tmp->type = reg_array[i].array[j].type;
-	tmp->fieldoffset = reg_array[i].array[j].fieldoffset;
-	tmp->start_bit = start_bit;
-
-	console_puts("Add register \"");
-	console_puts(argv[0]);
-	console_puts("\" to hook list\n");
-
-	/* First element */
-	if(it == NULL) {
-		tmp->id = 0;
-		hook_head = tmp;
-		display_update(prev_packet);
-		return;
-	}
-
-	/* Iterate to last element */
-	for(; it != NULL; it = it->next) {
-		if(!strcmp(it->name, argv[0] + 1)) {
-			console_puts("Register \"");
-			console_puts(argv[0] + 1);
-			console_puts("\" has already in hook list\n");
-			return;
-		}
-
-		if(it->next == NULL) {
-			tmp->id = it->id + 1;
-			it->next = tmp;
-			break;
-		}
-	}
-
-	display_update(prev_packet);
-}
-
-void cmd_undisplay(int argc, char *argv[])
-{
-	HookRegisters *it = hook_head, *prev;
-	int id;
-
-	if(argc > 1) {
-		console_puts("Too many arguments\n");
-	}
-
-	id = atoi(argv[0]);
-
-	if(it == NULL) {
-		console_puts("Display list is empty!\n");
-		return;
-	}
-
-	for(prev = NULL; it != NULL; prev = it, it = it->next) {
-		if(it->id == id) {
-			console_puts("Undisplay \"");
-			console_puts(it->name);
-			console_puts("\"\n");
-			if(prev == NULL) {
-				hook_head = it->next;
-				free(it);
-			}
-			else {
-				prev->next = it->next;
-				free(it);
-			}
-			display_update(prev_packet);
-			return;
-		}
-	}
-	console_puts("Display number ");
-	console_puts(argv[0]);
-	console_puts(" is not in the hook list!\n");
-}
-
-void cmd_print(int argc, char *argv[])
-{
-	ARMCPRegInfo tmp;
-	uint64_t value;
-	int valid = 0, i, j;
-	int start_bit = 0, end_bit;
-	char str[128] = {0};
-	char reg_name[64] = {0};
-	char reg[64] = {0};
-	char format = 'x'; // default format hexadecimal
-	char *pch;
-	uint64_t mask = 0xFFFFFFFFFFFFFFFF;
-
-	/* Print register format:
-	 * print $MIDR[31:16]
-	 * print /x $MIDR[31:16] (x, d, u, o)
-	 */
-	if(argc == 1) {
-		strncpy(reg, argv[0], 64);
-	}
-	else if(argc == 2) {
-		if(argv[0][0] != '/') {
-			console_puts("Invalid format\n");
-			return;
-		}
-		format = argv[0][1];
-		strncpy(reg, argv[1], 64);
-	}
-	else {
-		console_puts("Too many arguments\n");
-		return;
-	}
-
-	if(reg[0] != '$') {
-		console_puts("Invalid register name\n");
-		return;
-	}
-	
-	pch = strchr(reg, '[');
-	if(pch != NULL) {
-		sscanf(pch, "[%d:%d]", &end_bit, &start_bit);
-		strncpy(reg_name, reg + 1, pch - reg - 1 < 64 ? pch - reg - 1 : 64);
-		int len = end_bit - start_bit;
-		mask >>= (63 - len);
-		mask <<= start_bit;
-	}
-	else {
-		strncpy(reg_name, reg + 1, 64);
-	}
-		
-
-	/* Search register in registers array */
-	for(i = 0; i < sizeof(reg_array) / sizeof(struct ARMCPRegArray); i++) {
-		for(j = 0; j < reg_array[i].size; j++) {
-			if(!strcmp(reg_array[i].array[j].name, reg_name)) {
-				valid = 1;
-				tmp = reg_array[i].array[j];
-				break;
-			}
-		}
-
-		if(valid) {
-			break;
-		}
-	}
-
-	if(!valid) {
-		console_puts("Invalid register name\n");
-		return;
-	}
-
-	switch(tmp.type) {
-	case ARM_CP_UNIMPL:
-		console_puts("UNIMPLEMENTED\n");
-		return;
-	case ARM_CP_CONST:
-		value = tmp.const_value;
-		break;
-	case ARM_CP_NORMAL_L:
-		value = *(uint32_t *)((uint8_t *)(&prev_packet) + tmp.fieldoffset);
-		break;
-	case ARM_CP_NORMAL_H:
-		value = *(uint64_t *)((uint8_t *)(&prev_packet) + tmp.fieldoffset);
-		break;
-	}
-
-	switch(format) {
-	case 'o':
-		sprintf(str, "%s = %#lo\n", reg + 1, (value & mask) >> start_bit);
-		break;
-	case 'x':
-		sprintf(str, "%s = %#lx\n", reg + 1, (value & mask) >> start_bit);
-		break;
-	case 'd':
-		sprintf(str, "%s = %ld\n", reg + 1, (value & mask) >> start_bit);
-		break;
-	case 'u':
-		sprintf(str, "%s = %lu\n", reg + 1, (value & mask) >> start_bit);
-		break;
-	default:
-		sprintf(str, "Invalid format\n");
-	}
-	console_puts(str);
-}
-
-void cmd_store(int argc, char *argv[])
-{
-	HookRegisters *it;
-	char filename[32] = "cli.cmd"; // default output file name
-	FILE *fout;
-
-	if(argc > 1) {
-		console_puts("Too many arguments\n");
-		return;
-	}
-
-	if(argc == 1) {
-		strncpy(filename, argv[0], 32);
-	}
-
-	// TODO: file process exception handling
-	fout = fopen(filename, "w");
-
-	for(it = hook_head; it != NULL; it = it->next) {
-		fprintf(fout, "display $%s\n", it->name);
-	}
-
-	console_puts("Store display list to \"");
-	console_puts(filename);
-	console_puts("\"\n");
-	fclose(fout);
-}
-
-void cmd_load(int argc, char *argv[])
-{
-	char filename[32] = "cli.cmd"; // default input file name
-	char line_buf[128] = {0};
-	FILE *fin;
-
-	if(argc > 1) {
-		console_puts("Too many arguments\n");
-		return;
-	}
-
-	if(argc == 1) {
-		strncpy(filename, argv[0], 32);
-	}
-
-	// TODO: file process exception handling
-	fin = fopen(filename, "r");
-	console_puts("Load command script from \"");
-	console_puts(filename);
-	console_puts("\"\n");
-
-	while(fgets(line_buf, 128, fin) != NULL) {
-		console_puts("-> ");
-		console_puts(line_buf);
-		parse_line(line_buf);
-	}
-
-	fclose(fin);
-}
-
-void cmd_refresh(int argc, char *argv[])
-{
-	display_update(prev_packet);
-}
-
-void cmd_quit(int argc, char *argv[])
-{
-	pthread_exit(0);
-}
-
-void cmd_help(int argc, char *argv[])
-{
-	int i;
-
-	for(i = 0; i < sizeof(cmd) / sizeof(CMDDefinition); i++) {
-		console_puts(cmd[i].name);
-		console_puts(" : ");
-		console_puts(cmd[i].desc);
-		console_puts("\n");
-	}
+	command_replay();
 }